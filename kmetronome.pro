@@ -26,13 +26,35 @@ DBUS_ADAPTORS += src/net.sourceforge.kmetronome.xml
 HEADERS += src/drumgrid.h \
     src/helpwindow.h \
     src/iconutils.h \
+    src/drumgriddelegate.h \
     src/drumgridmodel.h \
+    src/audioclickengine.h \
+    src/clickgenerator.h \
+    src/clicksynth.h \
+    src/compiledpattern.h \
     src/instrument.h \
+    src/instrumentcache.h \
+    src/instrumentlibrary.h \
+    src/instrumentmodels.h \
+    src/patternlibrary.h \
+    src/patternmodels.h \
+    src/patterntransfer.h \
     src/kmetronome.h \
     src/kmetropreferences.h \
     src/sequenceradapter.h \
+    src/songtimeline.h \
+    src/wavclickwriter.h \
+    src/offlinerenderer.h \
+    src/smfclickwriter.h \
+    src/smfpatternreader.h \
+    src/smfreader.h \
+    src/smftemporeader.h \
     src/about.h \
-    src/lcdnumberview.h
+    src/arrangement.h \
+    src/lcdnumberview.h \
+    src/mixkernel.h \
+    src/metricsexporter.h \
+    src/startuptrace.h
 
 FORMS += src/about.ui \
     src/drumgrid.ui \
@@ -42,14 +64,36 @@ FORMS += src/about.ui \
 SOURCES += src/drumgrid.cpp \
     src/helpwindow.cpp \
     src/iconutils.cpp \
+    src/drumgriddelegate.cpp \
     src/drumgridmodel.cpp \
+    src/audioclickengine.cpp \
+    src/clickgenerator.cpp \
+    src/clicksynth.cpp \
+    src/compiledpattern.cpp \
     src/instrument.cpp \
+    src/instrumentcache.cpp \
+    src/instrumentlibrary.cpp \
+    src/instrumentmodels.cpp \
+    src/patternlibrary.cpp \
+    src/patternmodels.cpp \
+    src/patterntransfer.cpp \
     src/kmetronome.cpp \
     src/kmetropreferences.cpp \
     src/main.cpp \
     src/sequenceradapter.cpp \
+    src/songtimeline.cpp \
+    src/wavclickwriter.cpp \
+    src/offlinerenderer.cpp \
+    src/smfclickwriter.cpp \
+    src/smfpatternreader.cpp \
+    src/smfreader.cpp \
+    src/smftemporeader.cpp \
     src/about.cpp \
-    src/lcdnumberview.cpp
+    src/arrangement.cpp \
+    src/lcdnumberview.cpp \
+    src/mixkernel.cpp \
+    src/metricsexporter.cpp \
+    src/startuptrace.cpp
 
 RESOURCES += src/kmetronome.qrc \
     doc/docs.qrc \
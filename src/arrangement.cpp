@@ -0,0 +1,134 @@
+/***************************************************************************
+ *   KMetronome - ALSA Sequencer based MIDI metronome                      *
+ *   Copyright (C) 2005-2021 Pedro Lopez-Cabanillas <plcl@users.sf.net>    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
+ ***************************************************************************/
+
+
+#include <QDebug>
+#include "arrangement.h"
+#include "compiledpattern.h"
+#include "defs.h"
+#include "patternlibrary.h"
+
+CompiledArrangement::CompiledArrangement(const QVector<ArrangementStep>& steps, bool loop) :
+    m_steps(steps),
+    m_patterns(steps.count()),
+    m_loop(loop)
+{ }
+
+/* The step after the given one, or -1 after the last one when not looping */
+int CompiledArrangement::next(int index) const
+{
+    if (index + 1 < m_steps.count())
+        return index + 1;
+    return m_loop ? 0 : -1;
+}
+
+std::shared_ptr<const CompiledPattern> CompiledArrangement::pattern(int index) const
+{
+    return std::atomic_load(&m_patterns[index]);
+}
+
+void CompiledArrangement::setPattern(int index, const std::shared_ptr<const CompiledPattern>& pattern)
+{
+    std::atomic_store(&m_patterns[index], pattern);
+}
+
+PatternArrangement::PatternArrangement(PatternLibrary* library, QObject* parent) :
+    QObject(parent),
+    m_library(library),
+    m_loop(true)
+{ }
+
+void PatternArrangement::clear()
+{
+    m_steps.clear();
+}
+
+/**
+ * Adds a step at the end. Steps of unknown patterns, or too short or
+ * too long, are refused.
+ */
+bool PatternArrangement::append(const ArrangementStep& step)
+{
+    if (step.bars < 1 || step.bars > ARRANGEMENT_BARS_MAX)
+        return false;
+    if (!step.isRest() && !m_library->contains(step.pattern))
+        return false;
+    m_steps.append(step);
+    return true;
+}
+
+/* One "bars:pattern" line for each step; rests have no pattern name */
+QStringList PatternArrangement::description() const
+{
+    QStringList lines;
+    foreach(const ArrangementStep& step, m_steps)
+        lines += QString("%1:%2").arg(step.bars).arg(step.pattern);
+    return lines;
+}
+
+/**
+ * The arrangement to be played, with the first two steps already
+ * compiled. It replaces the one playing, if any.
+ */
+std::shared_ptr<CompiledArrangement> PatternArrangement::start()
+{
+    m_playing = std::make_shared<CompiledArrangement>(m_steps, m_loop);
+    if (m_playing->count() > 0)
+        prefetch(0);
+    return m_playing;
+}
+
+/**
+ * The sequencer started scheduling the given step: compiles the pattern
+ * of the next one, reusing the current one when it is the same, and
+ * releases the patterns of the other steps.
+ */
+void PatternArrangement::prefetch(int step)
+{
+    if (!m_playing || step < 0 || step >= m_playing->count())
+        return;
+    int next = m_playing->next(step);
+    std::shared_ptr<const CompiledPattern> current = m_playing->pattern(step);
+    if (!current) {
+        current = compile(step);
+        m_playing->setPattern(step, current);
+    }
+    if (next >= 0 && next != step && !m_playing->pattern(next)) {
+        if (m_playing->step(next).pattern == m_playing->step(step).pattern)
+            m_playing->setPattern(next, current);
+        else
+            m_playing->setPattern(next, compile(next));
+    }
+    for (int i = 0; i < m_playing->count(); ++i) {
+        if (i != step && i != next)
+            m_playing->setPattern(i, nullptr);
+    }
+}
+
+std::shared_ptr<const CompiledPattern> PatternArrangement::compile(int step) const
+{
+    const ArrangementStep& s = m_playing->step(step);
+    if (s.isRest())
+        return nullptr;
+    Pattern pattern;
+    if (!m_library->load(s.pattern, pattern)) {
+        qWarning() << "Arrangement pattern not found:" << s.pattern;
+        return nullptr;
+    }
+    return std::make_shared<const CompiledPattern>(pattern);
+}
@@ -0,0 +1,112 @@
+/***************************************************************************
+ *   KMetronome - ALSA Sequencer based MIDI metronome                      *
+ *   Copyright (C) 2005-2021 Pedro Lopez-Cabanillas <plcl@users.sf.net>    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
+ ***************************************************************************/
+
+
+#ifndef ARRANGEMENT_H
+#define ARRANGEMENT_H
+
+#include <memory>
+#include <vector>
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+
+class CompiledPattern;
+class PatternLibrary;
+
+/**
+ * A step of an arrangement: some bars of a stored pattern, or of silence
+ * when the pattern name is empty. A pattern longer than the step is cut,
+ * and a shorter one is repeated.
+ */
+class ArrangementStep
+{
+public:
+    ArrangementStep() : bars(1) {}
+    ArrangementStep(const QString& name, int count) : pattern(name), bars(count) {}
+
+    bool isRest() const { return pattern.isEmpty(); }
+
+    QString pattern;
+    int bars;
+};
+
+/**
+ * The arrangement as read by the sequencer: the length of every step, and
+ * the compiled patterns of the steps being played or coming next. The
+ * steps are fixed when it is built; the patterns are swapped atomically
+ * by the GUI thread while the ALSA thread reads them.
+ */
+class CompiledArrangement
+{
+public:
+    CompiledArrangement(const QVector<ArrangementStep>& steps, bool loop);
+
+    int count() const { return m_steps.count(); }
+    const ArrangementStep& step(int index) const { return m_steps.at(index); }
+    bool loop() const { return m_loop; }
+    int next(int index) const;
+    std::shared_ptr<const CompiledPattern> pattern(int index) const;
+    void setPattern(int index, const std::shared_ptr<const CompiledPattern>& pattern);
+
+private:
+    const QVector<ArrangementStep> m_steps;
+    std::vector<std::shared_ptr<const CompiledPattern>> m_patterns;
+    const bool m_loop;
+};
+
+/**
+ * A list of patterns played one after another, like "8 bars of bossa1,
+ * 4 bars of calypso, 2 bars of silence", once or repeated forever.
+ *
+ * Only the patterns of the step being played and the next one are kept
+ * compiled. When the sequencer starts scheduling a step it signals it,
+ * and prefetch() loads and compiles the pattern of the following step,
+ * so it is ready at least one bar before its first bar is scheduled.
+ * Changing the steps doesn't affect an arrangement already playing.
+ */
+class PatternArrangement : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit PatternArrangement(PatternLibrary* library, QObject* parent = nullptr);
+
+    void clear();
+    bool append(const ArrangementStep& step);
+    QVector<ArrangementStep> steps() const { return m_steps; }
+    bool isEmpty() const { return m_steps.isEmpty(); }
+    void setLoop(bool loop) { m_loop = loop; }
+    bool loop() const { return m_loop; }
+    QStringList description() const;
+    std::shared_ptr<CompiledArrangement> start();
+
+public slots:
+    void prefetch(int step);
+
+private:
+    std::shared_ptr<const CompiledPattern> compile(int step) const;
+
+    PatternLibrary* m_library;
+    QVector<ArrangementStep> m_steps;
+    std::shared_ptr<CompiledArrangement> m_playing;
+    bool m_loop;
+};
+
+#endif // ARRANGEMENT_H
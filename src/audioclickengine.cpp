@@ -0,0 +1,335 @@
+/***************************************************************************
+ *   KMetronome - ALSA Sequencer based MIDI metronome                      *
+ *   Copyright (C) 2005-2021 Pedro Lopez-Cabanillas <plcl@users.sf.net>    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
+ ***************************************************************************/
+
+
+#include <algorithm>
+#include <vector>
+#include <alsa/asoundlib.h>
+#include "audioclickengine.h"
+
+AudioClickEngine::AudioClickEngine(QObject* parent)
+    : QThread(parent),
+    m_synth(AUDIO_SAMPLE_RATE),
+    m_device(QSTR_AUDIO_DEVICE),
+    m_periodSize(AUDIO_PERIOD),
+    m_resolution(METRONOME_RESOLUTION),
+    m_frame(0),
+    m_anchorFrame(0),
+    m_anchorTick(0),
+    m_framesPerTick(0),
+    m_queueTime(-1),
+    m_queueClock(0),
+    m_queueOffset(0),
+    m_shift(0),
+    m_synced(false),
+    m_stop(false),
+    m_failed(false),
+    m_volume(METRONOME_VOLUME),
+    m_balance(METRONOME_PAN),
+    m_latency(0),
+    m_xruns(0),
+    m_lateNotes(0)
+{
+    m_clock.start();
+}
+
+AudioClickEngine::~AudioClickEngine()
+{
+    stopPlayback();
+}
+
+double AudioClickEngine::framesPerTick(qreal bpm) const
+{
+    return 60.0 * m_synth.sampleRate() / (bpm * m_resolution);
+}
+
+double AudioClickEngine::frameOf(double tick) const
+{
+    return m_anchorFrame + (tick - m_anchorTick) * m_framesPerTick;
+}
+
+/**
+ * Forgets the events and the position of the previous playback, and any
+ * failure. The first frame played afterwards is tick zero, at the given
+ * resolution and tempo.
+ */
+void AudioClickEngine::resetPlayback(int ppq, qreal bpm)
+{
+    stopPlayback();
+    QMutexLocker locker(&m_mutex);
+    m_failed.store(false);
+    m_resolution = ppq;
+    m_incoming.clear();
+    m_events.clear();
+    m_synth.reset();
+    m_frame = 0;
+    m_anchorFrame = 0;
+    m_anchorTick = 0;
+    m_framesPerTick = framesPerTick(bpm);
+    m_queueTime = -1;
+    m_shift = 0;
+    m_synced = false;
+}
+
+/* Starts the engine thread, or resumes where it was stopped */
+void AudioClickEngine::startPlayback()
+{
+    if (isRunning())
+        return;
+    {
+        // the queue time read before a pause is stale
+        QMutexLocker locker(&m_mutex);
+        m_queueTime = -1;
+    }
+    m_stop.store(false);
+    start(QThread::TimeCriticalPriority);
+}
+
+void AudioClickEngine::stopPlayback()
+{
+    m_stop.store(true);
+    wait();
+}
+
+/* A tempo change now, rather than at a scheduled tick */
+void AudioClickEngine::setTempo(qreal bpm)
+{
+    Event event = { -1, -1, 0, bpm };
+    schedule(event);
+}
+
+void AudioClickEngine::scheduleNote(int tick, int key, int velocity)
+{
+    Event event = { tick, key, velocity, 0 };
+    schedule(event);
+}
+
+void AudioClickEngine::scheduleTempo(int tick, qreal bpm)
+{
+    Event event = { tick, -1, 0, bpm };
+    schedule(event);
+}
+
+/* The ALSA queue has just reached this real time, in microseconds */
+void AudioClickEngine::syncQueue(qint64 usecs)
+{
+    if (m_failed.load())
+        return;
+    QMutexLocker locker(&m_mutex);
+    m_queueTime = usecs;
+    m_queueClock = m_clock.nsecsElapsed();
+}
+
+void AudioClickEngine::schedule(const Event& event)
+{
+    if (m_failed.load())
+        return;
+    QMutexLocker locker(&m_mutex);
+    m_incoming.push_back(event);
+}
+
+/* Stops queueing events after a device error, and tells the GUI thread */
+void AudioClickEngine::fail(const QString& message)
+{
+    m_failed.store(true);
+    {
+        QMutexLocker locker(&m_mutex);
+        m_incoming.clear();
+    }
+    m_events.clear();
+    emit failed(message);
+}
+
+/**
+ * Moves the events received since the last period into the tick ordered
+ * list of the engine thread. Tempo changes without a tick take effect at
+ * the start of the next period.
+ */
+void AudioClickEngine::takeEvents()
+{
+    std::deque<Event> incoming;
+    {
+        QMutexLocker locker(&m_mutex);
+        incoming.swap(m_incoming);
+    }
+    for (const Event& event : incoming) {
+        if (event.tick < 0) {
+            m_anchorTick = m_anchorTick + (m_frame - m_anchorFrame) / m_framesPerTick;
+            m_anchorFrame = m_frame;
+            m_framesPerTick = framesPerTick(event.bpm);
+            continue;
+        }
+        std::deque<Event>::iterator it = m_events.end();
+        if (!m_events.empty() && m_events.back().tick > event.tick) {
+            it = std::upper_bound(m_events.begin(), m_events.end(), event,
+                    [](const Event& a, const Event& b) { return a.tick < b.tick; });
+        }
+        m_events.insert(it, event);
+    }
+}
+
+/**
+ * Renders one period, starting the notes that fall within it at their
+ * frame. Notes received too late to be played on time start at the
+ * beginning of the period.
+ */
+void AudioClickEngine::renderPeriod(qint16* output, int frames)
+{
+    m_synth.setVolume(m_volume.load());
+    m_synth.setBalance(m_balance.load());
+    const qint64 end = m_frame + frames;
+    while (!m_events.empty()) {
+        const Event& event = m_events.front();
+        double frame = frameOf(event.tick);
+        if (frame >= end)
+            break;
+        if (event.key < 0) {
+            m_anchorFrame = frame;
+            m_anchorTick = event.tick;
+            m_framesPerTick = framesPerTick(event.bpm);
+        } else {
+            qint64 offset = qint64(frame) - m_frame;
+            if (offset < 0) {
+                m_lateNotes.fetch_add(1, std::memory_order_relaxed);
+                offset = 0;
+            }
+            m_synth.noteOn(event.key, event.velocity, int(offset));
+        }
+        m_events.pop_front();
+    }
+    m_synth.render(output, frames);
+    m_frame = end;
+}
+
+/**
+ * Compares the real time of the queue passed to syncQueue() with the
+ * frames played, the written ones but the delay of the device. The
+ * first comparison after a reset is the reference; later, the frames of
+ * the following ticks are moved by the drift from it, when it exceeds a
+ * period, as some devices only report the delay with that precision.
+ */
+void AudioClickEngine::resync(qint64 delay, int period)
+{
+    qint64 queueTime, queueClock;
+    {
+        QMutexLocker locker(&m_mutex);
+        if (m_queueTime < 0)
+            return;
+        queueTime = m_queueTime;
+        queueClock = m_queueClock;
+        m_queueTime = -1;
+    }
+    double elapsed = queueTime * 1000.0 + (m_clock.nsecsElapsed() - queueClock);
+    double offset = elapsed * m_synth.sampleRate() / 1e9 - (m_frame - delay);
+    if (!m_synced) {
+        m_queueOffset = offset;
+        m_synced = true;
+        return;
+    }
+    double shift = m_queueOffset - offset;
+    if (qAbs(shift - m_shift) < period)
+        return;
+    m_anchorFrame += shift - m_shift;
+    m_shift = shift;
+}
+
+static int configure(snd_pcm_t* pcm, unsigned int rate,
+                     snd_pcm_uframes_t& period, snd_pcm_uframes_t& buffer)
+{
+    snd_pcm_hw_params_t* hw;
+    snd_pcm_hw_params_alloca(&hw);
+    int err = snd_pcm_hw_params_any(pcm, hw);
+    if (err < 0)
+        return err;
+    if ((err = snd_pcm_hw_params_set_rate_resample(pcm, hw, 1)) < 0 ||
+        (err = snd_pcm_hw_params_set_access(pcm, hw, SND_PCM_ACCESS_RW_INTERLEAVED)) < 0 ||
+        (err = snd_pcm_hw_params_set_format(pcm, hw, SND_PCM_FORMAT_S16)) < 0 ||
+        (err = snd_pcm_hw_params_set_channels(pcm, hw, 2)) < 0 ||
+        (err = snd_pcm_hw_params_set_rate(pcm, hw, rate, 0)) < 0 ||
+        (err = snd_pcm_hw_params_set_period_size_near(pcm, hw, &period, nullptr)) < 0)
+        return err;
+    unsigned int periods = AUDIO_PERIODS;
+    if ((err = snd_pcm_hw_params_set_periods_near(pcm, hw, &periods, nullptr)) < 0 ||
+        (err = snd_pcm_hw_params(pcm, hw)) < 0)
+        return err;
+    snd_pcm_hw_params_get_period_size(hw, &period, nullptr);
+    snd_pcm_hw_params_get_buffer_size(hw, &buffer);
+
+    snd_pcm_sw_params_t* sw;
+    snd_pcm_sw_params_alloca(&sw);
+    if ((err = snd_pcm_sw_params_current(pcm, sw)) < 0 ||
+        (err = snd_pcm_sw_params_set_avail_min(pcm, sw, period)) < 0 ||
+        (err = snd_pcm_sw_params_set_start_threshold(pcm, sw, buffer)) < 0)
+        return err;
+    return snd_pcm_sw_params(pcm, sw);
+}
+
+void AudioClickEngine::run()
+{
+    const unsigned int rate = unsigned(m_synth.sampleRate());
+    snd_pcm_t* pcm = nullptr;
+    int err = snd_pcm_open(&pcm, m_device.toLocal8Bit().constData(), SND_PCM_STREAM_PLAYBACK, 0);
+    snd_pcm_uframes_t period = snd_pcm_uframes_t(qBound(AUDIO_PERIOD_MIN, m_periodSize, AUDIO_PERIOD_MAX));
+    snd_pcm_uframes_t buffer = period * AUDIO_PERIODS;
+    if (err >= 0)
+        err = configure(pcm, rate, period, buffer);
+    if (err < 0) {
+        if (pcm != nullptr)
+            snd_pcm_close(pcm);
+        fail(tr("Cannot open the audio device %1: %2").arg(m_device, QString::fromLocal8Bit(snd_strerror(err))));
+        return;
+    }
+    m_latency.store(qint64(buffer) * 1000000 / rate, std::memory_order_relaxed);
+    emit latencyChanged(latency());
+
+    std::vector<qint16> samples(period * 2);
+    while (!m_stop.load()) {
+        takeEvents();
+        renderPeriod(samples.data(), int(period));
+        const qint16* data = samples.data();
+        snd_pcm_uframes_t left = period;
+        while (left > 0 && !m_stop.load()) {
+            snd_pcm_sframes_t written = snd_pcm_writei(pcm, data, left);
+            if (written == -EAGAIN)
+                continue;
+            if (written < 0) {
+                if (written == -EPIPE)
+                    m_xruns.fetch_add(1, std::memory_order_relaxed);
+                err = snd_pcm_recover(pcm, int(written), 1);
+                if (err < 0) {
+                    fail(tr("Audio output error: %1").arg(QString::fromLocal8Bit(snd_strerror(err))));
+                    m_stop.store(true);
+                }
+                continue;
+            }
+            data += written * 2;
+            left -= snd_pcm_uframes_t(written);
+        }
+        snd_pcm_sframes_t delay;
+        if (snd_pcm_delay(pcm, &delay) == 0 && delay >= 0) {
+            m_latency.store(qint64(delay) * 1000000 / rate, std::memory_order_relaxed);
+            resync(delay, int(period));
+        }
+    }
+    // the frames dropped are never played, and resuming starts from them
+    snd_pcm_sframes_t delay;
+    if (snd_pcm_delay(pcm, &delay) == 0 && delay > 0)
+        m_frame -= qMin(qint64(delay), m_frame);
+    snd_pcm_drop(pcm);
+    snd_pcm_close(pcm);
+}
@@ -0,0 +1,131 @@
+/***************************************************************************
+ *   KMetronome - ALSA Sequencer based MIDI metronome                      *
+ *   Copyright (C) 2005-2021 Pedro Lopez-Cabanillas <plcl@users.sf.net>    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
+ ***************************************************************************/
+
+
+#ifndef AUDIOCLICKENGINE_H
+#define AUDIOCLICKENGINE_H
+
+#include <atomic>
+#include <deque>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QString>
+#include <QThread>
+#include "clicksynth.h"
+
+/**
+ * Plays the metronome clicks through an ALSA PCM device, with the
+ * built-in ClickSynth, instead of sending MIDI notes to a synthesizer.
+ *
+ * The sequencer keeps making the bars as usual, and hands the notes and
+ * tempo changes of every bar to the engine a bar ahead, tagged with their
+ * ticks. The engine thread converts the ticks to frames along the tempo
+ * changes, and starts each click at its exact frame within the period
+ * being rendered. Periods are small and only two of them are buffered,
+ * so the output latency is the time of a few hundred frames; the latency
+ * measured on the device and the number of buffer underruns are kept.
+ *
+ * The sound card clock drifts from the system timer driving the ALSA
+ * queue, so once per bar the sequencer passes the real time of the queue
+ * to syncQueue(). The engine compares it with the frames played so far,
+ * and moves the frames of the following ticks by the drift measured
+ * since the start of the playback.
+ *
+ * The device and the period size are read by the engine thread, so they
+ * are only set before the first playback. When the device fails, the
+ * engine drops the pending events, refuses new ones until the next reset
+ * and emits failed().
+ */
+class AudioClickEngine : public QThread
+{
+    Q_OBJECT
+
+public:
+    explicit AudioClickEngine(QObject* parent = nullptr);
+    virtual ~AudioClickEngine();
+
+    void setDevice(const QString& device) { m_device = device; }
+    QString device() const { return m_device; }
+    void setPeriodSize(int frames) { m_periodSize = frames; }
+    int periodSize() const { return m_periodSize; }
+    void setVolume(int volume) { m_volume.store(volume); }
+    void setBalance(int balance) { m_balance.store(balance); }
+
+    void resetPlayback(int ppq, qreal bpm);
+    void startPlayback();
+    void stopPlayback();
+    void setTempo(qreal bpm);
+    void scheduleNote(int tick, int key, int velocity);
+    void scheduleTempo(int tick, qreal bpm);
+    void syncQueue(qint64 usecs);
+
+    qint64 latency() const { return m_latency.load(std::memory_order_relaxed); }
+    quint64 xruns() const { return m_xruns.load(std::memory_order_relaxed); }
+    quint64 lateNotes() const { return m_lateNotes.load(std::memory_order_relaxed); }
+
+Q_SIGNALS:
+    void latencyChanged(qint64 usecs);
+    void failed(const QString& message);
+
+protected:
+    void run() override;
+
+private:
+    /* A note, or a tempo change when the key is negative */
+    struct Event {
+        int tick;
+        int key;
+        int velocity;
+        qreal bpm;
+    };
+
+    void schedule(const Event& event);
+    void fail(const QString& message);
+    void takeEvents();
+    void renderPeriod(qint16* output, int frames);
+    void resync(qint64 delay, int period);
+    double frameOf(double tick) const;
+    double framesPerTick(qreal bpm) const;
+
+    ClickSynth m_synth;
+    QMutex m_mutex;
+    std::deque<Event> m_incoming; /* guarded by the mutex */
+    std::deque<Event> m_events;   /* owned by the engine thread */
+    QString m_device;
+    int m_periodSize;
+    int m_resolution;
+    qint64 m_frame;        /* first frame of the next period */
+    double m_anchorFrame;  /* frame of the last tempo change */
+    double m_anchorTick;   /* tick of the last tempo change */
+    double m_framesPerTick;
+    QElapsedTimer m_clock;
+    qint64 m_queueTime;    /* guarded by the mutex, microseconds or -1 */
+    qint64 m_queueClock;   /* guarded by the mutex, when it was read */
+    double m_queueOffset;  /* queue frames ahead of the played ones */
+    double m_shift;        /* frames moved to follow the queue */
+    bool m_synced;
+    std::atomic<bool> m_stop;
+    std::atomic<bool> m_failed;
+    std::atomic<int> m_volume;
+    std::atomic<int> m_balance;
+    std::atomic<qint64> m_latency; /* microseconds */
+    std::atomic<quint64> m_xruns;
+    std::atomic<quint64> m_lateNotes;
+};
+
+#endif // AUDIOCLICKENGINE_H
@@ -0,0 +1,126 @@
+/***************************************************************************
+ *   KMetronome - ALSA Sequencer based MIDI metronome                      *
+ *   Copyright (C) 2005-2021 Pedro Lopez-Cabanillas <plcl@users.sf.net>    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
+ ***************************************************************************/
+
+
+#include "clickgenerator.h"
+#include "compiledpattern.h"
+#include "songtimeline.h"
+
+ClickGenerator::ClickGenerator() :
+    m_resolution(METRONOME_RESOLUTION),
+    m_ts_num(RHYTHM_TS_NUM),
+    m_ts_div(RHYTHM_TS_DEN),
+    m_weak_note(METRONOME_WEAK_NOTE),
+    m_strong_note(METRONOME_STRONG_NOTE),
+    m_weak_velocity(METRONOME_VELOCITY),
+    m_strong_velocity(METRONOME_VELOCITY)
+{ }
+
+int ClickGenerator::decodeVelocity(char cell) const
+{
+    const qreal f = 127.0 / 9.0;
+    if (cell == 'f')
+        return m_strong_velocity;
+    else if (cell == 'p')
+        return m_weak_velocity;
+    else if (cell >= '1' && cell <= '9')
+        return qRound(f * (cell - '0'));
+    return 0;
+}
+
+int ClickGenerator::decodeTag(char cell)
+{
+    if (cell == 'f')
+        return TAG_STRONG;
+    else if (cell == 'p')
+        return TAG_WEAK;
+    return TAG_FIXED;
+}
+
+/* A strong click on the first beat and weak ones on the others */
+int ClickGenerator::clicks(ClickSink& sink, int tick, int numerator, int denominator) const
+{
+    int t = tick;
+    int duration = m_resolution * 4 / denominator;
+    for (int j = 0; j < numerator; j++) {
+        if (j == 0)
+            sink.clickNote(m_strong_note, m_strong_velocity, t, TAG_STRONG);
+        else
+            sink.clickNote(m_weak_note, m_weak_velocity, t, TAG_WEAK);
+        sink.clickBeat(t);
+        t += duration;
+    }
+    sink.clickBarEnd(t);
+    return t;
+}
+
+int ClickGenerator::simpleBar(ClickSink& sink, int tick) const
+{
+    return clicks(sink, tick, m_ts_num, m_ts_div);
+}
+
+/**
+ * A bar of a drum pattern, expanding only the hits of its own columns.
+ */
+int ClickGenerator::patternBar(ClickSink& sink, const CompiledPattern& pattern, int bar, int tick) const
+{
+    int t = tick;
+    int duration = m_resolution * 4 / pattern.figure();
+    int first = bar * pattern.beats();
+    for (int c = first; c < first + pattern.beats(); ++c) {
+        for (const CompiledPattern::Hit* hit = pattern.begin(c); hit != pattern.end(c); ++hit)
+            sink.clickNote(hit->key, decodeVelocity(hit->cell), t, decodeTag(hit->cell));
+        sink.clickBeat(t);
+        t += duration;
+    }
+    sink.clickBarEnd(t);
+    return t;
+}
+
+/* A bar of silence, with the beats of the automatic rhythm */
+int ClickGenerator::restBar(ClickSink& sink, int tick) const
+{
+    int t = tick;
+    int duration = m_resolution * 4 / m_ts_div;
+    for (int j = 0; j < m_ts_num; j++) {
+        sink.clickBeat(t);
+        t += duration;
+    }
+    sink.clickBarEnd(t);
+    return t;
+}
+
+/**
+ * A bar of the song timeline: its meter when it changes there, the tempo
+ * changes inside it, and the clicks of its meter. The tempo at tick zero
+ * is left to the caller.
+ */
+int ClickGenerator::songBar(ClickSink& sink, const SongTimeline& timeline, int bar) const
+{
+    const SongTimeline::Meter& meter = timeline.meterAt(bar);
+    qint64 start = timeline.barTick(bar);
+    qint64 end = timeline.barTick(bar + 1);
+    if (meter.bar == bar)
+        sink.clickMeter(int(start), meter.numerator, meter.denominator);
+    for (int i = timeline.tempoIndex(start); i < timeline.tempoCount() &&
+         timeline.tempo(i).tick < end; ++i) {
+        if (timeline.tempo(i).tick > 0)
+            sink.clickTempo(int(timeline.tempo(i).tick), timeline.tempo(i).bpm);
+    }
+    return clicks(sink, int(start), meter.numerator, meter.denominator);
+}
@@ -0,0 +1,97 @@
+/***************************************************************************
+ *   KMetronome - ALSA Sequencer based MIDI metronome                      *
+ *   Copyright (C) 2005-2021 Pedro Lopez-Cabanillas <plcl@users.sf.net>    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
+ ***************************************************************************/
+
+
+#ifndef CLICKGENERATOR_H
+#define CLICKGENERATOR_H
+
+#include <QtGlobal>
+#include "defs.h"
+
+class CompiledPattern;
+class SongTimeline;
+
+const int TAG_FIXED(0);
+const int TAG_WEAK(1);
+const int TAG_STRONG(2);
+
+/**
+ * Receives the events of the bars made by a ClickGenerator, in time order
+ * within each bar. The tag of a note tells whether it is a strong or weak
+ * click, whose velocity may still change, or a fixed pattern hit.
+ */
+class ClickSink
+{
+public:
+    virtual ~ClickSink() {}
+    virtual void clickNote(int key, int velocity, int tick, int tag) = 0;
+    virtual void clickBeat(int) {}
+    virtual void clickBarEnd(int) {}
+    virtual void clickTempo(int, qreal) {}
+    virtual void clickMeter(int, int, int) {}
+};
+
+/**
+ * Makes the bars of the metronome: the automatic rhythm, the bars of a
+ * drum pattern, rests and the bars of a song timeline. It only knows the
+ * rhythm and the click notes; where the events go is up to the sink, so
+ * the sequencer and the offline renderers play exactly the same bars.
+ * Each method returns the tick where the following bar starts.
+ */
+class ClickGenerator
+{
+public:
+    ClickGenerator();
+
+    void setResolution(int newValue) { m_resolution = newValue; }
+    void setRhythmNumerator(int newValue) { m_ts_num = newValue; }
+    void setRhythmDenominator(int newValue) { m_ts_div = newValue; }
+    void setWeakNote(int newValue) { m_weak_note = newValue; }
+    void setStrongNote(int newValue) { m_strong_note = newValue; }
+    void setWeakVelocity(int newValue) { m_weak_velocity = newValue; }
+    void setStrongVelocity(int newValue) { m_strong_velocity = newValue; }
+    int resolution() const { return m_resolution; }
+    int rhythmNumerator() const { return m_ts_num; }
+    int rhythmDenominator() const { return m_ts_div; }
+    int weakNote() const { return m_weak_note; }
+    int strongNote() const { return m_strong_note; }
+    int weakVelocity() const { return m_weak_velocity; }
+    int strongVelocity() const { return m_strong_velocity; }
+    int barLength() const { return m_resolution * 4 / m_ts_div * m_ts_num; }
+
+    int simpleBar(ClickSink& sink, int tick) const;
+    int patternBar(ClickSink& sink, const CompiledPattern& pattern, int bar, int tick) const;
+    int restBar(ClickSink& sink, int tick) const;
+    int songBar(ClickSink& sink, const SongTimeline& timeline, int bar) const;
+
+    int decodeVelocity(char cell) const;
+    static int decodeTag(char cell);
+
+private:
+    int clicks(ClickSink& sink, int tick, int numerator, int denominator) const;
+
+    int m_resolution;
+    int m_ts_num; /* time signature: numerator */
+    int m_ts_div; /* time signature: denominator */
+    int m_weak_note;
+    int m_strong_note;
+    int m_weak_velocity;
+    int m_strong_velocity;
+};
+
+#endif // CLICKGENERATOR_H
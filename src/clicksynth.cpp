@@ -0,0 +1,154 @@
+/***************************************************************************
+ *   KMetronome - ALSA Sequencer based MIDI metronome                      *
+ *   Copyright (C) 2005-2021 Pedro Lopez-Cabanillas <plcl@users.sf.net>    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
+ ***************************************************************************/
+
+
+#include <algorithm>
+#include <cmath>
+#include "clicksynth.h"
+#include "mixkernel.h"
+
+/* Frames mixed at once by render() */
+static const int RENDER_BLOCK(256);
+
+ClickSynth::ClickSynth(int sampleRate)
+    : m_sampleRate(sampleRate),
+    m_volume(1.0f),
+    m_left(1.0f),
+    m_right(1.0f),
+    m_waves(128)
+{
+    for (int key = 0; key < m_waves.count(); ++key)
+        makeWave(key);
+    m_voices.reserve(AUDIO_VOICES_MAX);
+    m_buffer.resize(RENDER_BLOCK);
+    setVolume(METRONOME_VOLUME);
+    setBalance(METRONOME_PAN);
+}
+
+/**
+ * The click of a key: a sine of a pitch going up a fifth from one key to
+ * the next, wrapping around two octaves, with a fast exponential decay,
+ * plus a shorter noise burst from a linear congruential generator.
+ */
+void ClickSynth::makeWave(int key)
+{
+    const double pi = 3.14159265358979323846;
+    const double frequency = 600.0 * std::pow(2.0, (key * 7 % 24) / 12.0);
+    QVector<float>& wave = m_waves[key];
+    wave.resize(m_sampleRate * AUDIO_CLICK_LENGTH / 1000);
+    quint32 noise = 22222u + quint32(key);
+    for (int i = 0; i < wave.count(); ++i) {
+        double t = double(i) / m_sampleRate;
+        noise = noise * 1664525u + 1013904223u;
+        double white = double(noise >> 8) / double(1 << 23) - 1.0;
+        double tone = std::sin(2.0 * pi * frequency * t) * std::exp(-t / 0.012);
+        double burst = white * std::exp(-t / 0.0015);
+        wave[i] = float(0.55 * tone + 0.3 * burst);
+    }
+}
+
+void ClickSynth::setVolume(int volume)
+{
+    m_volume = qBound(0, volume, 127) / 127.0f;
+}
+
+/* Linear balance: the center plays both channels at full level */
+void ClickSynth::setBalance(int balance)
+{
+    balance = qBound(0, balance, 127);
+    m_left = qMin(1.0f, (127 - balance) / 63.5f);
+    m_right = qMin(1.0f, balance / 63.5f);
+}
+
+/**
+ * Starts a click. When all the voices are busy, the one that has played
+ * for longest is taken over.
+ */
+void ClickSynth::noteOn(int key, int velocity, int offset)
+{
+    if (key < 0 || key >= m_waves.count() || velocity <= 0)
+        return;
+    Voice voice;
+    voice.wave = m_waves.at(key).constData();
+    voice.length = m_waves.at(key).count();
+    voice.position = 0;
+    voice.delay = qMax(0, offset);
+    voice.gain = qMin(velocity, 127) / 127.0f;
+    if (m_voices.count() < AUDIO_VOICES_MAX) {
+        m_voices.append(voice);
+        return;
+    }
+    int oldest = 0;
+    for (int i = 1; i < m_voices.count(); ++i) {
+        if (m_voices.at(i).position - m_voices.at(i).delay >
+            m_voices.at(oldest).position - m_voices.at(oldest).delay)
+            oldest = i;
+    }
+    m_voices[oldest] = voice;
+}
+
+void ClickSynth::reset()
+{
+    m_voices.clear();
+}
+
+/**
+ * Mixes the voices into a mono buffer, overwriting it, and advances them
+ * by the given number of frames. Finished voices are dropped. The samples
+ * of each voice are added by the vectorized MixKernel.
+ */
+void ClickSynth::mix(float* buffer, int frames)
+{
+    std::fill(buffer, buffer + frames, 0.0f);
+    int i = 0;
+    while (i < m_voices.count()) {
+        Voice& voice = m_voices[i];
+        if (voice.delay >= frames) {
+            voice.delay -= frames;
+            ++i;
+            continue;
+        }
+        int n = qMin(frames - voice.delay, voice.length - voice.position);
+        MixKernel::mix(buffer + voice.delay, voice.wave + voice.position, voice.gain, n);
+        voice.position += n;
+        voice.delay = 0;
+        if (voice.position >= voice.length) {
+            m_voices[i] = m_voices.last();
+            m_voices.removeLast();
+        } else {
+            ++i;
+        }
+    }
+}
+
+/* Renders interleaved 16 bit stereo frames */
+void ClickSynth::render(qint16* output, int frames)
+{
+    const float left = m_volume * m_left * 32767.0f;
+    const float right = m_volume * m_right * 32767.0f;
+    while (frames > 0) {
+        int n = qMin(frames, RENDER_BLOCK);
+        mix(m_buffer.data(), n);
+        for (int i = 0; i < n; ++i) {
+            float sample = qBound(-1.0f, m_buffer.at(i), 1.0f);
+            *output++ = qint16(sample * left);
+            *output++ = qint16(sample * right);
+        }
+        frames -= n;
+    }
+}
@@ -0,0 +1,75 @@
+/***************************************************************************
+ *   KMetronome - ALSA Sequencer based MIDI metronome                      *
+ *   Copyright (C) 2005-2021 Pedro Lopez-Cabanillas <plcl@users.sf.net>    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
+ ***************************************************************************/
+
+
+#ifndef CLICKSYNTH_H
+#define CLICKSYNTH_H
+
+#include <QVector>
+#include <QtGlobal>
+#include "defs.h"
+
+/**
+ * A small percussion synthesizer for the internal audio output.
+ *
+ * Every MIDI key has its own click: a decaying sine whose pitch depends
+ * on the key, so neighbour keys are told apart, with a short noise burst
+ * for the attack. The clicks are computed once, as wavetables, when the
+ * synthesizer is created; playing them only mixes the tables, so nothing
+ * is allocated while rendering.
+ *
+ * Notes start at a frame offset counted from the beginning of the next
+ * rendered block, which makes them sample accurate. The output is 16 bit
+ * interleaved stereo, with the volume and balance of the MIDI controls.
+ */
+class ClickSynth
+{
+public:
+    explicit ClickSynth(int sampleRate = AUDIO_SAMPLE_RATE);
+
+    int sampleRate() const { return m_sampleRate; }
+    void setVolume(int volume);
+    void setBalance(int balance);
+    void noteOn(int key, int velocity, int offset = 0);
+    void reset();
+    int voices() const { return m_voices.count(); }
+
+    void mix(float* buffer, int frames);
+    void render(qint16* output, int frames);
+
+private:
+    struct Voice {
+        const float* wave;
+        int length;
+        int position;
+        int delay;
+        float gain;
+    };
+
+    void makeWave(int key);
+
+    int m_sampleRate;
+    float m_volume;
+    float m_left;
+    float m_right;
+    QVector<QVector<float> > m_waves;
+    QVector<Voice> m_voices;
+    QVector<float> m_buffer;
+};
+
+#endif // CLICKSYNTH_H
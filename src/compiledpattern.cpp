@@ -0,0 +1,87 @@
+/***************************************************************************
+ *   KMetronome - ALSA Sequencer based MIDI metronome                      *
+ *   Copyright (C) 2005-2021 Pedro Lopez-Cabanillas <plcl@users.sf.net>    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
+ ***************************************************************************/
+
+
+#include "compiledpattern.h"
+#include "drumgridmodel.h"
+#include "patternlibrary.h"
+
+/**
+ * Counts the hits of each column in a first pass, and places them in a
+ * second one. Both passes read the cells in their row major order.
+ */
+CompiledPattern::CompiledPattern(const DrumGridModel& model) :
+    m_figure(model.patternFigure()),
+    m_beats(model.patternBeats()),
+    m_bars(model.patternBars())
+{
+    const int rows = model.rowCount();
+    const int columns = model.columnCount();
+    m_starts.fill(0, columns + 1);
+    for (int r = 0; r < rows; ++r)
+        for (int c = 0; c < columns; ++c)
+            if (model.cell(r, c) != 0)
+                m_starts[c + 1]++;
+    for (int c = 0; c < columns; ++c)
+        m_starts[c + 1] += m_starts.at(c);
+    m_hits.resize(m_starts.at(columns));
+    QVector<int> next = m_starts;
+    for (int r = 0; r < rows; ++r) {
+        int key = model.keyAt(r);
+        for (int c = 0; c < columns; ++c) {
+            char cell = model.cell(r, c);
+            if (cell != 0) {
+                Hit& hit = m_hits[next[c]++];
+                hit.key = key;
+                hit.cell = cell;
+            }
+        }
+    }
+}
+
+/* Stored patterns come from files, so their layout is not trusted */
+CompiledPattern::CompiledPattern(const Pattern& pattern) :
+    m_figure(qMax(pattern.figure, 1)),
+    m_beats(qMax(pattern.beats, 1)),
+    m_bars(qMax(pattern.bars, 1))
+{
+    const int rows = qMin(pattern.keys.count(), pattern.rows.count());
+    const int columns = m_beats * m_bars;
+    m_starts.fill(0, columns + 1);
+    for (int r = 0; r < rows; ++r) {
+        const QStringList& row = pattern.rows.at(r);
+        for (int c = 0; c < columns && c < row.count(); ++c)
+            if (DrumGridModel::encodeCell(row.at(c)) != 0)
+                m_starts[c + 1]++;
+    }
+    for (int c = 0; c < columns; ++c)
+        m_starts[c + 1] += m_starts.at(c);
+    m_hits.resize(m_starts.at(columns));
+    QVector<int> next = m_starts;
+    for (int r = 0; r < rows; ++r) {
+        const QStringList& row = pattern.rows.at(r);
+        for (int c = 0; c < columns && c < row.count(); ++c) {
+            char cell = DrumGridModel::encodeCell(row.at(c));
+            if (cell != 0) {
+                Hit& hit = m_hits[next[c]++];
+                hit.key = pattern.keys.at(r);
+                hit.cell = cell;
+            }
+        }
+    }
+}
@@ -0,0 +1,63 @@
+/***************************************************************************
+ *   KMetronome - ALSA Sequencer based MIDI metronome                      *
+ *   Copyright (C) 2005-2021 Pedro Lopez-Cabanillas <plcl@users.sf.net>    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
+ ***************************************************************************/
+
+
+#ifndef COMPILEDPATTERN_H
+#define COMPILEDPATTERN_H
+
+#include <QtCore/QVector>
+
+class DrumGridModel;
+class Pattern;
+
+/**
+ * A read only snapshot of the pattern being played, laid out for the
+ * sequencer: the hits of each column are stored together, as the key and
+ * the cell value, so a bar is expanded by walking only its own hits,
+ * however many bars and empty cells the pattern has.
+ *
+ * Snapshots are built in the GUI thread, from the pattern being edited
+ * whenever it changes or from a stored pattern, and handed to the ALSA
+ * thread as a whole, so they are never modified once built.
+ */
+class CompiledPattern
+{
+public:
+    struct Hit {
+        int key;
+        char cell;
+    };
+
+    explicit CompiledPattern(const DrumGridModel& model);
+    explicit CompiledPattern(const Pattern& pattern);
+
+    int figure() const { return m_figure; }
+    int beats() const { return m_beats; }
+    int bars() const { return m_bars; }
+    const Hit* begin(int column) const { return m_hits.constData() + m_starts.at(column); }
+    const Hit* end(int column) const { return m_hits.constData() + m_starts.at(column + 1); }
+
+private:
+    int m_figure;
+    int m_beats;
+    int m_bars;
+    QVector<int> m_starts;
+    QVector<Hit> m_hits;
+};
+
+#endif /* COMPILEDPATTERN_H */
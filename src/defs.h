@@ -52,11 +52,33 @@ const int LSB_CC(0x20);
 
 const int PATTERN_FIGURE(16);
 const int PATTERN_COLUMNS(16);
+const int PATTERN_COLUMNS_MAX(512);
+const int PATTERN_BARS(1);
+const int PATTERN_BARS_MAX(32);
+const int ARRANGEMENT_BARS_MAX(999);
+const int RENDER_BARS(16);
+const int RENDER_BARS_MAX(9999);
+/* Milliseconds before showing the progress of pattern imports and exports */
+const int TRANSFER_PROGRESS_DELAY(500);
+const int STATUS_MESSAGE_TIMEOUT(5000);
+
+const int METRICS_INTERVAL(15);
+
+const int AUDIO_SAMPLE_RATE(48000);
+const int AUDIO_PERIOD(128);   /* frames */
+const int AUDIO_PERIOD_MIN(16);
+const int AUDIO_PERIOD_MAX(4096);
+const int AUDIO_PERIODS(2);
+const int AUDIO_VOICES_MAX(64);
+const int AUDIO_CLICK_LENGTH(60); /* milliseconds */
 
 const QString QSTR_PATTERN("Pattern_");
 const QString QSTR_FIGURE("Figure");
 const QString QSTR_BEATS("Beats");
+const QString QSTR_BARS("Bars");
+const QString QSTR_TAGS("Tags");
 const QString QSTR_APPNAME("Drumstick Metronome");
 const QString QSTR_DOMAIN("kmetronome.sourceforge.net");
+const QString QSTR_AUDIO_DEVICE("default");
 
 #endif /*DEFS_H*/
@@ -22,11 +22,13 @@
 #include <QShortcut>
 #include <QToolTip>
 #include <QClipboard>
-#include <QSettings>
 #include <QMessageBox>
 #include "defs.h"
 #include "drumgrid.h"
+#include "drumgriddelegate.h"
 #include "drumgridmodel.h"
+#include "patternlibrary.h"
+#include "patternmodels.h"
 #include "sequenceradapter.h"
 #include "ui_drumgrid.h"
 #include "iconutils.h"
@@ -36,18 +38,23 @@ DrumGrid::DrumGrid(QWidget *parent)
     m_ui(new Ui::DrumGrid),
     m_seq(nullptr),
     m_model(nullptr),
+    m_library(nullptr),
+    m_completer(nullptr),
     m_figure(PATTERN_FIGURE),
     m_columns(PATTERN_COLUMNS),
+    m_bars(PATTERN_BARS),
     m_internalIcons(false)
 {
     m_ui->setupUi(this);
     setWindowTitle( tr("Pattern Editor") );
     resize( 700, 400 );
     m_ui->tableView->setSelectionMode(QTableView::ContiguousSelection);
+    m_ui->tableView->setItemDelegate(new DrumGridDelegate(this));
+    m_ui->tableView->setWordWrap(false);
     QHeaderView *vH = m_ui->tableView->verticalHeader();
-    vH->setSectionResizeMode(QHeaderView::ResizeToContents);
+    vH->setSectionResizeMode(QHeaderView::Fixed);
     QHeaderView *hH = m_ui->tableView->horizontalHeader();
-    hH->setSectionResizeMode(QHeaderView::ResizeToContents);
+    hH->setSectionResizeMode(QHeaderView::Fixed);
 
     m_ui->startButton->setIcon(IconUtils::GetIcon("media-playback-start"));
     m_ui->startButton->setShortcut( Qt::Key_MediaPlay );
@@ -59,7 +66,9 @@ DrumGrid::DrumGrid(QWidget *parent)
     m_ui->removeButton->setIcon(IconUtils::GetIcon("list-remove"));
     m_ui->tempoSlider->setMaximum(TEMPO_MAX);
     m_ui->tempoSlider->setMinimum(TEMPO_MIN);
-    m_ui->beatNumber->setDigitCount(2);
+    m_ui->beatNumber->setDigitCount(3);
+    m_ui->gridColumns->setMaximum(PATTERN_COLUMNS_MAX);
+    m_ui->gridBars->setMaximum(PATTERN_BARS_MAX);
     m_ui->beatNumber->setNumber("1");
 
     IconUtils::SetupComboFigures(m_ui->figureCombo);
@@ -89,6 +98,7 @@ DrumGrid::DrumGrid(QWidget *parent)
     connect( m_ui->stopButton, SIGNAL(clicked()), SLOT(stop()));
     connect( m_ui->tempoSlider, SIGNAL(valueChanged(int)), SLOT(slotTempoChanged(int)));
     connect( m_ui->gridColumns, SIGNAL(valueChanged(int)), SLOT(slotColumnsChanged(int)));
+    connect( m_ui->gridBars, SIGNAL(valueChanged(int)), SLOT(slotBarsChanged(int)));
     connect( m_ui->figureCombo, SIGNAL(activated(int)), SLOT(slotFigureChanged(int)));
     connect( m_ui->patternCombo, SIGNAL(activated(int)), SLOT(patternChanged(int)));
     connect( m_ui->saveButton, SIGNAL(clicked()), SLOT(savePattern()));
@@ -129,15 +139,25 @@ void DrumGrid::setInstrument(const QString& instrument)
     m_model->loadKeyNames(instrument, bank, patch);
 }
 
+/**
+ * All cells have the same size, so the sections are fixed instead of
+ * measuring every cell each time the grid changes.
+ */
 void DrumGrid::updateView()
 {
-    m_ui->tableView->resizeColumnsToContents();
-    m_ui->tableView->resizeRowsToContents();
+    QSize size = DrumGridDelegate::cellSize(m_ui->tableView->fontMetrics());
+    QHeaderView *hH = m_ui->tableView->horizontalHeader();
+    hH->setMinimumSectionSize(size.width());
+    hH->setDefaultSectionSize(size.width());
+    QHeaderView *vH = m_ui->tableView->verticalHeader();
+    vH->setMinimumSectionSize(size.height());
+    vH->setDefaultSectionSize(size.height());
 }
 
 void DrumGrid::enableWidgets(bool enable)
 {
     m_ui->gridColumns->setEnabled(enable);
+    m_ui->gridBars->setEnabled(enable);
     m_ui->figureCombo->setEnabled(enable);
     m_ui->addButton->setEnabled(enable);
     m_ui->removeButton->setEnabled(enable);
@@ -160,6 +180,8 @@ void DrumGrid::setIcons(bool internal)
 void DrumGrid::play()
 {
     enableWidgets(false);
+    m_seq->setArrangement(nullptr);
+    m_seq->setTimeline(nullptr);
     m_seq->metronome_set_tempo();
     m_seq->metronome_start();
 }
@@ -201,7 +223,14 @@ void DrumGrid::setFigure(int newValue)
 void DrumGrid::slotColumnsChanged(int columns)
 {
     m_columns = columns;
-    m_model->updatePatternColumns(columns);
+    m_model->updatePatternLayout(m_columns, m_bars);
+    updateView();
+}
+
+void DrumGrid::slotBarsChanged(int bars)
+{
+    m_bars = bars;
+    m_model->updatePatternLayout(m_columns, m_bars);
     updateView();
 }
 
@@ -228,27 +257,31 @@ void DrumGrid::addEditAction(const QString& name, const char* slot, const QKeySe
     m_popup->addAction(name, this, slot, key);
 }
 
+void DrumGrid::setPatternLibrary(PatternLibrary* library)
+{
+    m_library = library;
+    if (m_completer == nullptr) {
+        m_completer = new PatternCompleter(m_ui->patternCombo, library);
+        connect(m_completer, &PatternCompleter::patternSelected, this, &DrumGrid::selectPattern);
+    } else {
+        m_completer->setLibrary(library);
+    }
+}
+
 void DrumGrid::readPattern()
 {
-    QSettings settings;
-    settings.beginGroup(QSTR_PATTERN+m_currentPattern);
-    QStringList keys = settings.childKeys();
-    if (!keys.empty()) {
-        setFigure(settings.value(QSTR_FIGURE, PATTERN_FIGURE).toInt());
-        int cols = settings.value(QSTR_BEATS, PATTERN_COLUMNS).toInt();
-        m_ui->gridColumns->setValue(cols);
-        slotColumnsChanged(cols);
-        keys.removeOne(QSTR_FIGURE);
-        keys.removeOne(QSTR_BEATS);
-        keys.sort();
+    Pattern pattern;
+    m_storedPattern = Pattern();
+    if (m_library != nullptr && m_library->load(m_currentPattern, pattern)) {
+        m_storedPattern = pattern;
+        setFigure(pattern.figure);
+        m_ui->gridColumns->setValue(pattern.beats);
+        m_ui->gridBars->setValue(pattern.bars);
+        m_columns = m_ui->gridColumns->value();
+        slotBarsChanged(m_ui->gridBars->value());
         m_model->clearPattern();
-        foreach(const QString& key, keys) {
-            bool isNumber;
-            int k = key.toInt(&isNumber);
-            if (isNumber) {
-                QStringList row = settings.value(key, QStringList()).toStringList();
-                m_model->addPatternData(k, row);
-            }
+        for (int r = 0; r < pattern.keys.count(); ++r) {
+            m_model->addPatternData(pattern.keys.at(r), pattern.rows.at(r));
         }
         m_model->endOfPattern();
     }
@@ -262,17 +295,20 @@ void DrumGrid::readPattern(const QString& name)
 
 void DrumGrid::writePattern()
 {
-    QSettings settings;
-    settings.beginGroup(QSTR_PATTERN+m_currentPattern);
-    settings.remove("");
-    settings.setValue(QSTR_FIGURE, m_figure);
-    settings.setValue(QSTR_BEATS, m_columns);
+    if (m_library == nullptr)
+        return;
+    Pattern pattern;
+    pattern.name = m_currentPattern;
+    pattern.figure = m_figure;
+    pattern.beats = m_columns;
+    pattern.bars = m_bars;
+    pattern.tags = m_library->info(m_currentPattern).tags;
     for(int r = 0; r < m_model->rowCount(); ++r) {
-        settings.setValue( m_model->patternKey(r),
-                           m_model->patternData(r) );
+        pattern.keys.append(m_model->patternKey(r).toInt());
+        pattern.rows.append(m_model->patternData(r));
     }
-    settings.endGroup();
-    settings.sync();
+    if (m_library->save(pattern, m_storedPattern))
+        m_storedPattern = pattern;
 }
 
 void DrumGrid::writePattern(const QString& name)
@@ -284,22 +320,18 @@ void DrumGrid::writePattern(const QString& name)
 void DrumGrid::removePattern(const QString& name)
 {
     if( QMessageBox::question(this, tr("Remove Pattern"), tr("Do you want to remove the current pattern?")) == QMessageBox::Yes ) {
-        QSettings settings;
-        settings.remove(QSTR_PATTERN+name);
-        settings.sync();
+        if (m_library != nullptr)
+            m_library->remove(name);
+        if (m_storedPattern.name == name)
+            m_storedPattern = Pattern();
     }
 }
 
 QStringList DrumGrid::patterns()
 {
-    QStringList lst;
-    int n = QSTR_PATTERN.size();
-    QSettings settings;
-    foreach(const QString& name, settings.childGroups()) {
-        if (name.startsWith(QSTR_PATTERN))
-            lst += name.mid(n);
-    }
-    return lst;
+    if (m_library == nullptr)
+        return QStringList();
+    return m_library->names();
 }
 
 void DrumGrid::patternChanged(int /*idx*/)
@@ -307,6 +339,14 @@ void DrumGrid::patternChanged(int /*idx*/)
     readPattern(m_ui->patternCombo->currentText());
 }
 
+void DrumGrid::selectPattern(const QString& name)
+{
+    int idx = m_ui->patternCombo->findText(name);
+    if (idx >= 0)
+        m_ui->patternCombo->setCurrentIndex(idx);
+    readPattern(name);
+}
+
 void DrumGrid::savePattern()
 {
     QString newName = m_ui->patternCombo->currentText();
@@ -356,11 +396,13 @@ void DrumGrid::done(int r)
     QDialog::done(r);
 }
 
-void DrumGrid::updateDisplay(int /*bar*/, int beat)
+void DrumGrid::updateDisplay(int bar, int beat)
 {
-    if (m_ui->chkselbeat->isChecked())
-        m_ui->tableView->selectColumn(beat-1);
-    m_ui->beatNumber->setNumber(QString("%1").arg(beat, 2, 10, QChar(' ')));
+    if (m_ui->chkselbeat->isChecked()) {
+        int bars = m_model->patternBars();
+        m_ui->tableView->selectColumn(qMax(bar - 1, 0) % bars * m_model->patternBeats() + beat - 1);
+    }
+    m_ui->beatNumber->setNumber(QString("%1").arg(beat, 3, 10, QChar(' ')));
 }
 
 void DrumGrid::addRow()
@@ -377,7 +419,7 @@ void DrumGrid::removeRow()
     int row = -1;
     const QModelIndexList indexlist =
             m_ui->tableView->selectionModel()->selectedIndexes();
-    if (indexlist.count() == m_columns) {
+    if (indexlist.count() == m_model->columnCount()) {
         foreach (const QModelIndex& idx, indexlist) {
             if (row < 0)
                 row = idx.row();
@@ -403,55 +445,29 @@ void DrumGrid::gridContextMenu(const QPoint&)
 
 void DrumGrid::slotCut()
 {
-    QStringList list;
-    QItemSelectionModel* selModel = m_ui->tableView->selectionModel();
-    QItemSelectionRange range = selModel->selection().first();
-    QModelIndexList indexes = selModel->selectedIndexes();
-    for (int row=range.top(); row<=range.bottom(); ++row) {
-        QStringList rowList;
-        foreach ( const QModelIndex& idx, indexes ) {
-            if (idx.row() == row) {
-                rowList << idx.data().toString();
-                m_model->changeCell(idx, QString());
-            }
-        }
-        list << rowList.join(QString(','));
-    }
-    qApp->clipboard()->setText( list.join(QString('\n')) ) ;
+    QItemSelection selection = m_ui->tableView->selectionModel()->selection();
+    if (selection.isEmpty())
+        return;
+    const QItemSelectionRange& range = selection.first();
+    qApp->clipboard()->setText( m_model->rangeText(range.top(), range.left(), range.bottom(), range.right()) );
+    m_model->clearRange(range.top(), range.left(), range.bottom(), range.right());
 }
 
 void DrumGrid::slotCopy()
 {
-    QStringList list;
-    QItemSelectionModel* selModel = m_ui->tableView->selectionModel();
-    QItemSelectionRange range = selModel->selection().first();
-    QModelIndexList indexes = selModel->selectedIndexes();
-    for (int row=range.top(); row<=range.bottom(); ++row) {
-        QStringList rowList;
-        foreach ( const QModelIndex& idx, indexes ) {
-            if (idx.row() == row)
-                rowList << idx.data().toString();
-        }
-        list << rowList.join(QString(','));
-    }
-    qApp->clipboard()->setText( list.join(QString('\n')) ) ;
+    QItemSelection selection = m_ui->tableView->selectionModel()->selection();
+    if (selection.isEmpty())
+        return;
+    const QItemSelectionRange& range = selection.first();
+    qApp->clipboard()->setText( m_model->rangeText(range.top(), range.left(), range.bottom(), range.right()) );
 }
 
 void DrumGrid::slotPaste()
 {
     QString clbrdText = qApp->clipboard()->text();
-    if (!clbrdText.isEmpty()) {
-        int x, y=0;
-        QItemSelectionModel* selModel = m_ui->tableView->selectionModel();
-        QItemSelectionRange range = selModel->selection().first();
-        QStringList rows = clbrdText.split('\n');
-        foreach( const QString& r, rows ) {
-            QStringList list = r.split(',');
-            for(x=0; x<list.size(); ++x) {
-                QModelIndex idx = m_model->index(range.top()+y, range.left()+x);
-                m_model->changeCell(idx, list.at(x));
-            }
-            y++;
-        }
+    QItemSelection selection = m_ui->tableView->selectionModel()->selection();
+    if (!clbrdText.isEmpty() && !selection.isEmpty()) {
+        const QItemSelectionRange& range = selection.first();
+        m_model->pasteText(range.top(), range.left(), clbrdText);
     }
 }
@@ -20,6 +20,7 @@
 #define DRUMGRID_H
 
 #include "defs.h"
+#include "patternlibrary.h"
 #include <QDialog>
 #include <QMenu>
 #include <QShortcut>
@@ -33,6 +34,7 @@ namespace Ui
 
 class SequencerAdapter;
 class DrumGridModel;
+class PatternCompleter;
 
 class DrumGrid : public QDialog
 {
@@ -42,6 +44,7 @@ public:
     virtual ~DrumGrid();
     void setSequencer(SequencerAdapter* seq);
     void setModel(DrumGridModel* model);
+    void setPatternLibrary(PatternLibrary* library);
 
     void subscribe(const QString& portName);
     void addShortcut(const QKeySequence& key, const QString& value);
@@ -67,10 +70,12 @@ public slots:
     void stop();
     void slotTempoChanged(int newTempo);
     void slotColumnsChanged(int columns);
+    void slotBarsChanged(int bars);
     void slotFigureChanged(int idx);
     void shortcutPressed(const QString& value);
     void updateDisplay(int bar, int beat);
     void patternChanged(int idx);
+    void selectPattern(const QString& name);
     void savePattern();
     void removePattern();
     void addRow();
@@ -87,11 +92,15 @@ private:
     Ui::DrumGrid *m_ui;
     SequencerAdapter *m_seq;
     DrumGridModel* m_model;
+    PatternLibrary* m_library;
+    PatternCompleter* m_completer;
     int m_figure;
     int m_columns;
+    int m_bars;
     unsigned long m_tick;
     QVector<QShortcut*> m_shortcuts;
     QString m_currentPattern;
+    Pattern m_storedPattern; /* as last loaded or saved, to save only the changes */
     QMenu* m_popup;
     bool m_internalIcons;
 };
@@ -0,0 +1,70 @@
+/***************************************************************************
+ *   KMetronome - ALSA Sequencer based MIDI metronome                      *
+ *   Copyright (C) 2005-2021 Pedro Lopez-Cabanillas <plcl@users.sf.net>    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
+ ***************************************************************************/
+
+#include <QApplication>
+#include <QPainter>
+#include <QStyle>
+#include <QWidget>
+#include "drumgriddelegate.h"
+#include "drumgridmodel.h"
+
+/* Space around the cell text, in pixels */
+const int CELL_MARGIN(4);
+
+DrumGridDelegate::DrumGridDelegate(QObject* parent) :
+    QStyledItemDelegate(parent)
+{ }
+
+QSize DrumGridDelegate::cellSize(const QFontMetrics& metrics)
+{
+    int side = qMax(metrics.height(), metrics.horizontalAdvance(QLatin1Char('M')));
+    return QSize(side + CELL_MARGIN * 2, metrics.height() + CELL_MARGIN);
+}
+
+void DrumGridDelegate::paint(QPainter* painter, const QStyleOptionViewItem& option,
+                             const QModelIndex& index) const
+{
+    const DrumGridModel* model = qobject_cast<const DrumGridModel*>(index.model());
+    if (model == nullptr) {
+        QStyledItemDelegate::paint(painter, option, index);
+        return;
+    }
+    bool selected = option.state & QStyle::State_Selected;
+    QPalette::ColorGroup group = (option.state & QStyle::State_Enabled) ? QPalette::Normal : QPalette::Disabled;
+    if (selected)
+        painter->fillRect(option.rect, option.palette.brush(group, QPalette::Highlight));
+    char cell = model->cell(index.row(), index.column());
+    if (cell != 0) {
+        painter->setPen(option.palette.color(group, selected ? QPalette::HighlightedText : QPalette::Text));
+        painter->setFont(option.font);
+        painter->drawText(option.rect, Qt::AlignCenter, QString(QChar::fromLatin1(cell)));
+    }
+    if (option.state & QStyle::State_HasFocus) {
+        QStyleOptionFocusRect focus;
+        focus.QStyleOption::operator=(option);
+        focus.backgroundColor = option.palette.color(group, selected ? QPalette::Highlight : QPalette::Base);
+        QStyle* style = option.widget != nullptr ? option.widget->style() : QApplication::style();
+        style->drawPrimitive(QStyle::PE_FrameFocusRect, &focus, painter, option.widget);
+    }
+}
+
+QSize DrumGridDelegate::sizeHint(const QStyleOptionViewItem& option,
+                                 const QModelIndex& /*index*/) const
+{
+    return cellSize(option.fontMetrics);
+}
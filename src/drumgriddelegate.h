@@ -0,0 +1,44 @@
+/***************************************************************************
+ *   KMetronome - ALSA Sequencer based MIDI metronome                      *
+ *   Copyright (C) 2005-2021 Pedro Lopez-Cabanillas <plcl@users.sf.net>    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
+ ***************************************************************************/
+
+#ifndef DRUMGRIDDELEGATE_H
+#define DRUMGRIDDELEGATE_H
+
+#include <QStyledItemDelegate>
+
+/**
+ * Paints the drum grid cells straight from the bytes of DrumGridModel,
+ * without going through QVariant and the default item layout, and gives
+ * every cell the same size so the view never needs to measure them.
+ */
+class DrumGridDelegate : public QStyledItemDelegate
+{
+    Q_OBJECT
+
+public:
+    explicit DrumGridDelegate(QObject* parent = nullptr);
+
+    void paint(QPainter* painter, const QStyleOptionViewItem& option,
+               const QModelIndex& index) const override;
+    QSize sizeHint(const QStyleOptionViewItem& option,
+                   const QModelIndex& index) const override;
+
+    static QSize cellSize(const QFontMetrics& metrics);
+};
+
+#endif // DRUMGRIDDELEGATE_H
@@ -19,18 +19,51 @@
 #include "drumgridmodel.h"
 #include "instrument.h"
 #include <QDebug>
+#include <cstring>
 
-const QString DEFVAL("f");
+const char DEFVAL('f');
+const QByteArray CELL_VALUES("fp123456789");
 
 DrumGridModel::DrumGridModel(QObject *parent)
     : QAbstractTableModel(parent),
     m_columns(PATTERN_COLUMNS),
+    m_bars(PATTERN_BARS),
     m_figure(PATTERN_FIGURE),
     m_lastValue(DEFVAL),
     m_insList(nullptr)
 {
-    m_modelData.clear();
-    m_keys.clear();
+    connect(this, &QAbstractItemModel::dataChanged, this, &DrumGridModel::patternChanged);
+    connect(this, &QAbstractItemModel::modelReset, this, &DrumGridModel::patternChanged);
+    connect(this, &QAbstractItemModel::rowsInserted, this, &DrumGridModel::patternChanged);
+    connect(this, &QAbstractItemModel::rowsRemoved, this, &DrumGridModel::patternChanged);
+    connect(this, &QAbstractItemModel::columnsInserted, this, &DrumGridModel::patternChanged);
+    connect(this, &QAbstractItemModel::columnsRemoved, this, &DrumGridModel::patternChanged);
+}
+
+/* Zero for an empty or invalid cell, or else its character */
+char DrumGridModel::encodeCell(const QString& value)
+{
+    QString cell = value.trimmed();
+    if (cell.isEmpty())
+        return 0;
+    char c = cell.at(0).toLatin1();
+    return CELL_VALUES.contains(c) ? c : 0;
+}
+
+QByteArray DrumGridModel::encodeRow(const QStringList& row, int columns)
+{
+    QByteArray cells(columns, 0);
+    for (int c = 0; c < columns && c < row.count(); ++c)
+        cells[c] = encodeCell(row.at(c));
+    return cells;
+}
+
+void DrumGridModel::insertRow(int row, int key, const QByteArray& cells)
+{
+    QByteArray data(m_columns, 0);
+    memcpy(data.data(), cells.constData(), qMin(cells.size(), m_columns));
+    m_keys.insert(row, key);
+    m_cells.insert(row * m_columns, data);
 }
 
 void DrumGridModel::setInstrumentList(InstrumentList* instruments)
@@ -41,36 +74,31 @@ void DrumGridModel::setInstrumentList(InstrumentList* instruments)
 void DrumGridModel::loadKeyNames(const QString& instrument, int bank, int patch)
 {
     if (m_insList != nullptr) {
-        Instrument ins = m_insList->value(instrument);
-        const InstrumentData& notes = ins.notes(bank, patch);
-        InstrumentData::ConstIterator k;
         m_keyNames.clear();
-        for( k = notes.constBegin(); k != notes.constEnd(); ++k )
-            m_keyNames[k.key()] = k.value();
+        InstrumentList::ConstIterator it = m_insList->constFind(instrument);
+        if (it != m_insList->constEnd())
+            m_keyNames = it.value().notes(bank, patch).map();
+        if (!m_keys.isEmpty())
+            emit headerDataChanged(Qt::Vertical, 0, rowCount() - 1);
     }
 }
 
 void DrumGridModel::fillSampleData()
 {
+    setPatternFigure(PATTERN_FIGURE);
+    updatePatternLayout(PATTERN_COLUMNS, PATTERN_BARS);
     beginInsertRows(QModelIndex(), 0, 4);
-    m_modelData.insert(0, QString(",p,,,,p,,,,p,,,,p,,").split(','));
-    m_modelData.insert(1, QString("f,,,p,f,,,p,f,,,p,f,,,p").split(','));
-    m_modelData.insert(2, QString(",,,,,,,,,,,,,4,4,").split(','));
-    m_modelData.insert(3, QString(",,,,f,,,,,,,,f,,,").split(','));
-    m_modelData.insert(4, QString("f,,,,p,,,,f,,,,p,,,").split(','));
-    m_keys.insert(0, 46);
-    m_keys.insert(1, 42);
-    m_keys.insert(2, 39);
-    m_keys.insert(3, 38);
-    m_keys.insert(4, 36);
+    insertRow(0, 46, encodeRow(QString(",p,,,,p,,,,p,,,,p,,").split(','), m_columns));
+    insertRow(1, 42, encodeRow(QString("f,,,p,f,,,p,f,,,p,f,,,p").split(','), m_columns));
+    insertRow(2, 39, encodeRow(QString(",,,,,,,,,,,,,4,4,").split(','), m_columns));
+    insertRow(3, 38, encodeRow(QString(",,,,f,,,,,,,,f,,,").split(','), m_columns));
+    insertRow(4, 36, encodeRow(QString("f,,,,p,,,,f,,,,p,,,").split(','), m_columns));
     endInsertRows();
-    setPatternFigure(PATTERN_FIGURE);
-    updatePatternColumns(PATTERN_COLUMNS);
 }
 
 int DrumGridModel::rowCount(const QModelIndex & /* parent */) const
 {
-    return m_modelData.count();
+    return m_keys.count();
 }
 
 int DrumGridModel::columnCount(const QModelIndex & /* parent */) const
@@ -81,10 +109,11 @@ int DrumGridModel::columnCount(const QModelIndex & /* parent */) const
 QVariant DrumGridModel::data(const QModelIndex &index, int role) const
 {
     if (!index.isValid() || role != Qt::DisplayRole ||
-         index.row() > m_modelData.count() ||
-         index.column() > m_columns )
+         index.row() >= m_keys.count() ||
+         index.column() >= m_columns )
         return QVariant();
-    return m_modelData[index.row()][index.column()].trimmed();
+    char c = cell(index.row(), index.column());
+    return c == 0 ? QString() : QString(QChar::fromLatin1(c));
 }
 
 QVariant DrumGridModel::headerData(int section ,
@@ -93,7 +122,7 @@ QVariant DrumGridModel::headerData(int section ,
 {
     if (role == Qt::DisplayRole) {
         if ( orientation == Qt::Horizontal ) {
-            int m = section % 10;
+            int m = (section % patternBeats()) % 10;
             if (m == 9)
                 m = 0;
             else
@@ -112,23 +141,22 @@ QVariant DrumGridModel::headerData(int section ,
 
 void DrumGridModel::changeCell(const QModelIndex &index)
 {
-    QString after, before = m_modelData[index.row()][index.column()];
-    if (before.isEmpty())
-        after = m_lastValue;
+    if (!index.isValid() || index.row() >= m_keys.count() || index.column() >= m_columns)
+        return;
+    if (cell(index.row(), index.column()) == 0)
+        changeCell(index, QString(QChar::fromLatin1(m_lastValue)));
     else
-        after.clear();
-    changeCell(index, after);
+        changeCell(index, QString());
 }
 
 void DrumGridModel::changeCell(const QModelIndex &index, const QString& newValue)
 {
-    const QString validation("fp123456789");
-    if (index.isValid() && !m_modelData.isEmpty()) {
-        QString cell = newValue;
-        if (cell.length() > 1)
-            cell = cell.left(1);
-        if (cell.isNull() || validation.contains(cell)) {
-            m_lastValue = m_modelData[index.row()][index.column()] = cell;
+    if (index.isValid() && index.row() < m_keys.count() && index.column() < m_columns) {
+        char c = newValue.isEmpty() ? 0 : encodeCell(newValue.left(1));
+        if (c != 0 || newValue.isEmpty()) {
+            m_cells[index.row() * m_columns + index.column()] = c;
+            if (c != 0)
+                m_lastValue = c;
             emit dataChanged(index, index);
         }
     }
@@ -136,7 +164,13 @@ void DrumGridModel::changeCell(const QModelIndex &index, const QString& newValue
 
 QStringList DrumGridModel::patternData(int row)
 {
-    return m_modelData.value(row, QStringList());
+    QStringList result;
+    if (row < 0 || row >= m_keys.count())
+        return result;
+    const char* cells = m_cells.constData() + row * m_columns;
+    for (int c = 0; c < m_columns; ++c)
+        result.append(cells[c] == 0 ? QString() : QString(QChar::fromLatin1(cells[c])));
+    return result;
 }
 
 QString DrumGridModel::patternKey(int row)
@@ -147,7 +181,7 @@ QString DrumGridModel::patternKey(int row)
 void DrumGridModel::clearPattern()
 {
     beginResetModel();
-    m_modelData.clear();
+    m_cells.clear();
     m_keys.clear();
     m_tempData.clear();
     m_tempKeys.clear();
@@ -157,65 +191,155 @@ void DrumGridModel::clearPattern()
 void DrumGridModel::addPatternData(int key, const QStringList& row)
 {
     m_tempKeys.prepend(key);
-    m_tempData.prepend(row);
+    m_tempData.prepend(encodeRow(row, row.count()));
 }
 
 void DrumGridModel::endOfPattern()
 {
+    if (m_tempData.isEmpty())
+        return;
     beginInsertRows(QModelIndex(), 0, m_tempData.count()-1);
-    m_keys = m_tempKeys;
-    m_modelData = m_tempData;
+    m_keys.clear();
+    m_cells.clear();
+    m_cells.reserve(m_tempData.count() * m_columns);
+    for (int r = 0; r < m_tempData.count(); ++r)
+        insertRow(r, m_tempKeys.at(r), m_tempData.at(r));
+    m_tempData.clear();
+    m_tempKeys.clear();
     endInsertRows();
 }
 
-void DrumGridModel::updatePatternColumns(int columns)
+void DrumGridModel::setPatternFigure(int figure)
 {
-    int diff = m_columns - columns;
-    if (diff == 0)
+    if (figure == m_figure)
+        return;
+    m_figure = figure;
+    emit patternChanged();
+}
+
+/**
+ * Changes the number of beats per bar and the number of bars. Each bar
+ * keeps its first beats, so the cells stay in their bars; the matrix is
+ * laid out again with a single allocation.
+ */
+void DrumGridModel::updatePatternLayout(int beats, int bars)
+{
+    int oldBeats = patternBeats();
+    int columns = beats * bars;
+    if (beats == oldBeats && bars == m_bars)
         return;
-    if (diff > 0) {
+    int diff = m_columns - columns;
+    if (diff > 0)
         beginRemoveColumns(QModelIndex(), columns, m_columns-1);
-        for(int i=0; i<m_modelData.size(); ++i)
-            while( m_modelData[i].size() > columns )
-                m_modelData[i].removeLast();
-    } else {
-        beginInsertColumns(QModelIndex(), columns, columns-diff-1);
-        for(int i=0; i<m_modelData.size(); ++i)
-            while( m_modelData[i].size() < columns )
-                m_modelData[i].append(QString());
-    }
+    else if (diff < 0)
+        beginInsertColumns(QModelIndex(), m_columns, columns-1);
+    QByteArray cells(m_keys.count() * columns, 0);
+    int common = qMin(beats, oldBeats);
+    int commonBars = qMin(bars, m_bars);
+    for (int r = 0; r < m_keys.count(); ++r)
+        for (int b = 0; b < commonBars; ++b)
+            memcpy(cells.data() + r * columns + b * beats,
+                   m_cells.constData() + r * m_columns + b * oldBeats, common);
+    m_cells = cells;
     m_columns = columns;
+    m_bars = bars;
     if (diff > 0)
         endRemoveColumns();
-    else
+    else if (diff < 0)
         endInsertColumns();
+    if (beats != oldBeats) {
+        emit headerDataChanged(Qt::Horizontal, 0, m_columns - 1);
+        if (!m_keys.isEmpty())
+            emit dataChanged(index(0, 0), index(m_keys.count() - 1, m_columns - 1));
+    }
 }
 
 QString DrumGridModel::patternHit(int row, int col)
 {
-    if ((col < m_columns) && (row < m_modelData.size()))
-        return m_modelData[row][col].trimmed();
+    if (row >= 0 && row < m_keys.count() && col >= 0 && col < m_columns) {
+        char c = cell(row, col);
+        if (c != 0)
+            return QString(QChar::fromLatin1(c));
+    }
     return QString();
 }
 
+/**
+ * The cells of a range as text for the clipboard: comma separated cells,
+ * one line per row.
+ */
+QString DrumGridModel::rangeText(int top, int left, int bottom, int right) const
+{
+    QByteArray text;
+    top = qMax(top, 0);
+    left = qMax(left, 0);
+    bottom = qMin(bottom, m_keys.count() - 1);
+    right = qMin(right, m_columns - 1);
+    for (int r = top; r <= bottom; ++r) {
+        if (r > top)
+            text += '\n';
+        const char* cells = m_cells.constData() + r * m_columns;
+        for (int c = left; c <= right; ++c) {
+            if (c > left)
+                text += ',';
+            if (cells[c] != 0)
+                text += cells[c];
+        }
+    }
+    return QString::fromLatin1(text);
+}
+
+void DrumGridModel::clearRange(int top, int left, int bottom, int right)
+{
+    top = qMax(top, 0);
+    left = qMax(left, 0);
+    bottom = qMin(bottom, m_keys.count() - 1);
+    right = qMin(right, m_columns - 1);
+    if (top > bottom || left > right)
+        return;
+    for (int r = top; r <= bottom; ++r)
+        memset(m_cells.data() + r * m_columns + left, 0, right - left + 1);
+    emit dataChanged(index(top, left), index(bottom, right));
+}
+
+/**
+ * Pastes clipboard text with the layout of rangeText() at the given cell.
+ * Cells falling outside of the grid and invalid values are ignored.
+ */
+void DrumGridModel::pasteText(int top, int left, const QString& text)
+{
+    if (top < 0 || left < 0 || top >= m_keys.count() || left >= m_columns)
+        return;
+    int bottom = top, right = left;
+    const QStringList lines = text.split('\n');
+    for (int y = 0; y < lines.count() && top + y < m_keys.count(); ++y) {
+        const QStringList values = lines.at(y).split(',');
+        char* cells = m_cells.data() + (top + y) * m_columns;
+        for (int x = 0; x < values.count() && left + x < m_columns; ++x) {
+            char c = encodeCell(values.at(x));
+            if (c != 0 || values.at(x).trimmed().isEmpty())
+                cells[left + x] = c;
+            right = qMax(right, left + x);
+        }
+        bottom = top + y;
+    }
+    emit dataChanged(index(top, left), index(bottom, right));
+}
+
 void DrumGridModel::insertPatternRow(const QString& name)
 {
-    int i = 0, j = 0, key = m_keyNames.key(name);
-    QStringList data;
-    for (i = 0; i < m_columns; ++i)
-        data.append(QString());
+    int j = 0, key = m_keyNames.key(name);
     while (j < m_keys.count() && m_keys[j] > key)
         j++;
     beginInsertRows(QModelIndex(), j, j);
-    m_keys.insert(j, key);
-    m_modelData.insert(j, data);
+    insertRow(j, key, QByteArray());
     endInsertRows();
 }
 
 void DrumGridModel::removePatternRow(int row)
 {
     beginRemoveRows(QModelIndex(), row, row);
-    m_modelData.removeAt(row);
+    m_cells.remove(row * m_columns, m_columns);
     m_keys.removeAt(row);
     endRemoveRows();
 }
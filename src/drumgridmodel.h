@@ -21,10 +21,22 @@
 
 #include "defs.h"
 #include <QtCore/QAbstractTableModel>
+#include <QtCore/QByteArray>
 #include <QtCore/QStringList>
 
 class InstrumentList;
 
+/**
+ * The pattern being edited or played. Cells are stored as a contiguous
+ * row major byte matrix, one byte per cell holding one of the characters
+ * "fp123456789", or zero for an empty cell. The string based methods are
+ * adapters for the views and the pattern library; the sequencer reads the
+ * bytes directly with cell() and keyAt().
+ *
+ * A pattern may span several bars: the columns hold the beats of every
+ * bar, one bar after another. patternChanged() is emitted after any change
+ * of the cells, rows, layout or figure.
+ */
 class DrumGridModel : public QAbstractTableModel
 {
     Q_OBJECT
@@ -47,25 +59,40 @@ public:
     QStringList patternData(int row);
     QString patternKey(int row);
     QString patternHit(int row, int col);
-    void updatePatternColumns(int columns);
-    void setPatternFigure(int figure) { m_figure = figure; }
-    int patternFigure() { return m_figure; }
+    char cell(int row, int col) const { return m_cells.at(row * m_columns + col); }
+    int keyAt(int row) const { return m_keys.at(row); }
+    void updatePatternLayout(int beats, int bars);
+    void setPatternFigure(int figure);
+    int patternFigure() const { return m_figure; }
+    int patternBeats() const { return m_columns / m_bars; }
+    int patternBars() const { return m_bars; }
+    QString rangeText(int top, int left, int bottom, int right) const;
+    void clearRange(int top, int left, int bottom, int right);
+    void pasteText(int top, int left, const QString& text);
     void insertPatternRow(const QString& name);
     void removePatternRow(int row);
     QStringList keyNames();
+    static char encodeCell(const QString& value);
+
+signals:
+    void patternChanged();
 
 public slots:
     void changeCell(const QModelIndex &index);
     void changeCell(const QModelIndex &index, const QString& newValue);
 
 private:
+    static QByteArray encodeRow(const QStringList& row, int columns);
+    void insertRow(int row, int key, const QByteArray& cells);
+
     int m_columns;
+    int m_bars;
     int m_figure;
-    QString m_lastValue;
+    char m_lastValue;
     InstrumentList* m_insList;
     QMap<int,QString> m_keyNames;
-    QList<QStringList> m_modelData;
-    QList<QStringList> m_tempData;
+    QByteArray m_cells;
+    QList<QByteArray> m_tempData;
     QList<int> m_keys;
     QList<int> m_tempKeys;
 };
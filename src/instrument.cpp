@@ -23,8 +23,9 @@
 #include <QFileInfo>
 #include <QFile>
 #include <QTextStream>
-#include <QRegExp>
+#include <QVarLengthArray>
 #include <QDate>
+#include <climits>
 
 #include "instrument.h"
 
@@ -39,46 +40,114 @@
 // Retrieve patch/program list for given bank address.
 const InstrumentData& Instrument::patch ( int iBank ) const
 {
-	if (m_pData->patches.contains(iBank))
-		return m_pData->patches[iBank];
+	static const InstrumentData s_empty;
 
-	return m_pData->patches[-1];
+	InstrumentPatches::ConstIterator it = m_pData->patches.constFind(iBank);
+	if (it == m_pData->patches.constEnd())
+		it = m_pData->patches.constFind(-1);
+	if (it == m_pData->patches.constEnd())
+		return s_empty;
+
+	return it.value();
 }
 
 
 // Retrieve key/notes list for given (bank, prog) pair.
 const InstrumentData& Instrument::notes ( int iBank, int iProg ) const
 {
-	if (m_pData->keys.contains(iBank)) {
-		if (m_pData->keys[iBank].contains(iProg)) {
-			return m_pData->keys[iBank][iProg];
-		} else {
-			return m_pData->keys[iBank][-1];
-		}
-	}
-	else if (iBank >= 0)
-		return notes(-1, iProg);
+	if (iBank < -1 || iProg < 0 || iProg > 127)
+		return resolveNotes(iBank, iProg);
 
-	return m_pData->keys[-1][-1];
+	if (!m_pData->indexed)
+		buildIndex();
+
+	const int iRow = m_pData->indexBanks.value(iBank, 0);
+	return *m_pData->indexRows.at(iRow).notes[iProg];
 }
 
 
 // Check if given (bank, prog) pair is a drum patch.
 bool Instrument::isDrum ( int iBank, int iProg ) const
 {
-	if (m_pData->drums.contains(iBank)) {
-		if (m_pData->drums[iBank].contains(iProg)) {
-			return (bool) m_pData->drums[iBank][iProg];
-		} else {
-			return (bool) m_pData->drums[iBank][-1];
+	if (iBank < -1 || iProg < 0 || iProg > 127)
+		return resolveDrum(iBank, iProg);
+
+	if (!m_pData->indexed)
+		buildIndex();
+
+	const int iRow = m_pData->indexBanks.value(iBank, 0);
+	return m_pData->indexRows.at(iRow).drums[iProg];
+}
+
+
+// Build the resolved lookup index, one row per defined bank.
+void Instrument::buildIndex (void) const
+{
+	QList<int> banks = m_pData->keys.keys();
+	InstrumentDrums::ConstIterator it = m_pData->drums.constBegin();
+	for (; it != m_pData->drums.constEnd(); ++it) {
+		if (!m_pData->keys.contains(it.key()))
+			banks.append(it.key());
+	}
+	banks.removeAll(-1);
+
+	m_pData->indexBanks.clear();
+	m_pData->indexRows.resize(banks.count() + 1);
+
+	// Row 0 resolves the wildcard bank, the others their own.
+	for (int iRow = 0; iRow <= banks.count(); ++iRow) {
+		const int iBank = (iRow > 0 ? banks.at(iRow - 1) : -1);
+		IndexRow& row = m_pData->indexRows[iRow];
+		for (int iProg = 0; iProg < 128; ++iProg) {
+			row.notes[iProg] = &resolveNotes(iBank, iProg);
+			row.drums[iProg] = resolveDrum(iBank, iProg);
 		}
+		if (iRow > 0)
+			m_pData->indexBanks.insert(iBank, iRow);
 	}
-	else if (iBank >= 0)
-		return isDrum(-1, iProg);
 
-	return false;
+	m_pData->indexed = true;
+}
+
+
+// Key/notes list lookup, falling back on the wildcard bank and prog.
+const InstrumentData& Instrument::resolveNotes ( int iBank, int iProg ) const
+{
+	static const InstrumentData s_empty;
+
+	InstrumentKeys::ConstIterator it = m_pData->keys.constFind(iBank);
+	if (it == m_pData->keys.constEnd()) {
+		if (iBank >= 0)
+			return resolveNotes(-1, iProg);
+		it = m_pData->keys.constFind(-1);
+		if (it == m_pData->keys.constEnd())
+			return s_empty;
+		iProg = -1;
+	}
+
+	const InstrumentNotes& notes = it.value();
+	InstrumentNotes::ConstIterator iter = notes.constFind(iProg);
+	if (iter == notes.constEnd())
+		iter = notes.constFind(-1);
+	if (iter == notes.constEnd())
+		return s_empty;
+
+	return iter.value();
+}
+
+
+// Drum flag lookup, falling back on the wildcard bank and prog.
+bool Instrument::resolveDrum ( int iBank, int iProg ) const
+{
+	InstrumentDrums::ConstIterator it = m_pData->drums.constFind(iBank);
+	if (it == m_pData->drums.constEnd())
+		return (iBank >= 0 ? resolveDrum(-1, iProg) : false);
+
+	const InstrumentDrumFlags& flags = it.value();
+	if (flags.contains(iProg))
+		return bool(flags.value(iProg));
 
-	return isDrum(-1, iProg);
+	return bool(flags.value(-1));
 }
 
 
@@ -101,6 +170,15 @@ void InstrumentList::clearAll (void)
 }
 
 
+// Resolve the lookup index of every instrument.
+void InstrumentList::buildIndex (void) const
+{
+	InstrumentList::ConstIterator it = constBegin();
+	for (; it != constEnd(); ++it)
+		it.value().buildIndex();
+}
+
+
 // Special list merge method.
 void InstrumentList::merge ( const InstrumentList& instruments )
 {
@@ -141,6 +219,165 @@ const QStringList& InstrumentList::files (void) const
 }
 
 
+//----------------------------------------------------------------------
+// class InsLine -- a simplified .ins file line, without allocations.
+//
+
+namespace {
+
+// Size of the chunks read from the text stream.
+const qint64 c_iReadChunk = 64 * 1024;
+
+class InsLine
+{
+public:
+
+	// Copy [pBegin, pEnd) collapsing whitespace, like QString::simplified().
+	void assign(const QChar *pBegin, const QChar *pEnd)
+	{
+		m_data.resize(int(pEnd - pBegin));
+		QChar *pData = m_data.data();
+		int iSize = 0;
+		bool bSpace = false;
+		for (const QChar *p = pBegin; p < pEnd; ++p) {
+			if (p->isSpace()) {
+				bSpace = (iSize > 0);
+				continue;
+			}
+			if (bSpace) {
+				pData[iSize++] = QLatin1Char(' ');
+				bSpace = false;
+			}
+			pData[iSize++] = *p;
+		}
+		m_iSize = iSize;
+	}
+
+	int size() const { return m_iSize; }
+	bool isEmpty() const { return m_iSize == 0; }
+	QChar at(int i) const { return m_data.at(i); }
+
+	// Does the line start with the given ASCII text at position iPos?
+	bool matches(int iPos, const char *pszText) const
+	{
+		for (; *pszText; ++pszText, ++iPos) {
+			if (iPos >= m_iSize || m_data.at(iPos) != QLatin1Char(*pszText))
+				return false;
+		}
+		return true;
+	}
+
+	bool equals(const char *pszText) const
+		{ return matches(0, pszText) && int(qstrlen(pszText)) == m_iSize; }
+
+	QString mid(int iPos) const
+		{ return QString(m_data.constData() + iPos, m_iSize - iPos); }
+	QString mid(int iPos, int iLen) const
+		{ return QString(m_data.constData() + iPos, iLen); }
+	QString toString() const
+		{ return mid(0); }
+
+	// Parse "[0-9]+" at iPos; out of range numbers give 0, as QString::toInt.
+	bool number(int& iPos, int& iValue) const
+	{
+		int i = iPos;
+		qint64 iNum = 0;
+		while (i < m_iSize && m_data.at(i).unicode() >= '0'
+				&& m_data.at(i).unicode() <= '9') {
+			if (iNum <= INT_MAX)
+				iNum = iNum * 10 + (m_data.at(i).unicode() - '0');
+			++i;
+		}
+		if (i == iPos)
+			return false;
+		iValue = (iNum > INT_MAX ? 0 : int(iNum));
+		iPos = i;
+		return true;
+	}
+
+	// Parse "([0-9]+|\*)" at iPos; the asterisk wildcard gives -1.
+	bool index(int& iPos, int& iValue) const
+	{
+		if (iPos < m_iSize && m_data.at(iPos) == QLatin1Char('*')) {
+			iValue = -1;
+			++iPos;
+			return true;
+		}
+		return number(iPos, iValue);
+	}
+
+	// Parse "\[([^\]]+)\]" as the whole line.
+	bool title(QString& sTitle) const
+	{
+		if (m_iSize < 3 || m_data.at(0) != QLatin1Char('[')
+				|| m_data.at(m_iSize - 1) != QLatin1Char(']'))
+			return false;
+		for (int i = 1; i < m_iSize - 1; ++i) {
+			if (m_data.at(i) == QLatin1Char(']'))
+				return false;
+		}
+		sTitle = mid(1, m_iSize - 2);
+		return true;
+	}
+
+	// Parse "<keyword>(.+)" as the whole line.
+	bool keyword(const char *pszKeyword, QString& sValue) const
+	{
+		int iPos = int(qstrlen(pszKeyword));
+		if (!matches(0, pszKeyword) || iPos >= m_iSize)
+			return false;
+		sValue = mid(iPos);
+		return true;
+	}
+
+	// Parse "<keyword>([0-<iMax>])" as the whole line.
+	bool flag(const char *pszKeyword, int iMax, int& iValue) const
+	{
+		int iPos = int(qstrlen(pszKeyword));
+		if (!matches(0, pszKeyword) || iPos != m_iSize - 1)
+			return false;
+		int iDigit = m_data.at(iPos).unicode() - '0';
+		if (iDigit < 0 || iDigit > iMax)
+			return false;
+		iValue = iDigit;
+		return true;
+	}
+
+	// Parse "([0-9]+)=(.*)" as the whole line.
+	bool data(int& iKey, QString& sValue) const
+	{
+		int iPos = 0;
+		if (!number(iPos, iKey) || !matches(iPos, "="))
+			return false;
+		sValue = mid(iPos + 1);
+		return true;
+	}
+
+	// Parse "<keyword>\[([0-9]+|\*)(,([0-9]+|\*))?\]=" returning the
+	// position of the value, or -1.
+	int indexed(const char *pszKeyword, int& iBank, int *piProg) const
+	{
+		int iPos = int(qstrlen(pszKeyword));
+		if (!matches(0, pszKeyword) || !index(iPos, iBank))
+			return -1;
+		if (piProg) {
+			if (!matches(iPos, ",") || !index(++iPos, *piProg))
+				return -1;
+		}
+		if (!matches(iPos, "]="))
+			return -1;
+		return iPos + 2;
+	}
+
+private:
+
+	QVarLengthArray<QChar, 256> m_data;
+	int m_iSize = 0;
+};
+
+}
+
+
 // File load method.
 bool InstrumentList::load ( const QString& sFilename )
 {
@@ -161,209 +398,224 @@ bool InstrumentList::load ( const QString& sFilename )
 
 	Instrument     *pInstrument = nullptr;
 	InstrumentData *pData = nullptr;
-
-	QRegExp rxTitle   ("^\\[([^\\]]+)\\]$");
-	QRegExp rxData    ("^([0-9]+)=(.*)$");
-	QRegExp rxBasedOn ("^BasedOn=(.+)$");
-	QRegExp rxBankSel ("^BankSelMethod=(0|1|2|3)$");
-	QRegExp rxUseNotes("^UsesNotesAsControllers=(0|1)$");
-	QRegExp rxControl ("^Control=(.+)$");
-	QRegExp rxRpn     ("^RPN=(.+)$");
-	QRegExp rxNrpn    ("^NRPN=(.+)$");
-	QRegExp rxPatch   ("^Patch\\[([0-9]+|\\*)\\]=(.+)$");
-	QRegExp rxKey     ("^Key\\[([0-9]+|\\*),([0-9]+|\\*)\\]=(.+)$");
-	QRegExp rxDrum    ("^Drum\\[([0-9]+|\\*),([0-9]+|\\*)\\]=(0|1)$");
+	InstrumentDataList *pDataList = nullptr;
+	const char *pszSection = nullptr;
 
 	const QString s0_127("0..127");
 	const QString s1_128("1..128");
 	const QString s0_16383("0..16383");
-	const QString sAsterisk('*');
 
-	// Read the file.
+	// Read the file, in big chunks, one line at a time.
 	unsigned int iLine = 0;
 	QTextStream ts(&file);
-
-	while (!ts.atEnd()) {
+	QString sBuffer;
+	QString sTitle, sValue;
+	InsLine line;
+	bool bEof = false;
+	int iPos = 0;
+
+	while (!bEof || iPos < sBuffer.size()) {
+
+		// Find the end of the line, or get more text.
+		int iEnd = sBuffer.indexOf(QLatin1Char('\n'), iPos);
+		if (iEnd < 0) {
+			if (!bEof) {
+				sBuffer.remove(0, iPos);
+				iPos = 0;
+				const QString& sChunk = ts.read(c_iReadChunk);
+				if (sChunk.isEmpty())
+					bEof = true;
+				else
+					sBuffer += sChunk;
+				continue;
+			}
+			iEnd = sBuffer.size();
+		}
 
 		// Read the line.
 		iLine++;
-		QString sLine = ts.readLine().simplified();
+		line.assign(sBuffer.constData() + iPos, sBuffer.constData() + iEnd);
+		iPos = iEnd + 1;
 		// If not empty, nor a comment, call the server...
-		if (sLine.isEmpty() || sLine[0] == ';')
+		if (line.isEmpty() || line.at(0) == QLatin1Char(';'))
 			continue;
 
 		// Check for section intro line...
-		if (sLine[0] == '.') {
-			if (sLine == ".Patch Names") {
+		if (line.at(0) == QLatin1Char('.')) {
+			if (line.equals(".Patch Names")) {
 				sect = PatchNames;
-			//	m_patches.clear();
+				pDataList = &m_patches;
+				pData = nullptr;
+				pszSection = ".Patch Names";
 				m_patches[s0_127].setName(s0_127);
 				m_patches[s1_128].setName(s1_128);
 			}
-			else if (sLine == ".Note Names") {
+			else if (line.equals(".Note Names")) {
 				sect = NoteNames;
-			//	m_notes.clear();
+				pDataList = &m_notes;
+				pData = nullptr;
+				pszSection = ".Note Names";
 				m_notes[s0_127].setName(s0_127);
 			}
-			else if (sLine == ".Controller Names") {
+			else if (line.equals(".Controller Names")) {
 				sect = ControlNames;
-			//	m_controllers.clear();
+				pDataList = &m_controllers;
+				pData = nullptr;
+				pszSection = ".Controller Names";
 				m_controllers[s0_127].setName(s0_127);
 			}
-			else if (sLine == ".RPN Names") {
+			else if (line.equals(".RPN Names")) {
 				sect = RpnNames;
-			//	m_rpns.clear();
+				pDataList = &m_rpns;
+				pData = nullptr;
+				pszSection = ".RPN Names";
 				m_rpns[s0_16383].setName(s0_16383);
 			}
-			else if (sLine == ".NRPN Names") {
+			else if (line.equals(".NRPN Names")) {
 				sect = NrpnNames;
-			//	m_nrpns.clear();
+				pDataList = &m_nrpns;
+				pData = nullptr;
+				pszSection = ".NRPN Names";
 				m_nrpns[s0_16383].setName(s0_16383);
 			}
-			else if (sLine == ".Instrument Definitions") {
+			else if (line.equals(".Instrument Definitions")) {
 				sect = InstrDefs;
-			//  clear();
+				pInstrument = nullptr;
+				pszSection = ".Instrument Definitions";
 			}
 			else {
 				// Unknown section found...
 				qWarning("%s(%d): %s: Unknown section.",
-					sFilename.toUtf8().constData(), iLine, sLine.toUtf8().constData());
+					sFilename.toUtf8().constData(), iLine,
+					line.toString().toUtf8().constData());
 			}
 			// Go on...
 			continue;
 		}
 
-		// Now it depends on the section...
+		// Now it depends on the section, and the first character...
+		bool bKnown = false;
+		const char ch = line.at(0).toLatin1();
 		switch (sect) {
-			case PatchNames: {
-				if (rxTitle.exactMatch(sLine)) {
-					// New patch name...
-					const QString& sTitle = rxTitle.cap(1);
-					pData = &(m_patches[sTitle]);
-					pData->setName(sTitle);
-				} else if (rxBasedOn.exactMatch(sLine)) {
-					pData->setBasedOn(rxBasedOn.cap(1));
-				} else if (rxData.exactMatch(sLine)) {
-					(*pData)[rxData.cap(1).toInt()] = rxData.cap(2);
-				} else {
-					qWarning("%s(%d): %s: Unknown .Patch Names entry.",
-						sFilename.toUtf8().constData(), iLine, sLine.toUtf8().constData());
+			case PatchNames:
+			case NoteNames:
+			case ControlNames:
+			case RpnNames:
+			case NrpnNames: {
+				int iKey = 0;
+				if (ch == '[') {
+					if (line.title(sTitle)) {
+						// New names list...
+						pData = &((*pDataList)[sTitle]);
+						pData->setName(sTitle);
+						bKnown = true;
+					}
+				} else if (ch == 'B') {
+					if (pData && line.keyword("BasedOn=", sValue)) {
+						pData->setBasedOn(sValue);
+						bKnown = true;
+					}
+				} else if (ch >= '0' && ch <= '9') {
+					if (pData && line.data(iKey, sValue)) {
+						(*pData)[iKey] = sValue;
+						bKnown = true;
+					}
 				}
 				break;
 			}
-			case NoteNames: {
-				if (rxTitle.exactMatch(sLine)) {
-					// New note name...
-					const QString& sTitle = rxTitle.cap(1);
-					pData = &(m_notes[sTitle]);
-					pData->setName(sTitle);
-				} else if (rxBasedOn.exactMatch(sLine)) {
-					pData->setBasedOn(rxBasedOn.cap(1));
-				} else if (rxData.exactMatch(sLine)) {
-					(*pData)[rxData.cap(1).toInt()] = rxData.cap(2);
-				} else {
-					qWarning("%s(%d): %s: Unknown .Note Names entry.",
-						sFilename.toUtf8().constData(), iLine, sLine.toUtf8().constData());
+			case InstrDefs: {
+				int iBank = 0, iProg = 0, iValue = 0;
+				if (ch == '[') {
+					if (line.title(sTitle)) {
+						// New instrument definition...
+						pInstrument = &((*this)[sTitle]);
+						pInstrument->setInstrumentName(sTitle);
+						bKnown = true;
+					}
 				}
-				break;
-			}
-			case ControlNames: {
-				if (rxTitle.exactMatch(sLine)) {
-					// New controller name...
-					const QString& sTitle = rxTitle.cap(1);
-					pData = &(m_controllers[sTitle]);
-					pData->setName(sTitle);
-				} else if (rxBasedOn.exactMatch(sLine)) {
-					pData->setBasedOn(rxBasedOn.cap(1));
-				} else if (rxData.exactMatch(sLine)) {
-					(*pData)[rxData.cap(1).toInt()] = rxData.cap(2);
-				} else {
-					qWarning("%s(%d): %s: Unknown .Controller Names entry.",
-						sFilename.toUtf8().constData(), iLine, sLine.toUtf8().constData());
+				else if (pInstrument == nullptr) {
+					break;
 				}
-				break;
-			}
-			case RpnNames: {
-				if (rxTitle.exactMatch(sLine)) {
-					// New RPN name...
-					const QString& sTitle = rxTitle.cap(1);
-					pData = &(m_rpns[sTitle]);
-					pData->setName(sTitle);
-				} else if (rxBasedOn.exactMatch(sLine)) {
-					pData->setBasedOn(rxBasedOn.cap(1));
-				} else if (rxData.exactMatch(sLine)) {
-					(*pData)[rxData.cap(1).toInt()] = rxData.cap(2);
-				} else {
-					qWarning("%s(%d): %s: Unknown .RPN Names entry.",
-						sFilename.toUtf8().constData(), iLine, sLine.toUtf8().constData());
+				else if (ch == 'B') {
+					if (line.flag("BankSelMethod=", 3, iValue)) {
+						pInstrument->setBankSelMethod(iValue);
+						bKnown = true;
+					}
 				}
-				break;
-			}
-			case NrpnNames: {
-				if (rxTitle.exactMatch(sLine)) {
-					// New NRPN name...
-					const QString& sTitle = rxTitle.cap(1);
-					pData = &(m_nrpns[sTitle]);
-					pData->setName(sTitle);
-				} else if (rxBasedOn.exactMatch(sLine)) {
-					pData->setBasedOn(rxBasedOn.cap(1));
-				} else if (rxData.exactMatch(sLine)) {
-					(*pData)[rxData.cap(1).toInt()] = rxData.cap(2);
-				} else {
-					qWarning("%s(%d): %s: Unknown .NRPN Names entry.",
-						sFilename.toUtf8().constData(), iLine, sLine.toUtf8().constData());
+				else if (ch == 'U') {
+					if (line.flag("UsesNotesAsControllers=", 1, iValue)) {
+						// The value is ignored, as the regular
+						// expression parser always did.
+						pInstrument->setUsesNotesAsControllers(false);
+						bKnown = true;
+					}
 				}
-				break;
-			}
-			case InstrDefs: {
-				if (rxTitle.exactMatch(sLine)) {
-					// New instrument definition...
-					const QString& sTitle = rxTitle.cap(1);
-					pInstrument = &((*this)[sTitle]);
-					pInstrument->setInstrumentName(sTitle);
-				} else if (rxBankSel.exactMatch(sLine)) {
-					pInstrument->setBankSelMethod(
-						rxBankSel.cap(1).toInt());
-				} else if (rxUseNotes.exactMatch(sLine)) {
-					pInstrument->setUsesNotesAsControllers(
-						(bool) rxBankSel.cap(1).toInt());
-				} else if (rxPatch.exactMatch(sLine)) {
-					int iBank = (rxPatch.cap(1) == sAsterisk
-						? -1 : rxPatch.cap(1).toInt());
-					pInstrument->setPatch(iBank, m_patches[rxPatch.cap(2)]);
-				} else if (rxControl.exactMatch(sLine)) {
-					pInstrument->setControl(m_controllers[rxControl.cap(1)]);
-				} else if (rxRpn.exactMatch(sLine)) {
-					pInstrument->setRpn(m_rpns[rxRpn.cap(1)]);
-				} else if (rxNrpn.exactMatch(sLine)) {
-					pInstrument->setNrpn(m_nrpns[rxNrpn.cap(1)]);
-				} else if (rxKey.exactMatch(sLine)) {
-					int iBank = (rxKey.cap(1) == sAsterisk
-						? -1 : rxKey.cap(1).toInt());
-					int iProg = (rxKey.cap(2) == sAsterisk
-						? -1 : rxKey.cap(2).toInt());
-					pInstrument->setNotes(iBank, iProg,	m_notes[rxKey.cap(3)]);
-				} else if (rxDrum.exactMatch(sLine)) {
-					int iBank = (rxDrum.cap(1) == sAsterisk
-						? -1 : rxDrum.cap(1).toInt());
-					int iProg = (rxDrum.cap(2) == sAsterisk
-						? -1 : rxKey.cap(2).toInt());
-					pInstrument->setDrum(iBank, iProg,
-						(bool) rxDrum.cap(3).toInt());
-				} else {
-					qWarning("%s(%d): %s: Unknown .Instrument Definitions entry.",
-						sFilename.toUtf8().constData(), iLine, sLine.toUtf8().constData());
+				else if (ch == 'P') {
+					int i = line.indexed("Patch[", iBank, nullptr);
+					if (i > 0 && i < line.size()) {
+						pInstrument->setPatch(iBank, m_patches[line.mid(i)]);
+						bKnown = true;
+					}
+				}
+				else if (ch == 'C') {
+					if (line.keyword("Control=", sValue)) {
+						pInstrument->setControl(m_controllers[sValue]);
+						bKnown = true;
+					}
+				}
+				else if (ch == 'R') {
+					if (line.keyword("RPN=", sValue)) {
+						pInstrument->setRpn(m_rpns[sValue]);
+						bKnown = true;
+					}
+				}
+				else if (ch == 'N') {
+					if (line.keyword("NRPN=", sValue)) {
+						pInstrument->setNrpn(m_nrpns[sValue]);
+						bKnown = true;
+					}
+				}
+				else if (ch == 'K') {
+					int i = line.indexed("Key[", iBank, &iProg);
+					if (i > 0 && i < line.size()) {
+						pInstrument->setNotes(iBank, iProg, m_notes[line.mid(i)]);
+						bKnown = true;
+					}
+				}
+				else if (ch == 'D') {
+					int i = line.indexed("Drum[", iBank, &iProg);
+					if (i > 0 && i == line.size() - 1) {
+						int iDigit = line.at(i).unicode() - '0';
+						if (iDigit == 0 || iDigit == 1) {
+							// Any program but the wildcard is read as 0,
+							// as the regular expression parser always did.
+							if (iProg > 0)
+								iProg = 0;
+							pInstrument->setDrum(iBank, iProg, bool(iDigit));
+							bKnown = true;
+						}
+					}
 				}
 				break;
 			}
 			default:
+				bKnown = true;
 				break;
 		}
+
+		if (!bKnown) {
+			qWarning("%s(%d): %s: Unknown %s entry.",
+				sFilename.toUtf8().constData(), iLine,
+				line.toString().toUtf8().constData(), pszSection);
+		}
 	}
 
 	// Ok. We've read it all.
 	file.close();
 
+	// Resolve the wildcards once, now.
+	buildIndex();
+
 	// We're in business...
 	appendFile(sFilename);
 
@@ -28,6 +28,8 @@
 
 #include <QStringList>
 #include <QMap>
+#include <QHash>
+#include <QVector>
 
 // Forward declarations.
 class QTextStream;
@@ -89,6 +91,12 @@ public:
 	bool contains(int iKey) const
 		{ return m_pData->map.contains(iKey); }
 
+	// Direct (implicitly shared) map accessor.
+	const DataMap& map() const { return m_pData->map; }
+
+	// Identity of the shared payload.
+	const void *identity() const { return m_pData; }
+
 protected:
 
 	// Copy/clone method.
@@ -217,17 +225,20 @@ public:
 	// Keys banks accessors.
 	const InstrumentData& notes(int iBank, int iProg) const;
 	void setNotes(int iBank, int iProg, const InstrumentData& notes)
-		{ m_pData->keys[iBank][iProg] = notes; }
+		{ m_pData->keys[iBank][iProg] = notes; m_pData->indexed = false; }
 	const InstrumentKeys& keys() const
 		{ return m_pData->keys; }
 
 	// Drumflags banks accessors.
 	bool isDrum(int iBank, int iProg) const;
 	void setDrum(int iBank, int iProg, bool bDrum)
-		{ m_pData->drums[iBank][iProg] = (int) bDrum; }
+		{ m_pData->drums[iBank][iProg] = (int) bDrum; m_pData->indexed = false; }
 	const InstrumentDrums& drums() const
 		{ return m_pData->drums; }
 
+	// Resolve the (bank, prog) lookup index, wildcards included.
+	void buildIndex() const;
+
 protected:
 
 	// Copy/clone method.
@@ -237,14 +248,26 @@ protected:
 	void detach()
 		{ if (--(m_pData->refCount) == 0) delete m_pData; }
 
+	// Slow path lookups, straight from the definition maps.
+	const InstrumentData& resolveNotes(int iBank, int iProg) const;
+	bool resolveDrum(int iBank, int iProg) const;
+
 private:
 
+	// One resolved bank of the lookup index.
+	struct IndexRow
+	{
+		const InstrumentData *notes[128];
+		bool drums[128];
+	};
+
 	// The ref-counted data.
 	struct DataRef
 	{
 		// Default payload constructor.
 		DataRef() : refCount(1),
-			bankSelMethod(0), usesNotesAsControllers(false) {};
+			bankSelMethod(0), usesNotesAsControllers(false),
+			indexed(false) {};
 		// Payload members.
 		int                       refCount;
 		int                       bankSelMethod;
@@ -256,6 +279,10 @@ private:
 		InstrumentData    nrpn;
 		InstrumentKeys    keys;
 		InstrumentDrums   drums;
+		// Lookup index: row 0 is for any bank not defined.
+		bool                      indexed;
+		QHash<int, int>           indexBanks;
+		QVector<IndexRow>         indexRows;
 
 	} * m_pData;
 };
@@ -319,9 +346,15 @@ public:
 	// Clear all contents.
 	void clearAll();
 
+	// Resolve the lookup index of every instrument.
+	void buildIndex() const;
+
 	// Special instrument list merge method.
 	void merge(const InstrumentList& instruments);
 
+	// The binary cache reads and writes the names lists directly.
+	friend class InstrumentCache;
+
 protected:
 
 	// Internal instrument data list save method helpers.
@@ -0,0 +1,395 @@
+/***************************************************************************
+ *   KMetronome - ALSA Sequencer based MIDI metronome                      *
+ *   Copyright (C) 2005-2021 Pedro Lopez-Cabanillas <plcl@users.sf.net>    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
+ ***************************************************************************/
+
+#include <cstring>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QList>
+#include <QMutex>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QVector>
+#include "instrument.h"
+#include "instrumentcache.h"
+
+const quint32 CACHE_MAGIC(0x43494d4b); /* "KMIC" */
+const quint32 CACHE_VERSION(1);
+const quint32 CACHE_BYTE_ORDER(0x01020304);
+
+enum DataKind {
+    NoList = 0,
+    PatchList,
+    NoteList,
+    ControllerList,
+    RpnList,
+    NrpnList
+};
+
+/*
+ * Mapped cache files are never unmapped: strings handed out point into
+ * them. Only the first load of each cache file is mapped for good; the
+ * cache written after its source was edited is read into copies.
+ */
+struct CacheMapping {
+    QFile* file;
+    uchar* base;
+    qint64 size;
+};
+static QMutex s_mappedMutex;
+static QList<QFile*> s_mappedFiles;
+/* The first mapping of each cache file, reused while still valid */
+static QHash<QString, CacheMapping> s_latestMappings;
+
+namespace {
+
+class CacheWriter
+{
+public:
+    void u32(quint32 v) { m_data.append(reinterpret_cast<const char*>(&v), sizeof(v)); }
+    void i32(qint32 v) { m_data.append(reinterpret_cast<const char*>(&v), sizeof(v)); }
+    void i64(qint64 v) { m_data.append(reinterpret_cast<const char*>(&v), sizeof(v)); }
+    void str(const QString& s)
+    {
+        u32(quint32(s.size()));
+        m_data.append(reinterpret_cast<const char*>(s.constData()), s.size() * int(sizeof(QChar)));
+        while (m_data.size() % 4 != 0)
+            m_data.append('\0');
+    }
+    const QByteArray& data() const { return m_data; }
+
+private:
+    QByteArray m_data;
+};
+
+class CacheReader
+{
+public:
+    CacheReader(const uchar* base, qint64 size, bool copy = false) :
+        m_base(base), m_size(size), m_pos(0), m_ok(true), m_copy(copy) {}
+
+    bool ok() const { return m_ok; }
+
+    quint32 u32() { quint32 v = 0; read(&v, sizeof(v)); return v; }
+    qint32 i32() { qint32 v = 0; read(&v, sizeof(v)); return v; }
+    qint64 i64() { qint64 v = 0; read(&v, sizeof(v)); return v; }
+    QString str()
+    {
+        quint32 len = u32();
+        qint64 bytes = qint64(len) * qint64(sizeof(QChar));
+        if (!m_ok || bytes > m_size - m_pos) {
+            m_ok = false;
+            return QString();
+        }
+        QString s;
+        if (len > 0 && m_copy)
+            s = QString(reinterpret_cast<const QChar*>(m_base + m_pos), int(len));
+        else if (len > 0)
+            s = QString::fromRawData(reinterpret_cast<const QChar*>(m_base + m_pos), int(len));
+        m_pos += (bytes + 3) & ~qint64(3);
+        return s;
+    }
+
+private:
+    void read(void* v, qint64 len)
+    {
+        if (!m_ok || len > m_size - m_pos) {
+            m_ok = false;
+            return;
+        }
+        memcpy(v, m_base + m_pos, size_t(len));
+        m_pos += len;
+    }
+
+    const uchar* m_base;
+    qint64 m_size;
+    qint64 m_pos;
+    bool m_ok;
+    bool m_copy;
+};
+
+}
+
+QString InstrumentCache::cacheFileName(const QString& sourceFile)
+{
+    QString dir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    if (dir.isEmpty())
+        return QString();
+    QByteArray key = QCryptographicHash::hash(
+        QFileInfo(sourceFile).absoluteFilePath().toUtf8(), QCryptographicHash::Sha1).toHex();
+    return dir + "/instruments/" + QString::fromLatin1(key) + ".cache";
+}
+
+static void writeHeader(CacheWriter& w, const QString& sourceFile)
+{
+    QFileInfo info(sourceFile);
+    w.u32(CACHE_MAGIC);
+    w.u32(CACHE_VERSION);
+    w.u32(CACHE_BYTE_ORDER);
+    w.u32(0);
+    w.i64(info.size());
+    w.i64(info.lastModified().toMSecsSinceEpoch());
+    w.str(info.absoluteFilePath());
+}
+
+static bool readHeader(CacheReader& r, const QString& sourceFile)
+{
+    QFileInfo info(sourceFile);
+    if (r.u32() != CACHE_MAGIC || r.u32() != CACHE_VERSION ||
+        r.u32() != CACHE_BYTE_ORDER)
+        return false;
+    r.u32();
+    if (r.i64() != info.size() ||
+        r.i64() != info.lastModified().toMSecsSinceEpoch())
+        return false;
+    return r.str() == info.absoluteFilePath() && r.ok();
+}
+
+bool InstrumentCache::save(const QString& sourceFile, const InstrumentList& list)
+{
+    QString fileName = cacheFileName(sourceFile);
+    if (fileName.isEmpty() || !QDir().mkpath(QFileInfo(fileName).absolutePath()))
+        return false;
+
+    // Every distinct InstrumentData goes once into a table, referenced by index.
+    QVector<InstrumentData> table;
+    QVector<int> kinds;
+    QStringList keys;
+    QHash<const void*, int> index;
+    const InstrumentDataList* lists[] = { nullptr,
+        &list.m_patches, &list.m_notes, &list.m_controllers, &list.m_rpns, &list.m_nrpns };
+    for (int kind = PatchList; kind <= NrpnList; ++kind) {
+        InstrumentDataList::ConstIterator it;
+        for (it = lists[kind]->constBegin(); it != lists[kind]->constEnd(); ++it) {
+            index.insert(it.value().identity(), table.size());
+            table.append(it.value());
+            kinds.append(kind);
+            keys.append(it.key());
+        }
+    }
+    auto ref = [&](const InstrumentData& data) -> qint32 {
+        int i = index.value(data.identity(), -1);
+        if (i < 0) {
+            i = table.size();
+            index.insert(data.identity(), i);
+            table.append(data);
+            kinds.append(NoList);
+            keys.append(QString());
+        }
+        return i;
+    };
+
+    CacheWriter ins;
+    ins.u32(quint32(list.count()));
+    InstrumentList::ConstIterator it;
+    for (it = list.constBegin(); it != list.constEnd(); ++it) {
+        const Instrument& instr = it.value();
+        ins.str(it.key());
+        ins.str(instr.instrumentName());
+        ins.i32(instr.bankSelMethod());
+        ins.u32(instr.usesNotesAsControllers() ? 1 : 0);
+        ins.i32(ref(instr.control()));
+        ins.i32(ref(instr.rpn()));
+        ins.i32(ref(instr.nrpn()));
+        ins.u32(quint32(instr.patches().count()));
+        InstrumentPatches::ConstIterator pit;
+        for (pit = instr.patches().constBegin(); pit != instr.patches().constEnd(); ++pit) {
+            ins.i32(pit.key());
+            ins.i32(ref(pit.value()));
+        }
+        quint32 count = 0;
+        InstrumentKeys::ConstIterator kit;
+        for (kit = instr.keys().constBegin(); kit != instr.keys().constEnd(); ++kit)
+            count += quint32(kit.value().count());
+        ins.u32(count);
+        for (kit = instr.keys().constBegin(); kit != instr.keys().constEnd(); ++kit) {
+            InstrumentNotes::ConstIterator nit;
+            for (nit = kit.value().constBegin(); nit != kit.value().constEnd(); ++nit) {
+                ins.i32(kit.key());
+                ins.i32(nit.key());
+                ins.i32(ref(nit.value()));
+            }
+        }
+        count = 0;
+        InstrumentDrums::ConstIterator dit;
+        for (dit = instr.drums().constBegin(); dit != instr.drums().constEnd(); ++dit)
+            count += quint32(dit.value().count());
+        ins.u32(count);
+        for (dit = instr.drums().constBegin(); dit != instr.drums().constEnd(); ++dit) {
+            InstrumentDrumFlags::ConstIterator fit;
+            for (fit = dit.value().constBegin(); fit != dit.value().constEnd(); ++fit) {
+                ins.i32(dit.key());
+                ins.i32(fit.key());
+                ins.i32(fit.value());
+            }
+        }
+    }
+
+    CacheWriter w;
+    writeHeader(w, sourceFile);
+    w.u32(quint32(table.size()));
+    for (int i = 0; i < table.size(); ++i) {
+        const InstrumentData& data = table.at(i);
+        w.u32(quint32(kinds.at(i)));
+        w.str(keys.at(i));
+        w.str(data.name());
+        w.str(data.basedOn());
+        w.u32(data.count());
+        InstrumentData::ConstIterator dit;
+        for (dit = data.constBegin(); dit != data.constEnd(); ++dit) {
+            w.i32(dit.key());
+            w.str(dit.value());
+        }
+    }
+
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    file.write(w.data());
+    file.write(ins.data());
+    return file.commit();
+}
+
+bool InstrumentCache::load(const QString& sourceFile, InstrumentList& list)
+{
+    QString fileName = cacheFileName(sourceFile);
+    if (fileName.isEmpty() || !QFileInfo::exists(fileName) || !QFileInfo::exists(sourceFile))
+        return false;
+    CacheMapping m = { nullptr, nullptr, 0 };
+    s_mappedMutex.lock();
+    bool known = s_latestMappings.contains(fileName);
+    if (known)
+        m = s_latestMappings.value(fileName);
+    s_mappedMutex.unlock();
+    bool shared = false;
+    if (known) {
+        CacheReader check(m.base, m.size);
+        shared = readHeader(check, sourceFile);
+    }
+    // A mapping superseded by an edit of the source stays pinned by the
+    // lists built from it, so the new cache is read into copies and
+    // unmapped at once instead of adding another mapping on every reload.
+    bool copy = known && !shared;
+    if (!shared) {
+        m.file = new QFile(fileName);
+        m.base = nullptr;
+        if (m.file->open(QIODevice::ReadOnly)) {
+            m.size = m.file->size();
+            m.base = m.file->map(0, m.size);
+        }
+        if (m.base == nullptr) {
+            delete m.file;
+            return false;
+        }
+    }
+
+    CacheReader r(m.base, m.size, copy);
+    bool ok = readHeader(r, sourceFile);
+    InstrumentList result;
+    if (ok) {
+        InstrumentDataList* lists[] = { nullptr,
+            &result.m_patches, &result.m_notes, &result.m_controllers,
+            &result.m_rpns, &result.m_nrpns };
+        quint32 tableSize = r.u32();
+        QVector<InstrumentData> table;
+        for (quint32 i = 0; r.ok() && i < tableSize; ++i) {
+            InstrumentData data;
+            quint32 kind = r.u32();
+            QString key = r.str();
+            data.setName(r.str());
+            data.setBasedOn(r.str());
+            quint32 count = r.u32();
+            for (quint32 j = 0; r.ok() && j < count; ++j) {
+                int k = r.i32();
+                data[k] = r.str();
+            }
+            if (kind > NoList && kind <= NrpnList)
+                lists[kind]->insert(key, data);
+            table.append(data);
+        }
+        auto ref = [&](qint32 i) -> InstrumentData {
+            if (i < 0 || i >= table.size()) {
+                ok = false;
+                return InstrumentData();
+            }
+            return table.at(i);
+        };
+        quint32 instrCount = r.u32();
+        for (quint32 i = 0; r.ok() && ok && i < instrCount; ++i) {
+            QString key = r.str();
+            Instrument& instr = result[key];
+            instr.setInstrumentName(r.str());
+            instr.setBankSelMethod(r.i32());
+            instr.setUsesNotesAsControllers(r.u32() != 0);
+            instr.setControl(ref(r.i32()));
+            instr.setRpn(ref(r.i32()));
+            instr.setNrpn(ref(r.i32()));
+            quint32 count = r.u32();
+            for (quint32 j = 0; r.ok() && j < count; ++j) {
+                int bank = r.i32();
+                instr.setPatch(bank, ref(r.i32()));
+            }
+            count = r.u32();
+            for (quint32 j = 0; r.ok() && j < count; ++j) {
+                int bank = r.i32();
+                int prog = r.i32();
+                instr.setNotes(bank, prog, ref(r.i32()));
+            }
+            count = r.u32();
+            for (quint32 j = 0; r.ok() && j < count; ++j) {
+                int bank = r.i32();
+                int prog = r.i32();
+                instr.setDrum(bank, prog, r.i32() != 0);
+            }
+        }
+        ok = ok && r.ok();
+    }
+    if (!ok || copy) {
+        if (!shared) {
+            m.file->unmap(m.base);
+            delete m.file;
+        }
+        if (!ok)
+            return false;
+    } else if (!shared) {
+        s_mappedMutex.lock();
+        s_mappedFiles.append(m.file);
+        s_latestMappings.insert(fileName, m);
+        s_mappedMutex.unlock();
+    }
+    result.buildIndex();
+    list.merge(result);
+    list.appendFile(sourceFile);
+    return true;
+}
+
+bool InstrumentCache::loadInstruments(const QString& sourceFile, InstrumentList& list)
+{
+    if (load(sourceFile, list))
+        return true;
+    InstrumentList parsed;
+    if (!parsed.load(sourceFile))
+        return false;
+    save(sourceFile, parsed);
+    list.merge(parsed);
+    list.appendFile(sourceFile);
+    return true;
+}
@@ -0,0 +1,47 @@
+/***************************************************************************
+ *   KMetronome - ALSA Sequencer based MIDI metronome                      *
+ *   Copyright (C) 2005-2021 Pedro Lopez-Cabanillas <plcl@users.sf.net>    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
+ ***************************************************************************/
+
+#ifndef INSTRUMENTCACHE_H
+#define INSTRUMENTCACHE_H
+
+#include <QString>
+
+class InstrumentList;
+
+/**
+ * Binary cache of parsed instrument definition (.ins) files.
+ *
+ * Each source file gets a cache file under the user cache location, keyed
+ * by the source path, size and modification time. Cache files are memory
+ * mapped and kept mapped for the lifetime of the process: the names stored
+ * in the resulting InstrumentList are built with QString::fromRawData, so
+ * they are read straight from the mapping instead of being copied. Loading
+ * the same file again reuses its mapping while it is still valid. Once the
+ * source has been edited, its new cache is read into copied strings and
+ * unmapped, so reloading never keeps more than one mapping per file.
+ */
+class InstrumentCache
+{
+public:
+    static QString cacheFileName(const QString& sourceFile);
+    static bool load(const QString& sourceFile, InstrumentList& list);
+    static bool save(const QString& sourceFile, const InstrumentList& list);
+    static bool loadInstruments(const QString& sourceFile, InstrumentList& list);
+};
+
+#endif // INSTRUMENTCACHE_H
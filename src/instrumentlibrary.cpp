@@ -0,0 +1,441 @@
+/***************************************************************************
+ *   KMetronome - ALSA Sequencer based MIDI metronome                      *
+ *   Copyright (C) 2005-2021 Pedro Lopez-Cabanillas <plcl@users.sf.net>    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
+ ***************************************************************************/
+
+#include <QDir>
+#include <QFileInfo>
+#include <QFileSystemWatcher>
+#include <QRunnable>
+#include <QThread>
+#include <QTimer>
+#include "instrument.h"
+#include "instrumentcache.h"
+#include "instrumentlibrary.h"
+
+/* Delay to collect bursts of file system notifications, in milliseconds */
+const int RESCAN_DELAY(500);
+/* Approximate heap overhead of a map node, for the memory estimates */
+const qint64 MAP_NODE_SIZE(48);
+
+namespace {
+
+class InstrumentLoadTask : public QRunnable
+{
+public:
+    InstrumentLoadTask(InstrumentLibrary* library, int generation,
+                       const QString& fileName, InstrumentList* list) :
+        m_library(library),
+        m_generation(generation),
+        m_fileName(fileName),
+        m_list(list)
+    { }
+
+    void run() override
+    {
+        if (!InstrumentCache::loadInstruments(m_fileName, *m_list)) {
+            qWarning("Failure loading instrument definitions from %s",
+                     m_fileName.toUtf8().constData());
+        }
+        QMetaObject::invokeMethod(m_library, "fileLoaded",
+                                  Qt::QueuedConnection, Q_ARG(int, m_generation));
+    }
+
+private:
+    InstrumentLibrary* m_library;
+    int m_generation;
+    QString m_fileName;
+    InstrumentList* m_list;
+};
+
+}
+
+InstrumentLibrary::InstrumentLibrary(QObject* parent) : QObject(parent),
+    m_watcher(nullptr),
+    m_generation(0),
+    m_done(0),
+    m_total(0),
+    m_loading(false),
+    m_reloading(false),
+    m_compact(false)
+{
+    m_pool.setMaxThreadCount(QThread::idealThreadCount());
+    m_rescanTimer = new QTimer(this);
+    m_rescanTimer->setSingleShot(true);
+    m_rescanTimer->setInterval(RESCAN_DELAY);
+    connect(m_rescanTimer, &QTimer::timeout, this, &InstrumentLibrary::rescan);
+}
+
+InstrumentLibrary::~InstrumentLibrary()
+{
+    m_pool.waitForDone();
+    clearLists();
+}
+
+void InstrumentLibrary::setBaseFile(const QString& fileName)
+{
+    m_baseFile = fileName;
+}
+
+void InstrumentLibrary::setDirectories(const QStringList& directories)
+{
+    m_directories = directories;
+}
+
+QStringList InstrumentLibrary::scanFiles() const
+{
+    QStringList files;
+    if (!m_baseFile.isEmpty()) {
+        files << m_baseFile;
+    }
+    foreach(const QString& d, m_directories) {
+        QDir dir(d);
+        if (d.isEmpty() || !dir.exists()) {
+            continue;
+        }
+        QFileInfoList entries = dir.entryInfoList(QStringList() << "*.ins" << "*.INS",
+            QDir::Files | QDir::Readable, QDir::Name | QDir::IgnoreCase);
+        foreach(const QFileInfo& f, entries) {
+            QString fileName = f.absoluteFilePath();
+            if (!files.contains(fileName)) {
+                files << fileName;
+            }
+        }
+    }
+    return files;
+}
+
+QDateTime InstrumentLibrary::fileStamp(const QString& fileName) const
+{
+    return QFileInfo(fileName).lastModified();
+}
+
+void InstrumentLibrary::setWatching(bool enable)
+{
+    if (enable && m_watcher == nullptr) {
+        m_watcher = new QFileSystemWatcher(this);
+        connect(m_watcher, &QFileSystemWatcher::directoryChanged,
+                m_rescanTimer, QOverload<>::of(&QTimer::start));
+        connect(m_watcher, &QFileSystemWatcher::fileChanged,
+                m_rescanTimer, QOverload<>::of(&QTimer::start));
+        updateWatcher();
+    } else if (!enable && m_watcher != nullptr) {
+        delete m_watcher;
+        m_watcher = nullptr;
+        m_rescanTimer->stop();
+    }
+}
+
+/* Files replaced by a rename drop out of the watcher, so add them again */
+void InstrumentLibrary::updateWatcher()
+{
+    if (m_watcher == nullptr) {
+        return;
+    }
+    QStringList wanted;
+    foreach(const QString& d, m_directories) {
+        if (!d.isEmpty() && QFileInfo(d).isDir()) {
+            wanted << QFileInfo(d).absoluteFilePath();
+        }
+    }
+    foreach(const QString& f, m_files) {
+        if (!f.startsWith(':')) {
+            wanted << f;
+        }
+    }
+    QStringList watched = m_watcher->directories() + m_watcher->files();
+    foreach(const QString& p, watched) {
+        if (!wanted.contains(p)) {
+            m_watcher->removePath(p);
+        }
+    }
+    foreach(const QString& p, wanted) {
+        if (!watched.contains(p)) {
+            m_watcher->addPath(p);
+        }
+    }
+}
+
+void InstrumentLibrary::clearLists()
+{
+    qDeleteAll(m_lists);
+    m_lists.clear();
+}
+
+/**
+ * Starts parsing every file of the library in the thread pool. The
+ * progress() signal is emitted as the files are done, and loaded() when
+ * all of them are ready to be merged.
+ */
+void InstrumentLibrary::load()
+{
+    m_pool.waitForDone();
+    clearLists();
+    m_files = scanFiles();
+    m_stamps.clear();
+    m_generation++;
+    m_done = 0;
+    m_total = m_files.count();
+    m_loading = true;
+    m_reloading = false;
+    m_names.fill(QStringList(), m_files.count());
+    foreach(const QString& f, m_files) {
+        m_stamps.insert(f, fileStamp(f));
+        m_lists.append(new InstrumentList);
+    }
+    for (int i = 0; i < m_files.count(); ++i) {
+        m_pool.start(new InstrumentLoadTask(this, m_generation, m_files[i], m_lists[i]));
+    }
+    updateWatcher();
+    emit progress(0, m_total);
+    if (m_total == 0) {
+        finish();
+    }
+}
+
+/**
+ * Compares the files in the directories with the loaded ones, and parses
+ * again only those new or modified since they were loaded.
+ */
+void InstrumentLibrary::rescan()
+{
+    if (m_loading) {
+        m_rescanTimer->start();
+        return;
+    }
+    QStringList files = scanFiles();
+    QVector<InstrumentList*> lists;
+    QVector<QStringList> names;
+    QStringList dirty;
+    bool removed = false;
+    foreach(const QString& f, files) {
+        QDateTime stamp = fileStamp(f);
+        int i = m_files.indexOf(f);
+        if (i >= 0 && m_stamps.value(f) == stamp) {
+            lists.append(m_lists[i]);
+            names.append(m_names[i]);
+            m_lists[i] = nullptr;
+        } else {
+            lists.append(new InstrumentList);
+            names.append(QStringList());
+            dirty.append(f);
+            m_stamps.insert(f, stamp);
+        }
+    }
+    foreach(const QString& f, m_files) {
+        if (!files.contains(f)) {
+            m_stamps.remove(f);
+            removed = true;
+        }
+    }
+    clearLists();
+    m_lists = lists;
+    m_names = names;
+    m_files = files;
+    updateWatcher();
+    if (dirty.isEmpty() && !removed) {
+        return;
+    }
+    m_generation++;
+    m_done = 0;
+    m_total = dirty.count();
+    m_loading = true;
+    m_reloading = true;
+    foreach(const QString& f, dirty) {
+        int i = m_files.indexOf(f);
+        m_pool.start(new InstrumentLoadTask(this, m_generation, f, m_lists[i]));
+    }
+    if (m_total == 0) {
+        finish();
+    }
+}
+
+void InstrumentLibrary::waitForFinished()
+{
+    if (m_loading) {
+        m_pool.waitForDone();
+        m_done = m_total;
+        finish();
+    }
+}
+
+void InstrumentLibrary::fileLoaded(int generation)
+{
+    if (!m_loading || generation != m_generation) {
+        return;
+    }
+    m_done++;
+    if (!m_reloading) {
+        emit progress(m_done, m_total);
+    }
+    if (m_done == m_total) {
+        finish();
+    }
+}
+
+void InstrumentLibrary::finish()
+{
+    for (int i = 0; i < m_lists.count(); ++i) {
+        if (m_lists[i] != nullptr) {
+            m_names[i] = m_lists[i]->keys();
+        }
+    }
+    if (m_compact) {
+        compact();
+    }
+    m_loading = false;
+    if (m_reloading) {
+        emit changed();
+    } else {
+        emit loaded();
+    }
+}
+
+void InstrumentLibrary::mergeInto(InstrumentList& list)
+{
+    list.clearAll();
+    m_resident.clear();
+    if (m_compact) {
+        for (int i = 0; i < m_names.count(); ++i) {
+            foreach(const QString& name, m_names[i]) {
+                Instrument placeholder;
+                placeholder.setInstrumentName(name);
+                list[name] = placeholder;
+            }
+            list.appendFile(m_files[i]);
+        }
+        return;
+    }
+    foreach(const InstrumentList* l, m_lists) {
+        list.merge(*l);
+        foreach(const QString& f, l->files()) {
+            list.appendFile(f);
+        }
+    }
+}
+
+/**
+ * Replaces the placeholder of an instrument in a compact list with its
+ * full definition, taken from the last file defining it.
+ */
+bool InstrumentLibrary::pageIn(const QString& name, InstrumentList& list)
+{
+    if (!m_compact || m_resident.contains(name)) {
+        return true;
+    }
+    for (int i = m_names.count() - 1; i >= 0; --i) {
+        if (m_names[i].contains(name)) {
+            InstrumentList source;
+            if (!InstrumentCache::loadInstruments(m_files[i], source) ||
+                !source.contains(name)) {
+                return false;
+            }
+            list[name] = source.value(name);
+            m_resident.append(name);
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Turns every paged in instrument of a compact list, except keep, back
+ * into a placeholder.
+ */
+void InstrumentLibrary::trim(InstrumentList& list, const QString& keep)
+{
+    if (!m_compact) {
+        return;
+    }
+    foreach(const QString& name, m_resident) {
+        if (name != keep && list.contains(name)) {
+            Instrument placeholder;
+            placeholder.setInstrumentName(name);
+            list[name] = placeholder;
+        }
+    }
+    bool kept = m_resident.contains(keep);
+    m_resident.clear();
+    if (kept) {
+        m_resident.append(keep);
+    }
+}
+
+static qint64 estimatedSize(const InstrumentData& data)
+{
+    qint64 size = MAP_NODE_SIZE + (data.name().size() + data.basedOn().size()) * qint64(sizeof(QChar));
+    InstrumentData::ConstIterator it;
+    for (it = data.constBegin(); it != data.constEnd(); ++it) {
+        size += MAP_NODE_SIZE + it.value().size() * qint64(sizeof(QChar));
+    }
+    return size;
+}
+
+static qint64 estimatedSize(const InstrumentDataList& list)
+{
+    qint64 size = 0;
+    InstrumentDataList::ConstIterator it;
+    for (it = list.constBegin(); it != list.constEnd(); ++it) {
+        size += it.key().size() * qint64(sizeof(QChar)) + estimatedSize(it.value());
+    }
+    return size;
+}
+
+/**
+ * Rough heap footprint of the names and map nodes held by a list, the
+ * shared names data counted only once.
+ */
+qint64 InstrumentLibrary::estimatedSize(const InstrumentList& list)
+{
+    qint64 size = ::estimatedSize(list.patches()) + ::estimatedSize(list.notes()) +
+        ::estimatedSize(list.controllers()) + ::estimatedSize(list.rpns()) +
+        ::estimatedSize(list.nrpns());
+    InstrumentList::ConstIterator it;
+    for (it = list.constBegin(); it != list.constEnd(); ++it) {
+        const Instrument& instr = it.value();
+        size += MAP_NODE_SIZE + qint64(sizeof(Instrument)) +
+            (it.key().size() + instr.instrumentName().size()) * qint64(sizeof(QChar));
+        size += instr.patches().count() * MAP_NODE_SIZE;
+        InstrumentKeys::ConstIterator k;
+        for (k = instr.keys().constBegin(); k != instr.keys().constEnd(); ++k) {
+            size += (k.value().count() + 1) * MAP_NODE_SIZE;
+        }
+        InstrumentDrums::ConstIterator d;
+        for (d = instr.drums().constBegin(); d != instr.drums().constEnd(); ++d) {
+            size += (d.value().count() + 1) * MAP_NODE_SIZE;
+        }
+    }
+    return size;
+}
+
+/* Releases the lists just loaded, keeping only their instrument names */
+void InstrumentLibrary::compact()
+{
+    qint64 released = 0;
+    qint64 index = 0;
+    for (int i = 0; i < m_lists.count(); ++i) {
+        if (m_lists[i] != nullptr) {
+            released += estimatedSize(*m_lists[i]);
+            delete m_lists[i];
+            m_lists[i] = nullptr;
+        }
+        foreach(const QString& name, m_names[i]) {
+            index += MAP_NODE_SIZE + qint64(sizeof(Instrument)) + name.size() * qint64(sizeof(QChar));
+        }
+    }
+    qInfo("Compact instrument library: released about %lld KiB of definitions, "
+          "keeping an index of about %lld KiB", released / 1024, index / 1024);
+}
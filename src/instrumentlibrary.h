@@ -0,0 +1,114 @@
+/***************************************************************************
+ *   KMetronome - ALSA Sequencer based MIDI metronome                      *
+ *   Copyright (C) 2005-2021 Pedro Lopez-Cabanillas <plcl@users.sf.net>    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
+ ***************************************************************************/
+
+#ifndef INSTRUMENTLIBRARY_H
+#define INSTRUMENTLIBRARY_H
+
+#include <QDateTime>
+#include <QHash>
+#include <QObject>
+#include <QStringList>
+#include <QThreadPool>
+#include <QVector>
+
+class InstrumentList;
+class QFileSystemWatcher;
+class QTimer;
+
+/**
+ * A set of instrument definition files, loaded in parallel.
+ *
+ * The library is made of a base file followed by every .ins file found in
+ * the instrument directories, sorted by name. Each file is parsed (or read
+ * from its InstrumentCache) by a thread pool worker into its own
+ * InstrumentList, and the lists are merged afterwards always in the same
+ * order, so definitions in later files replace the earlier ones no matter
+ * which worker finished first.
+ *
+ * When watching is enabled, changes in the instrument directories and
+ * files are collected for a short while and then only the files added or
+ * modified are parsed again; the lists of the untouched files are kept,
+ * merged again, and changed() is emitted.
+ *
+ * In compact mode the parsed lists are released as soon as they are
+ * loaded, and only the instrument names of each file are kept. Merging
+ * then produces empty placeholders, and pageIn() brings in the full
+ * definition of a single instrument from its cache file when needed.
+ */
+class InstrumentLibrary : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit InstrumentLibrary(QObject* parent = nullptr);
+    virtual ~InstrumentLibrary();
+
+    void setBaseFile(const QString& fileName);
+    QString baseFile() const { return m_baseFile; }
+    void setDirectories(const QStringList& directories);
+    QStringList directories() const { return m_directories; }
+    QStringList sourceFiles() const { return m_files; }
+
+    void load();
+    bool isLoading() const { return m_loading; }
+    void waitForFinished();
+    void mergeInto(InstrumentList& list);
+    void setWatching(bool enable);
+    bool isWatching() const { return m_watcher != nullptr; }
+    void setCompact(bool enable) { m_compact = enable; }
+    bool isCompact() const { return m_compact; }
+    bool pageIn(const QString& name, InstrumentList& list);
+    void trim(InstrumentList& list, const QString& keep);
+    static qint64 estimatedSize(const InstrumentList& list);
+
+Q_SIGNALS:
+    void progress(int done, int total);
+    void loaded();
+    void changed();
+
+private Q_SLOTS:
+    void fileLoaded(int generation);
+    void rescan();
+
+private:
+    QStringList scanFiles() const;
+    QDateTime fileStamp(const QString& fileName) const;
+    void updateWatcher();
+    void clearLists();
+    void compact();
+    void finish();
+
+    QString m_baseFile;
+    QStringList m_directories;
+    QStringList m_files;
+    QVector<InstrumentList*> m_lists;
+    QVector<QStringList> m_names;
+    QStringList m_resident;
+    QHash<QString, QDateTime> m_stamps;
+    QThreadPool m_pool;
+    QFileSystemWatcher* m_watcher;
+    QTimer* m_rescanTimer;
+    int m_generation;
+    int m_done;
+    int m_total;
+    bool m_loading;
+    bool m_reloading;
+    bool m_compact;
+};
+
+#endif // INSTRUMENTLIBRARY_H
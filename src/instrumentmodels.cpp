@@ -0,0 +1,147 @@
+/***************************************************************************
+ *   KMetronome - ALSA Sequencer based MIDI metronome                      *
+ *   Copyright (C) 2005-2021 Pedro Lopez-Cabanillas <plcl@users.sf.net>    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
+ ***************************************************************************/
+
+#include <algorithm>
+#include "instrument.h"
+#include "instrumentmodels.h"
+
+InstrumentNamesModel::InstrumentNamesModel(QObject *parent)
+    : QAbstractListModel(parent),
+    m_instruments(nullptr),
+    m_fetched(false)
+{ }
+
+void InstrumentNamesModel::setInstruments(const InstrumentList* instruments)
+{
+    beginResetModel();
+    m_instruments = instruments;
+    m_names.clear();
+    m_fetched = false;
+    endResetModel();
+}
+
+int InstrumentNamesModel::rowCount(const QModelIndex &parent) const
+{
+    if (parent.isValid() || m_instruments == nullptr)
+        return 0;
+    return m_instruments->count();
+}
+
+QVariant InstrumentNamesModel::data(const QModelIndex &index, int role) const
+{
+    if (role == Qt::DisplayRole || role == Qt::EditRole) {
+        return nameAt(index.row());
+    }
+    return QVariant();
+}
+
+void InstrumentNamesModel::fetchNames() const
+{
+    if (!m_fetched && m_instruments != nullptr) {
+        m_names = m_instruments->keys();
+        m_fetched = true;
+    }
+}
+
+QString InstrumentNamesModel::nameAt(int row) const
+{
+    fetchNames();
+    return m_names.value(row);
+}
+
+int InstrumentNamesModel::indexOf(const QString& name) const
+{
+    fetchNames();
+    QStringList::ConstIterator it = std::lower_bound(m_names.constBegin(), m_names.constEnd(), name);
+    if (it == m_names.constEnd() || *it != name)
+        return -1;
+    return int(it - m_names.constBegin());
+}
+
+KeyNamesModel::KeyNamesModel(QObject *parent)
+    : QAbstractListModel(parent),
+    m_fetched(false)
+{ }
+
+void KeyNamesModel::setNames(const QMap<int,QString>& names)
+{
+    beginResetModel();
+    m_names = names;
+    m_keys.clear();
+    m_fetched = false;
+    endResetModel();
+}
+
+int KeyNamesModel::rowCount(const QModelIndex &parent) const
+{
+    if (parent.isValid())
+        return 0;
+    return m_names.count();
+}
+
+QVariant KeyNamesModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid() || index.row() >= m_names.count())
+        return QVariant();
+    if (role == Qt::DisplayRole || role == Qt::EditRole)
+        return nameAt(index.row());
+    if (role == Qt::UserRole)
+        return keyAt(index.row());
+    return QVariant();
+}
+
+void KeyNamesModel::fetchKeys() const
+{
+    if (!m_fetched) {
+        m_keys = m_names.keys().toVector();
+        m_fetched = true;
+    }
+}
+
+int KeyNamesModel::keyAt(int row) const
+{
+    fetchKeys();
+    return m_keys.value(row, -1);
+}
+
+QString KeyNamesModel::nameAt(int row) const
+{
+    fetchKeys();
+    if (row < 0 || row >= m_keys.count())
+        return QString();
+    return m_names.value(m_keys.at(row));
+}
+
+int KeyNamesModel::indexOfKey(int key) const
+{
+    fetchKeys();
+    QVector<int>::ConstIterator it = std::lower_bound(m_keys.constBegin(), m_keys.constEnd(), key);
+    if (it == m_keys.constEnd() || *it != key)
+        return -1;
+    return int(it - m_keys.constBegin());
+}
+
+int KeyNamesModel::indexOfName(const QString& name) const
+{
+    fetchKeys();
+    for (int row = 0; row < m_keys.count(); ++row) {
+        if (m_names.value(m_keys.at(row)) == name)
+            return row;
+    }
+    return -1;
+}
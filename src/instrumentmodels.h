@@ -0,0 +1,84 @@
+/***************************************************************************
+ *   KMetronome - ALSA Sequencer based MIDI metronome                      *
+ *   Copyright (C) 2005-2021 Pedro Lopez-Cabanillas <plcl@users.sf.net>    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
+ ***************************************************************************/
+
+#ifndef INSTRUMENTMODELS_H
+#define INSTRUMENTMODELS_H
+
+#include <QtCore/QAbstractListModel>
+#include <QtCore/QMap>
+#include <QtCore/QStringList>
+#include <QtCore/QVector>
+
+class InstrumentList;
+
+/**
+ * List model over the names of an InstrumentList. Resetting it is
+ * constant time: the names are only collected when a view asks for them.
+ */
+class InstrumentNamesModel : public QAbstractListModel
+{
+    Q_OBJECT
+
+public:
+    InstrumentNamesModel(QObject *parent = nullptr);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+
+    void setInstruments(const InstrumentList* instruments);
+    QString nameAt(int row) const;
+    int indexOf(const QString& name) const;
+
+private:
+    void fetchNames() const;
+
+    const InstrumentList* m_instruments;
+    mutable QStringList m_names;
+    mutable bool m_fetched;
+};
+
+/**
+ * List model over a map of numbered names: banks, programs or notes. The
+ * display role is the name and Qt::UserRole the number. The map is
+ * implicitly shared, so setting it doesn't copy anything.
+ */
+class KeyNamesModel : public QAbstractListModel
+{
+    Q_OBJECT
+
+public:
+    KeyNamesModel(QObject *parent = nullptr);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+
+    void setNames(const QMap<int,QString>& names);
+    int keyAt(int row) const;
+    QString nameAt(int row) const;
+    int indexOfKey(int key) const;
+    int indexOfName(const QString& name) const;
+
+private:
+    void fetchKeys() const;
+
+    QMap<int,QString> m_names;
+    mutable QVector<int> m_keys;
+    mutable bool m_fetched;
+};
+
+#endif /* INSTRUMENTMODELS_H */
@@ -0,0 +1,397 @@
+/*
+  KMetronome - ALSA Sequencer based MIDI metronome
+  Copyright (C) 2005-2021 Pedro Lopez-Cabanillas <plcl@users.sf.net>
+
+  For this file, the following copyright notice is also applicable:
+  Copyright (C) 2005-2021, rncbc aka Rui Nuno Capela. All rights reserved.
+  See http://qtractor.sourceforge.net
+
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License
+  along with this program. If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*  Checks that InstrumentList::load() reads the bundled instrument
+    definitions, and the small files under testdata covering wildcards,
+    drum programs, comments, CRLF line endings and empty values, exactly
+    like the regular expression parser it replaced, kept below as it was,
+    and compares the load time of both. */
+
+#include <QDir>
+#include <QFile>
+#include <QRegExp>
+#include <QTextStream>
+#include <QtTest>
+
+#include "instrument.h"
+
+//----------------------------------------------------------------------
+// The regular expression parser of InstrumentList::load(), unchanged.
+//
+
+static bool legacyLoad ( InstrumentList& list, const QString& sFilename )
+{
+	// The names lists are only exposed as const, but list isn't.
+	InstrumentDataList& m_patches = const_cast<InstrumentDataList&>(list.patches());
+	InstrumentDataList& m_notes = const_cast<InstrumentDataList&>(list.notes());
+	InstrumentDataList& m_controllers = const_cast<InstrumentDataList&>(list.controllers());
+	InstrumentDataList& m_rpns = const_cast<InstrumentDataList&>(list.rpns());
+	InstrumentDataList& m_nrpns = const_cast<InstrumentDataList&>(list.nrpns());
+
+	// Open and read from real file.
+	QFile file(sFilename);
+	if (!file.open(QIODevice::ReadOnly))
+		return false;
+
+	enum FileSection {
+		None         = 0,
+		PatchNames   = 1,
+		NoteNames    = 2,
+		ControlNames = 3,
+		RpnNames     = 4,
+		NrpnNames    = 5,
+		InstrDefs    = 6
+	} sect = None;
+
+	Instrument     *pInstrument = nullptr;
+	InstrumentData *pData = nullptr;
+
+	QRegExp rxTitle   ("^\\[([^\\]]+)\\]$");
+	QRegExp rxData    ("^([0-9]+)=(.*)$");
+	QRegExp rxBasedOn ("^BasedOn=(.+)$");
+	QRegExp rxBankSel ("^BankSelMethod=(0|1|2|3)$");
+	QRegExp rxUseNotes("^UsesNotesAsControllers=(0|1)$");
+	QRegExp rxControl ("^Control=(.+)$");
+	QRegExp rxRpn     ("^RPN=(.+)$");
+	QRegExp rxNrpn    ("^NRPN=(.+)$");
+	QRegExp rxPatch   ("^Patch\\[([0-9]+|\\*)\\]=(.+)$");
+	QRegExp rxKey     ("^Key\\[([0-9]+|\\*),([0-9]+|\\*)\\]=(.+)$");
+	QRegExp rxDrum    ("^Drum\\[([0-9]+|\\*),([0-9]+|\\*)\\]=(0|1)$");
+
+	const QString s0_127("0..127");
+	const QString s1_128("1..128");
+	const QString s0_16383("0..16383");
+	const QString sAsterisk('*');
+
+	// Read the file.
+	unsigned int iLine = 0;
+	QTextStream ts(&file);
+
+	while (!ts.atEnd()) {
+
+		// Read the line.
+		iLine++;
+		QString sLine = ts.readLine().simplified();
+		// If not empty, nor a comment, call the server...
+		if (sLine.isEmpty() || sLine[0] == ';')
+			continue;
+
+		// Check for section intro line...
+		if (sLine[0] == '.') {
+			if (sLine == ".Patch Names") {
+				sect = PatchNames;
+			//	m_patches.clear();
+				m_patches[s0_127].setName(s0_127);
+				m_patches[s1_128].setName(s1_128);
+			}
+			else if (sLine == ".Note Names") {
+				sect = NoteNames;
+			//	m_notes.clear();
+				m_notes[s0_127].setName(s0_127);
+			}
+			else if (sLine == ".Controller Names") {
+				sect = ControlNames;
+			//	m_controllers.clear();
+				m_controllers[s0_127].setName(s0_127);
+			}
+			else if (sLine == ".RPN Names") {
+				sect = RpnNames;
+			//	m_rpns.clear();
+				m_rpns[s0_16383].setName(s0_16383);
+			}
+			else if (sLine == ".NRPN Names") {
+				sect = NrpnNames;
+			//	m_nrpns.clear();
+				m_nrpns[s0_16383].setName(s0_16383);
+			}
+			else if (sLine == ".Instrument Definitions") {
+				sect = InstrDefs;
+			//  clear();
+			}
+			else {
+				// Unknown section found...
+				qWarning("%s(%d): %s: Unknown section.",
+					sFilename.toUtf8().constData(), iLine, sLine.toUtf8().constData());
+			}
+			// Go on...
+			continue;
+		}
+
+		// Now it depends on the section...
+		switch (sect) {
+			case PatchNames: {
+				if (rxTitle.exactMatch(sLine)) {
+					// New patch name...
+					const QString& sTitle = rxTitle.cap(1);
+					pData = &(m_patches[sTitle]);
+					pData->setName(sTitle);
+				} else if (rxBasedOn.exactMatch(sLine)) {
+					pData->setBasedOn(rxBasedOn.cap(1));
+				} else if (rxData.exactMatch(sLine)) {
+					(*pData)[rxData.cap(1).toInt()] = rxData.cap(2);
+				} else {
+					qWarning("%s(%d): %s: Unknown .Patch Names entry.",
+						sFilename.toUtf8().constData(), iLine, sLine.toUtf8().constData());
+				}
+				break;
+			}
+			case NoteNames: {
+				if (rxTitle.exactMatch(sLine)) {
+					// New note name...
+					const QString& sTitle = rxTitle.cap(1);
+					pData = &(m_notes[sTitle]);
+					pData->setName(sTitle);
+				} else if (rxBasedOn.exactMatch(sLine)) {
+					pData->setBasedOn(rxBasedOn.cap(1));
+				} else if (rxData.exactMatch(sLine)) {
+					(*pData)[rxData.cap(1).toInt()] = rxData.cap(2);
+				} else {
+					qWarning("%s(%d): %s: Unknown .Note Names entry.",
+						sFilename.toUtf8().constData(), iLine, sLine.toUtf8().constData());
+				}
+				break;
+			}
+			case ControlNames: {
+				if (rxTitle.exactMatch(sLine)) {
+					// New controller name...
+					const QString& sTitle = rxTitle.cap(1);
+					pData = &(m_controllers[sTitle]);
+					pData->setName(sTitle);
+				} else if (rxBasedOn.exactMatch(sLine)) {
+					pData->setBasedOn(rxBasedOn.cap(1));
+				} else if (rxData.exactMatch(sLine)) {
+					(*pData)[rxData.cap(1).toInt()] = rxData.cap(2);
+				} else {
+					qWarning("%s(%d): %s: Unknown .Controller Names entry.",
+						sFilename.toUtf8().constData(), iLine, sLine.toUtf8().constData());
+				}
+				break;
+			}
+			case RpnNames: {
+				if (rxTitle.exactMatch(sLine)) {
+					// New RPN name...
+					const QString& sTitle = rxTitle.cap(1);
+					pData = &(m_rpns[sTitle]);
+					pData->setName(sTitle);
+				} else if (rxBasedOn.exactMatch(sLine)) {
+					pData->setBasedOn(rxBasedOn.cap(1));
+				} else if (rxData.exactMatch(sLine)) {
+					(*pData)[rxData.cap(1).toInt()] = rxData.cap(2);
+				} else {
+					qWarning("%s(%d): %s: Unknown .RPN Names entry.",
+						sFilename.toUtf8().constData(), iLine, sLine.toUtf8().constData());
+				}
+				break;
+			}
+			case NrpnNames: {
+				if (rxTitle.exactMatch(sLine)) {
+					// New NRPN name...
+					const QString& sTitle = rxTitle.cap(1);
+					pData = &(m_nrpns[sTitle]);
+					pData->setName(sTitle);
+				} else if (rxBasedOn.exactMatch(sLine)) {
+					pData->setBasedOn(rxBasedOn.cap(1));
+				} else if (rxData.exactMatch(sLine)) {
+					(*pData)[rxData.cap(1).toInt()] = rxData.cap(2);
+				} else {
+					qWarning("%s(%d): %s: Unknown .NRPN Names entry.",
+						sFilename.toUtf8().constData(), iLine, sLine.toUtf8().constData());
+				}
+				break;
+			}
+			case InstrDefs: {
+				if (rxTitle.exactMatch(sLine)) {
+					// New instrument definition...
+					const QString& sTitle = rxTitle.cap(1);
+					pInstrument = &(list[sTitle]);
+					pInstrument->setInstrumentName(sTitle);
+				} else if (rxBankSel.exactMatch(sLine)) {
+					pInstrument->setBankSelMethod(
+						rxBankSel.cap(1).toInt());
+				} else if (rxUseNotes.exactMatch(sLine)) {
+					pInstrument->setUsesNotesAsControllers(
+						(bool) rxBankSel.cap(1).toInt());
+				} else if (rxPatch.exactMatch(sLine)) {
+					int iBank = (rxPatch.cap(1) == sAsterisk
+						? -1 : rxPatch.cap(1).toInt());
+					pInstrument->setPatch(iBank, m_patches[rxPatch.cap(2)]);
+				} else if (rxControl.exactMatch(sLine)) {
+					pInstrument->setControl(m_controllers[rxControl.cap(1)]);
+				} else if (rxRpn.exactMatch(sLine)) {
+					pInstrument->setRpn(m_rpns[rxRpn.cap(1)]);
+				} else if (rxNrpn.exactMatch(sLine)) {
+					pInstrument->setNrpn(m_nrpns[rxNrpn.cap(1)]);
+				} else if (rxKey.exactMatch(sLine)) {
+					int iBank = (rxKey.cap(1) == sAsterisk
+						? -1 : rxKey.cap(1).toInt());
+					int iProg = (rxKey.cap(2) == sAsterisk
+						? -1 : rxKey.cap(2).toInt());
+					pInstrument->setNotes(iBank, iProg,	m_notes[rxKey.cap(3)]);
+				} else if (rxDrum.exactMatch(sLine)) {
+					int iBank = (rxDrum.cap(1) == sAsterisk
+						? -1 : rxDrum.cap(1).toInt());
+					int iProg = (rxDrum.cap(2) == sAsterisk
+						? -1 : rxKey.cap(2).toInt());
+					pInstrument->setDrum(iBank, iProg,
+						(bool) rxDrum.cap(3).toInt());
+				} else {
+					qWarning("%s(%d): %s: Unknown .Instrument Definitions entry.",
+						sFilename.toUtf8().constData(), iLine, sLine.toUtf8().constData());
+				}
+				break;
+			}
+			default:
+				break;
+		}
+	}
+
+	// Ok. We've read it all.
+	file.close();
+
+	// We're in business...
+	list.appendFile(sFilename);
+
+	return true;
+}
+
+
+
+//----------------------------------------------------------------------
+// class InstrumentTest -- the comparison and the benchmark.
+//
+
+class InstrumentTest : public QObject
+{
+	Q_OBJECT
+
+private Q_SLOTS:
+	void compare_data();
+	void compare();
+	void loadTime_data();
+	void loadTime();
+
+private:
+	static void compareData(const InstrumentData& a, const InstrumentData& b);
+	static void compareList(const InstrumentDataList& a, const InstrumentDataList& b);
+};
+
+static QString drumsFile()
+{
+	return QStringLiteral(INSTRUMENTS_DIR "/drums.ins");
+}
+
+void InstrumentTest::compare_data()
+{
+	QTest::addColumn<QString>("fileName");
+	const QStringList dirs = QStringList()
+		<< QStringLiteral(INSTRUMENTS_DIR) << QStringLiteral(TESTDATA_DIR);
+	for (const QString& path : dirs) {
+		QDir dir(path);
+		const QStringList files = dir.entryList(QStringList() << "*.ins", QDir::Files, QDir::Name);
+		QVERIFY(!files.isEmpty());
+		for (const QString& file : files) {
+			const QString row = dir.dirName() + '/' + file;
+			QTest::newRow(row.toUtf8().constData()) << dir.filePath(file);
+		}
+	}
+}
+
+void InstrumentTest::compareData(const InstrumentData& a, const InstrumentData& b)
+{
+	QCOMPARE(a.name(), b.name());
+	QCOMPARE(a.basedOn(), b.basedOn());
+	QCOMPARE(a.map(), b.map());
+}
+
+void InstrumentTest::compareList(const InstrumentDataList& a, const InstrumentDataList& b)
+{
+	QCOMPARE(a.keys(), b.keys());
+	for (InstrumentDataList::ConstIterator it = a.constBegin(); it != a.constEnd(); ++it)
+		compareData(it.value(), b.value(it.key()));
+}
+
+void InstrumentTest::compare()
+{
+	QFETCH(QString, fileName);
+	InstrumentList parsed, expected;
+	QVERIFY(parsed.load(fileName));
+	QVERIFY(legacyLoad(expected, fileName));
+
+	compareList(parsed.patches(), expected.patches());
+	compareList(parsed.notes(), expected.notes());
+	compareList(parsed.controllers(), expected.controllers());
+	compareList(parsed.rpns(), expected.rpns());
+	compareList(parsed.nrpns(), expected.nrpns());
+	QCOMPARE(parsed.files(), expected.files());
+
+	QCOMPARE(parsed.keys(), expected.keys());
+	for (InstrumentList::ConstIterator it = parsed.constBegin(); it != parsed.constEnd(); ++it) {
+		const Instrument& a = it.value();
+		const Instrument b = expected.value(it.key());
+		QCOMPARE(a.instrumentName(), b.instrumentName());
+		QCOMPARE(a.bankSelMethod(), b.bankSelMethod());
+		QCOMPARE(a.usesNotesAsControllers(), b.usesNotesAsControllers());
+		compareData(a.control(), b.control());
+		compareData(a.rpn(), b.rpn());
+		compareData(a.nrpn(), b.nrpn());
+		QCOMPARE(a.patches().keys(), b.patches().keys());
+		for (InstrumentPatches::ConstIterator p = a.patches().constBegin(); p != a.patches().constEnd(); ++p)
+			compareData(p.value(), b.patches().value(p.key()));
+		QCOMPARE(a.keys().keys(), b.keys().keys());
+		for (InstrumentKeys::ConstIterator k = a.keys().constBegin(); k != a.keys().constEnd(); ++k) {
+			const InstrumentNotes notes = b.keys().value(k.key());
+			QCOMPARE(k.value().keys(), notes.keys());
+			for (InstrumentNotes::ConstIterator n = k.value().constBegin(); n != k.value().constEnd(); ++n)
+				compareData(n.value(), notes.value(n.key()));
+		}
+		QCOMPARE(a.drums().keys(), b.drums().keys());
+		for (InstrumentDrums::ConstIterator d = a.drums().constBegin(); d != a.drums().constEnd(); ++d) {
+			const QMap<int, int> flags = b.drums().value(d.key());
+			QCOMPARE(static_cast<const QMap<int, int>&>(d.value()), flags);
+		}
+	}
+}
+
+void InstrumentTest::loadTime_data()
+{
+	QTest::addColumn<bool>("legacy");
+	QTest::newRow("tokenizer") << false;
+	QTest::newRow("regexp") << true;
+}
+
+/* Load time of the bundled drums.ins with each parser */
+void InstrumentTest::loadTime()
+{
+	QFETCH(bool, legacy);
+	const QString fileName = drumsFile();
+	QBENCHMARK {
+		InstrumentList list;
+		if (legacy)
+			legacyLoad(list, fileName);
+		else
+			list.load(fileName);
+	}
+}
+
+QTEST_GUILESS_MAIN(InstrumentTest)
+
+#include "instrumenttest.moc"
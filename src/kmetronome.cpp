@@ -17,8 +17,19 @@
  ***************************************************************************/
 
 #include <cmath>
+#include <QComboBox>
+#include <QDialogButtonBox>
 #include <QEvent>
+#include <QFormLayout>
+#include <QFileInfo>
 #include <QLabel>
+#include <QLineEdit>
+#include <QProgressBar>
+#include <QProgressDialog>
+#include <QPushButton>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QStatusBar>
 #include <QActionGroup>
 #include <QStandardPaths>
 #include <QMessageBox>
@@ -28,6 +39,7 @@
 #include <QCloseEvent>
 #include <QDesktopServices>
 #include <QDBusConnection>
+#include <QElapsedTimer>
 #include <QDebug>
 #include <drumstick/sequencererror.h>
 #include "kmetronome.h"
@@ -37,10 +49,41 @@
 #include "drumgrid.h"
 #include "drumgridmodel.h"
 #include "instrument.h"
+#include "instrumentlibrary.h"
 #include "about.h"
+#include "arrangement.h"
+#include "audioclickengine.h"
+#include "compiledpattern.h"
 #include "kmetronome_adaptor.h"
 #include "iconutils.h"
 #include "helpwindow.h"
+#include "metricsexporter.h"
+#include "offlinerenderer.h"
+#include "patternlibrary.h"
+#include "patternmodels.h"
+#include "patterntransfer.h"
+#include "songtimeline.h"
+#include "startuptrace.h"
+
+namespace {
+
+/* Compacts the pattern library without blocking the user interface */
+class PatternCompactTask : public QRunnable
+{
+public:
+    explicit PatternCompactTask(PatternLibrary* library) : m_library(library) { }
+
+    void run() override
+    {
+        if (!m_library->compact())
+            qWarning("Failure compacting the pattern library");
+    }
+
+private:
+    PatternLibrary* m_library;
+};
+
+}
 
 static QString dataDirectory()
 {
@@ -89,12 +132,24 @@ static QString trQtDirectory()
 KMetronome::KMetronome(QWidget *parent) :
     QMainWindow(parent),
     m_patternMode(false),
-    m_seq(nullptr)
+    m_seq(nullptr),
+    m_metrics(nullptr),
+    m_library(nullptr),
+    m_patterns(nullptr),
+    m_patternModel(nullptr),
+    m_arrangement(nullptr),
+    m_song(nullptr),
+    m_loadProgress(nullptr),
+    m_currentLang(nullptr),
+    m_languageMenuReady(false),
+    m_audioOutput(false),
+    m_audioPeriod(AUDIO_PERIOD)
 {
     new KmetronomeAdaptor(this);
     QDBusConnection dbus = QDBusConnection::sessionBus();
     dbus.registerObject("/", this);
     dbus.registerService("net.sourceforge.kmetronome");
+    StartupTrace::mark("D-Bus registered");
 
     m_trq = new QTranslator(this);
     QCoreApplication::installTranslator(m_trq);
@@ -109,6 +164,7 @@ KMetronome::KMetronome(QWidget *parent) :
         qWarning() << "Failure loading program translations for" << configuredLanguage();
     }
     QLocale::setDefault(locale);
+    StartupTrace::mark("translations loaded");
 
     m_ui.setupUi(this);
     m_ui.m_exitbtn->setFocusPolicy(Qt::NoFocus);
@@ -152,32 +208,45 @@ KMetronome::KMetronome(QWidget *parent) :
     connect( m_ui.m_tempo, &QAbstractSlider::valueChanged, this, &KMetronome::displayTempo );
     connect( m_ui.m_pattern, QOverload<int>::of(&QComboBox::activated), this, &KMetronome::patternChanged );
 
+    StartupTrace::mark("user interface built");
+
     m_model = new DrumGridModel(this);
+    m_patterns = new PatternLibrary(QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation));
+    if (!m_patterns->open()) {
+        qWarning() << "Failure opening the pattern library";
+    } else if (m_patterns->isCreated()) {
+        m_patterns->migrateSettings();
+    }
+    m_patternModel = new PatternListModel(this);
+    m_patternModel->setLibrary(m_patterns);
+    m_patternModel->setLeadingItem(tr("Automatic", "the pattern is created automatically"));
+    m_ui.m_pattern->setModel(m_patternModel);
+    PatternCompleter* completer = new PatternCompleter(m_ui.m_pattern, m_patterns);
+    connect( completer, &PatternCompleter::patternSelected, this, &KMetronome::setSelectedPattern );
+    connect( m_ui.m_pattern->lineEdit(), &QLineEdit::editingFinished, this, [=]{
+        m_ui.m_pattern->setEditText(m_ui.m_pattern->itemText(m_ui.m_pattern->currentIndex()));
+    });
+    m_arrangement = new PatternArrangement(m_patterns, this);
+    m_song = new SongTimeline;
     m_instrumentList = new InstrumentList;
     m_model->setInstrumentList(m_instrumentList);
-    QString data = dataDirectory();
-    if (data.isEmpty()) {
-        m_instrumentList->load(":/data/drums.ins");
-    } else {
-        QFileInfo f(data, "drums.ins");
-        if (f.exists()) {
-            m_instrumentList->load(f.absoluteFilePath());
-        } else {
-            m_instrumentList->load(":/data/drums.ins");
-        }
-    }
     try {
         m_seq = new SequencerAdapter(this);
+        StartupTrace::mark("ALSA client opened");
         m_seq->setModel(m_model);
         connect(m_seq, &SequencerAdapter::signalUpdate, this, &KMetronome::updateDisplay, Qt::QueuedConnection);
         connect(m_seq, &SequencerAdapter::signalPlay, this, &KMetronome::play, Qt::QueuedConnection);
         connect(m_seq, &SequencerAdapter::signalStop, this, &KMetronome::stop, Qt::QueuedConnection);
         connect(m_seq, &SequencerAdapter::signalCont, this, &KMetronome::cont, Qt::QueuedConnection);
         connect(m_seq, &SequencerAdapter::signalNotation, this, &KMetronome::setTimeSignature, Qt::QueuedConnection);
+        connect(m_seq, &SequencerAdapter::signalArrangementStep, m_arrangement, &PatternArrangement::prefetch, Qt::QueuedConnection);
         setupActions();
         readConfiguration();
-        createLanguageMenu();
+        StartupTrace::mark("configuration read");
+        connect(m_ui.menuLanguage, &QMenu::aboutToShow, this, &KMetronome::slotLanguageMenu);
         applyVisualStyle();
+        StartupTrace::mark("visual style applied");
+        startInstrumentsLoad();
     } catch (drumstick::ALSA::SequencerError& ex) {
         QString errorstr = tr("Fatal error from the ALSA sequencer. "
             "This usually happens when the kernel doesn't have ALSA support, "
@@ -188,13 +257,117 @@ KMetronome::KMetronome(QWidget *parent) :
         QMessageBox::critical(nullptr, tr("Error"), errorstr);
         close();
     }
-    m_helpWindow = new HelpWindow(this);
-    m_helpWindow->applySettings();
 }
 
 KMetronome::~KMetronome()
 {
+    delete m_library;
+    delete m_transfer;
+    QThreadPool::globalInstance()->waitForDone();
+    delete m_patterns;
     delete m_instrumentList;
+    delete m_song;
+}
+
+/**
+ * The instrument definitions are parsed by the library in a thread pool,
+ * so the main window can be shown before they are available. Everything
+ * that needs them calls waitForInstruments() first.
+ */
+void KMetronome::startInstrumentsLoad()
+{
+    QString fileName(":/data/drums.ins");
+    QString data = dataDirectory();
+    if (!data.isEmpty()) {
+        QFileInfo f(data, "drums.ins");
+        if (f.exists()) {
+            fileName = f.absoluteFilePath();
+        }
+    }
+    QSettings settings;
+    settings.beginGroup("Settings");
+    QStringList dirs;
+    dirs << QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation) + "/instruments";
+    dirs << settings.value("instrumentsDirectory", QString()).toString();
+    bool watch = settings.value("watchInstruments", true).toBool();
+    bool compact = settings.value("compactInstruments", false).toBool();
+    settings.endGroup();
+
+    m_library = new InstrumentLibrary;
+    m_library->setBaseFile(fileName);
+    m_library->setDirectories(dirs);
+    m_library->setCompact(compact);
+    connect(m_library, &InstrumentLibrary::progress, this, &KMetronome::instrumentsProgress);
+    connect(m_library, &InstrumentLibrary::loaded, this, &KMetronome::instrumentsLoaded);
+    connect(m_library, &InstrumentLibrary::changed, this, &KMetronome::instrumentsChanged);
+    m_library->load();
+    m_library->setWatching(watch);
+}
+
+void KMetronome::waitForInstruments()
+{
+    if (m_library != nullptr && m_library->isLoading()) {
+        m_library->waitForFinished();
+    }
+}
+
+void KMetronome::instrumentsProgress(int done, int total)
+{
+    if (done >= total || total < 2) {
+        return;
+    }
+    if (m_loadProgress == nullptr) {
+        m_loadProgress = new QProgressBar(this);
+        m_loadProgress->setMaximumWidth(200);
+        m_loadProgress->setFormat(tr("Loading instruments: %p%"));
+        statusBar()->addPermanentWidget(m_loadProgress);
+    }
+    m_loadProgress->setRange(0, total);
+    m_loadProgress->setValue(done);
+    statusBar()->show();
+}
+
+void KMetronome::instrumentsLoaded()
+{
+    if (m_loadProgress != nullptr) {
+        statusBar()->removeWidget(m_loadProgress);
+        delete m_loadProgress;
+        m_loadProgress = nullptr;
+    }
+    m_library->mergeInto(*m_instrumentList);
+    m_library->pageIn(m_instrument, *m_instrumentList);
+    StartupTrace::mark("instruments loaded");
+    applyInstrumentSettings();
+    m_seq->metronome_set_bank();
+    m_seq->metronome_set_program();
+}
+
+/**
+ * Some instrument files were added, modified or removed while running:
+ * refresh everything depending on the definitions.
+ */
+void KMetronome::instrumentsChanged()
+{
+    m_library->mergeInto(*m_instrumentList);
+    m_library->pageIn(m_instrument, *m_instrumentList);
+    applyInstrumentSettings();
+    m_seq->metronome_set_bank();
+    m_seq->metronome_set_program();
+    if (m_drumgrid != nullptr) {
+        m_drumgrid->setInstrument(m_instrument);
+    }
+    if (m_preferences != nullptr) {
+        m_preferences->refreshInstruments();
+    }
+}
+
+HelpWindow* KMetronome::helpWindow()
+{
+    if (m_helpWindow == nullptr) {
+        m_helpWindow = new HelpWindow(this);
+        m_helpWindow->applySettings();
+    }
+    return m_helpWindow;
 }
 
 void KMetronome::setupActions()
@@ -203,7 +376,10 @@ void KMetronome::setupActions()
     m_ui.actionAbout->setIcon(QIcon(IconUtils::GetPixmap(":/icons/midi/icon32.png")));
     connect( m_ui.actionPlayStop, &QAction::triggered, this, &KMetronome::toggle );
     connect( m_ui.actionImportPatterns, &QAction::triggered, this, &KMetronome::slotImportPatterns );
+    connect( m_ui.actionImportMidiFolder, &QAction::triggered, this, &KMetronome::slotImportMidiFolder );
     connect( m_ui.actionExportPatterns, &QAction::triggered, this, &KMetronome::slotExportPatterns );
+    connect( m_ui.actionRenderMidi, &QAction::triggered, this, &KMetronome::slotRenderMidi );
+    connect( m_ui.actionRenderWave, &QAction::triggered, this, &KMetronome::slotRenderWave );
     connect( m_ui.actionQuit, &QAction::triggered, this, &KMetronome::close );
     connect( m_ui.actionEditPatterns, &QAction::triggered, this, &KMetronome::editPatterns );
     connect( m_ui.actionShowActionButtons, &QAction::triggered, this, &KMetronome::displayFakeToolbar );
@@ -227,9 +403,10 @@ void KMetronome::about()
 
 void KMetronome::help()
 {
-    m_helpWindow->setIcons(m_internalIcons);
+    HelpWindow* window = helpWindow();
+    window->setIcons(m_internalIcons);
     QString hname = QString("help/%1/index.html").arg(configuredLanguage());
-    m_helpWindow->showPage(hname);
+    window->showPage(hname);
 }
 
 void KMetronome::saveConfiguration()
@@ -244,6 +421,9 @@ void KMetronome::saveConfiguration()
     settings.setValue("qtstyle", m_style);
     settings.setValue("darkMode", m_darkMode);
     settings.setValue("internalIcons", m_internalIcons);
+    settings.setValue("audioOutput", m_audioOutput);
+    settings.setValue("audioDevice", m_audioDevice);
+    settings.setValue("audioPeriod", m_audioPeriod);
     if (m_seq != nullptr) {
         settings.setValue("instrument", m_instrument);
         settings.setValue("bank", m_bank);
@@ -292,6 +472,65 @@ void KMetronome::applyInstrumentSettings()
     }
 }
 
+/**
+ * Creates a new internal audio output with the current settings when
+ * enabled, and hands it to the sequencer, or releases it and goes back
+ * to MIDI notes. An engine already playing with the same settings is
+ * kept.
+ */
+void KMetronome::applyAudioSettings()
+{
+    const QString device = m_audioDevice.isEmpty() ? QSTR_AUDIO_DEVICE : m_audioDevice;
+    if (!m_audioOutput) {
+        if (m_audio)
+            replaceAudioEngine(nullptr);
+        return;
+    }
+    if (m_audio && m_audio->device() == device && m_audio->periodSize() == m_audioPeriod)
+        return;
+    std::shared_ptr<AudioClickEngine> engine = std::make_shared<AudioClickEngine>();
+    connect(engine.get(), &AudioClickEngine::latencyChanged, this, &KMetronome::audioLatencyChanged, Qt::QueuedConnection);
+    connect(engine.get(), &AudioClickEngine::failed, this, &KMetronome::audioFailed, Qt::QueuedConnection);
+    engine->setDevice(device);
+    engine->setPeriodSize(m_audioPeriod);
+    replaceAudioEngine(engine);
+}
+
+/**
+ * Swaps the audio output of the sequencer, or goes back to MIDI notes
+ * when the engine is null. The playback is stopped meanwhile, so that
+ * the engine is never replaced while playing, and started again.
+ */
+void KMetronome::replaceAudioEngine(const std::shared_ptr<AudioClickEngine>& engine)
+{
+    bool playing = m_seq->isPlaying();
+    if (playing)
+        m_seq->metronome_stop();
+    m_seq->setAudioEngine(engine);
+    m_audio = engine;
+    if (playing)
+        m_seq->metronome_start();
+}
+
+void KMetronome::audioLatencyChanged(qint64 usecs)
+{
+    statusBar()->showMessage(tr("Audio output latency: %1 ms").arg(usecs / 1000.0, 0, 'f', 1),
+                             STATUS_MESSAGE_TIMEOUT);
+}
+
+/**
+ * The audio device failed: the clicks go back to MIDI notes until the
+ * preferences are accepted again.
+ */
+void KMetronome::audioFailed(const QString& message)
+{
+    if (!m_audio || sender() != m_audio.get())
+        return;
+    replaceAudioEngine(nullptr);
+    QMessageBox::warning(this, tr("Audio Output"),
+        tr("%1\n\nThe clicks are sent as MIDI notes instead.").arg(message));
+}
+
 void KMetronome::readConfiguration()
 {
     QSettings settings;
@@ -301,7 +540,6 @@ void KMetronome::readConfiguration()
     m_instrument = settings.value("instrument", QString()).toString();
     m_bank = settings.value("bank", QString()).toString();
     m_program = settings.value("program", QString()).toString();
-    applyInstrumentSettings();
     m_seq->setChannel(settings.value("channel", METRONOME_CHANNEL).toInt());
     m_seq->setWeakNote(settings.value("weakNote", METRONOME_WEAK_NOTE).toInt());
     m_seq->setStrongNote(settings.value("strongNote", METRONOME_STRONG_NOTE).toInt());
@@ -316,6 +554,9 @@ void KMetronome::readConfiguration()
     m_style = settings.value("qtstyle", "fusion").toString();
     m_darkMode = settings.value("darkMode", false).toBool();
     m_internalIcons = settings.value("internalIcons", false).toBool();
+    m_audioOutput = settings.value("audioOutput", false).toBool();
+    m_audioDevice = settings.value("audioDevice", QSTR_AUDIO_DEVICE).toString();
+    m_audioPeriod = settings.value("audioPeriod", AUDIO_PERIOD).toInt();
     m_seq->setVolume(volume);
     m_seq->setBalance(balance);
     m_seq->setWeakVelocity(weakVel);
@@ -342,7 +583,9 @@ void KMetronome::readConfiguration()
         m_seq->connect_output();
         m_seq->connect_input();
     }
-    m_seq->sendInitialControls();
+    applyAudioSettings();
+    m_seq->metronome_set_controls();
+    m_seq->metronome_set_tempo();
     bool fakeToolbar = settings.value("fakeToolbar", true).toBool();
     m_ui.actionShowActionButtons->setChecked(fakeToolbar);
     bool realToolbar = settings.value("toolbar", true).toBool();
@@ -350,20 +593,30 @@ void KMetronome::readConfiguration()
     displayFakeToolbar(fakeToolbar);
     m_ui.toolBar->setVisible(realToolbar);
     updatePatterns();
-    if (m_ui.m_pattern->count() == 0) {
-        importPatterns(":/data/samples.pat");
+    if (m_patterns->count() == 0) {
+        PatternTransfer samples(m_patterns);
+        samples.setImport(":/data/samples.pat", PatternTransfer::OverwriteExisting);
+        samples.execute();
+        updatePatterns();
+        StartupTrace::mark("sample patterns imported");
     }
 }
 
 void KMetronome::optionsPreferences()
 {
+    waitForInstruments();
     QPointer<KMetroPreferences> dlg = new KMetroPreferences(this);
+    m_preferences = dlg;
+    dlg->setInstrumentLibrary(m_library);
     dlg->fillOutputConnections(m_seq->outputConnections());
     dlg->fillInputConnections(m_seq->inputConnections());
     dlg->fillInstruments(m_instrumentList);
     dlg->fillStyles();
     dlg->setDarkMode(m_darkMode);
     dlg->setInternalIcons(m_internalIcons);
+    dlg->setAudioOutput(m_audioOutput);
+    dlg->setAudioDevice(m_audioDevice);
+    dlg->setAudioPeriod(m_audioPeriod);
     dlg->setAutoConnect(m_seq->getAutoConnect());
     QString conn = m_seq->getOutputConn();
     if (conn != nullptr && !conn.isEmpty())
@@ -390,6 +643,7 @@ void KMetronome::optionsPreferences()
             m_instrument = dlg->getInstrumentName();
             m_bank = dlg->getBankName();
             m_program = dlg->getProgramName();
+            m_library->pageIn(m_instrument, *m_instrumentList);
             applyInstrumentSettings();
             m_seq->setWeakNote(dlg->getWeakNote());
             m_seq->setStrongNote(dlg->getStrongNote());
@@ -397,6 +651,10 @@ void KMetronome::optionsPreferences()
             m_seq->setChannel(dlg->getChannel());
             m_seq->setSendNoteOff(dlg->getSendNoteOff());
             m_seq->setNoteDuration(dlg->getDuration());
+            m_audioOutput = dlg->getAudioOutput();
+            m_audioDevice = dlg->getAudioDevice();
+            m_audioPeriod = dlg->getAudioPeriod();
+            applyAudioSettings();
             m_seq->connect_output();
             m_seq->connect_input();
             m_seq->sendInitialControls();
@@ -407,11 +665,30 @@ void KMetronome::optionsPreferences()
         applyVisualStyle();
     }
     delete dlg;
+    m_library->trim(*m_instrumentList, m_instrument);
 }
 
 void KMetronome::updateDisplay(int bar, int beat)
 {
+    if (m_metrics == nullptr) {
+        display(bar, beat);
+        return;
+    }
+    QElapsedTimer timer;
+    timer.start();
     display(bar, beat);
+    m_seq->recordFrameTime(timer.nsecsElapsed() / 1000);
+}
+
+void KMetronome::enableMetrics(const QString& fileName, int interval)
+{
+    if (m_seq == nullptr || fileName.isEmpty())
+        return;
+    if (m_metrics == nullptr)
+        m_metrics = new MetricsExporter(m_seq, this);
+    m_metrics->setFileName(fileName);
+    m_metrics->setInterval(interval);
+    m_metrics->start();
 }
 
 void KMetronome::tempoChanged(int newTempo)
@@ -463,6 +740,14 @@ void KMetronome::toggle(bool checked)
  */
 
 void KMetronome::play()
+{
+    m_seq->setArrangement(nullptr);
+    m_seq->setTimeline(nullptr);
+    m_seq->metronome_set_tempo();
+    startPlayback();
+}
+
+void KMetronome::startPlayback()
 {
     enableControls(false);
     m_ui.actionConfiguration->setEnabled(false);
@@ -513,29 +798,115 @@ void KMetronome::setTimeSignature(int numerator, int denominator)
     m_seq->setRhythmDenominator(denominator);
 }
 
+void KMetronome::clearArrangement()
+{
+    m_arrangement->clear();
+}
+
 /**
- * Patterns stuff
+ * Appends some bars of a stored pattern to the arrangement, or of silence
+ * when the pattern name is empty. Returns false if the step is invalid.
  */
+bool KMetronome::addArrangementStep(const QString& pattern, int bars)
+{
+    if (!m_arrangement->append(ArrangementStep(pattern, bars))) {
+        qWarning() << "Invalid arrangement step:" << pattern << bars;
+        return false;
+    }
+    return true;
+}
 
-void KMetronome::updatePatterns()
+void KMetronome::setArrangementLoop(bool loop)
 {
-    const int n(QSTR_PATTERN.size());
-    QStringList lst;
-    QSettings settings;
-    foreach(const QString& name, settings.childGroups()) {
-        if (name.startsWith(QSTR_PATTERN))
-            lst += name.mid(n);
+    m_arrangement->setLoop(loop);
+}
+
+QStringList KMetronome::arrangement()
+{
+    return m_arrangement->description();
+}
+
+/**
+ * Plays the arrangement from its first step, restarting the playback if
+ * needed. Playing stops after the last step unless the arrangement loops.
+ */
+void KMetronome::playArrangement()
+{
+    if (m_arrangement->isEmpty())
+        return;
+    if (m_seq->isPlaying())
+        stop();
+    m_seq->setTimeline(nullptr);
+    m_seq->setArrangement(m_arrangement->start());
+    m_seq->metronome_set_tempo();
+    startPlayback();
+}
+
+/**
+ * Replaces the song timeline with the tempo and meter changes of a text,
+ * as described in SongTimeline.
+ */
+bool KMetronome::setSongTimeline(const QString& text)
+{
+    if (!m_song->parse(text)) {
+        qWarning() << "Invalid song timeline:" << m_song->errorString();
+        return false;
     }
-    if (!lst.isEmpty()) {
-        setPatterns(lst);
+    return true;
+}
+
+/**
+ * Reads the song timeline from a text file, or the tempo map of a
+ * Standard MIDI File.
+ */
+bool KMetronome::loadSongTimeline(const QString& fileName)
+{
+    if (!m_song->load(fileName)) {
+        qWarning() << "Failure reading the song timeline" << fileName << m_song->errorString();
+        return false;
     }
+    return true;
+}
+
+QString KMetronome::songTimeline()
+{
+    return m_song->toText();
+}
+
+/**
+ * Plays the song timeline from its first bar, restarting the playback if
+ * needed. Playing stops at the end bar of the song, if it has one.
+ */
+void KMetronome::playSong()
+{
+    if (m_seq->isPlaying())
+        stop();
+    std::shared_ptr<SongTimeline> timeline = std::make_shared<SongTimeline>(*m_song);
+    timeline->setResolution(m_seq->getResolution());
+    m_seq->setArrangement(nullptr);
+    m_seq->setTimeline(timeline);
+    startPlayback();
+}
+
+/**
+ * Patterns stuff
+ */
+
+void KMetronome::updatePatterns()
+{
+    QString current = getSelectedPattern();
+    m_patternModel->setLeadingItem(tr("Automatic", "the pattern is created automatically"));
+    int idx = current.isEmpty() ? 0 : m_patternModel->indexOf(current);
+    m_ui.m_pattern->setCurrentIndex(qMax(idx, 0));
 }
 
 void KMetronome::readDrumGridPattern()
 {
+    waitForInstruments();
     if (m_drumgrid == nullptr) {
         m_drumgrid = new DrumGrid(this);
         m_drumgrid->setModel(m_model);
+        m_drumgrid->setPatternLibrary(m_patterns);
         m_drumgrid->setSequencer(m_seq);
     }
     m_drumgrid->setInstrument(m_instrument);
@@ -550,6 +921,8 @@ void KMetronome::editPatterns()
     QString tmpPattern;
     readDrumGridPattern();
     res = m_drumgrid->exec();
+    if (m_patterns->needsCompaction())
+        QThreadPool::globalInstance()->start(new PatternCompactTask(m_patterns));
     updatePatterns();
     if (res == QDialog::Accepted && m_drumgrid != nullptr)
         tmpPattern = m_drumgrid->currentPattern();
@@ -566,55 +939,130 @@ void KMetronome::patternChanged(int idx)
     }
     m_seq->setPatternMode(m_patternMode);
     if (m_patternMode) {
-        setBeatsBar(m_model->columnCount());
+        setBeatsBar(m_model->patternBeats());
         setFigure(m_model->patternFigure());
     }
     m_ui.m_beatsBar->setEnabled(!m_patternMode);
     m_ui.m_figure->setEnabled(!m_patternMode);
 }
 
+/**
+ * Imports a pattern file, a MIDI file or a directory of MIDI files on a
+ * worker thread. When the library already has patterns, the user chooses
+ * what to do with the names found in both.
+ */
 void KMetronome::importPatterns(const QString& path)
 {
-    QSettings settings;
-    QSettings input(path, QSettings::IniFormat, this);
-    foreach(const QString& name, input.childGroups()) {
-        input.beginGroup(name);
-        settings.beginGroup(QSTR_PATTERN+name);
-        settings.remove("");
-        foreach(const QString& key, input.childKeys()) {
-            settings.setValue(key, input.value(key));
+    PatternTransfer::ConflictPolicy policy;
+    if (!askImportPolicy(policy))
+        return;
+    QFileInfo info(path);
+    QString suffix = info.suffix().toLower();
+    PatternTransfer* transfer = new PatternTransfer(m_patterns, this);
+    if (info.isDir() || suffix == "mid" || suffix == "midi") {
+        int figure;
+        if (!askImportFigure(figure)) {
+            delete transfer;
+            return;
         }
-        settings.endGroup();
-        input.endGroup();
+        transfer->setMidiImport(path, figure, policy);
+    } else {
+        transfer->setImport(path, policy);
     }
-    settings.sync();
-    updatePatterns();
+    startPatternTransfer(transfer, tr("Importing patterns..."));
 }
 
-void KMetronome::exportPatterns(const QString& path)
+bool KMetronome::askImportPolicy(PatternTransfer::ConflictPolicy& policy)
 {
-    QSettings settings;
-    QSettings output(path, QSettings::IniFormat, this);
-    const int n(QSTR_PATTERN.size());
-    QStringList lst;
-    foreach(const QString& name, settings.childGroups()) {
-        if (name.startsWith(QSTR_PATTERN)) {
-            lst += name.mid(n);
+    policy = PatternTransfer::OverwriteExisting;
+    if (m_patterns->count() > 0) {
+        QMessageBox box(QMessageBox::Question, tr("Import Patterns"),
+                        tr("Some imported patterns may have the same name as existing ones. "
+                           "What do you want to do with them?"),
+                        QMessageBox::Cancel, this);
+        QPushButton* skip = box.addButton(tr("Skip"), QMessageBox::AcceptRole);
+        QPushButton* overwrite = box.addButton(tr("Overwrite"), QMessageBox::AcceptRole);
+        QPushButton* rename = box.addButton(tr("Rename"), QMessageBox::AcceptRole);
+        box.setDefaultButton(rename);
+        box.exec();
+        if (box.clickedButton() == skip) {
+            policy = PatternTransfer::SkipExisting;
+        } else if (box.clickedButton() == overwrite) {
+            policy = PatternTransfer::OverwriteExisting;
+        } else if (box.clickedButton() == rename) {
+            policy = PatternTransfer::RenameImported;
+        } else {
+            return false;
         }
     }
-    if (!lst.isEmpty()) {
-        foreach(const QString& name, lst) {
-            settings.beginGroup(QSTR_PATTERN+name);
-            output.beginGroup(name);
-            output.remove("");
-            foreach(const QString& key, settings.childKeys()) {
-                output.setValue(key, settings.value(key));
-            }
-            output.endGroup();
-            settings.endGroup();
-        }
-        output.sync();
+    return true;
+}
+
+/**
+ * The figure that the notes of imported MIDI files are quantized to.
+ */
+bool KMetronome::askImportFigure(int& figure)
+{
+    QDialog dialog(this);
+    dialog.setWindowTitle(tr("Import MIDI Files"));
+    QComboBox* figures = new QComboBox(&dialog);
+    IconUtils::SetupComboFigures(figures);
+    figures->setCurrentIndex(4); /* sixteenth */
+    QDialogButtonBox* buttons = new QDialogButtonBox(QDialogButtonBox::Ok | QDialogButtonBox::Cancel, &dialog);
+    connect(buttons, &QDialogButtonBox::accepted, &dialog, &QDialog::accept);
+    connect(buttons, &QDialogButtonBox::rejected, &dialog, &QDialog::reject);
+    QFormLayout* layout = new QFormLayout(&dialog);
+    layout->addRow(tr("Quantize to:"), figures);
+    layout->addRow(buttons);
+    if (dialog.exec() != QDialog::Accepted)
+        return false;
+    figure = 1 << figures->currentIndex();
+    return true;
+}
+
+void KMetronome::exportPatterns(const QString& path)
+{
+    PatternTransfer* transfer = new PatternTransfer(m_patterns, this);
+    transfer->setExport(path);
+    startPatternTransfer(transfer, tr("Exporting patterns..."));
+}
+
+void KMetronome::startPatternTransfer(PatternTransfer* transfer, const QString& label)
+{
+    QProgressDialog* dialog = new QProgressDialog(label, tr("Cancel"), 0, 0, this);
+    dialog->setWindowModality(Qt::WindowModal);
+    dialog->setMinimumDuration(TRANSFER_PROGRESS_DELAY);
+    connect( transfer, &PatternTransfer::progress, dialog, [dialog](int done, int total) {
+        dialog->setMaximum(total);
+        dialog->setValue(done);
+    });
+    connect( dialog, &QProgressDialog::canceled, transfer, &PatternTransfer::cancel, Qt::DirectConnection );
+    connect( transfer, &QThread::finished, dialog, &QObject::deleteLater );
+    connect( transfer, &QThread::finished, this, &KMetronome::patternTransferFinished );
+    m_transfer = transfer;
+    transfer->start(QThread::LowPriority);
+}
+
+void KMetronome::patternTransferFinished()
+{
+    PatternTransfer* transfer = qobject_cast<PatternTransfer*>(sender());
+    if (transfer == nullptr)
+        return;
+    if (!transfer->errorString().isEmpty()) {
+        QMessageBox::warning(this, transfer->isImport() ? tr("Import Patterns") : tr("Export Patterns"),
+                             transfer->errorString());
+    } else if (transfer->isCancelled()) {
+        statusBar()->showMessage(tr("Cancelled"), STATUS_MESSAGE_TIMEOUT);
+    } else if (transfer->isImport()) {
+        statusBar()->showMessage(tr("Imported %n pattern(s)", "", transfer->transferred()) +
+                                 (transfer->skipped() > 0 ? ", " + tr("skipped %n", "patterns", transfer->skipped()) : QString()),
+                                 STATUS_MESSAGE_TIMEOUT);
+    } else {
+        statusBar()->showMessage(tr("Exported %n pattern(s)", "", transfer->transferred()), STATUS_MESSAGE_TIMEOUT);
     }
+    if (transfer->isImport())
+        updatePatterns();
+    transfer->deleteLater();
 }
 
 void KMetronome::slotImportPatterns()
@@ -626,7 +1074,16 @@ void KMetronome::slotImportPatterns()
         QStandardPaths::AppLocalDataLocation
 #endif
         , "*.pat", QStandardPaths::LocateDirectory);
-    QString path = QFileDialog::getOpenFileName(this, tr("Import Patterns"),dirName,tr("Pattern Files (*.pat)"));
+    QString path = QFileDialog::getOpenFileName(this, tr("Import Patterns"),dirName,
+                                                tr("Pattern Files (*.pat);;MIDI Files (*.mid *.midi)"));
+    if (!path.isEmpty()) {
+        importPatterns(path);
+    }
+}
+
+void KMetronome::slotImportMidiFolder()
+{
+    QString path = QFileDialog::getExistingDirectory(this, tr("Import MIDI Folder"));
     if (!path.isEmpty()) {
         importPatterns(path);
     }
@@ -663,6 +1120,83 @@ void KMetronome::slotExportPatterns()
     }
 }
 
+/**
+ * Gives the renderer the current settings and what to render: the song
+ * timeline, if the user wants it, or some bars of the current pattern or
+ * automatic rhythm. Returns false if the user cancelled.
+ */
+bool KMetronome::setupRenderer(OfflineRenderer& renderer, const QString& title)
+{
+    ClickGenerator& generator = renderer.generator();
+    generator.setResolution(m_seq->getResolution());
+    generator.setRhythmNumerator(m_seq->getRhythmNumerator());
+    generator.setRhythmDenominator(m_seq->getRhythmDenominator());
+    generator.setWeakNote(m_seq->getWeakNote());
+    generator.setStrongNote(m_seq->getStrongNote());
+    generator.setWeakVelocity(m_seq->getWeakVelocity());
+    generator.setStrongVelocity(m_seq->getStrongVelocity());
+    renderer.setBpm(m_seq->getBpm());
+    renderer.setChannel(m_seq->getChannel());
+    renderer.setVolume(m_seq->getVolume());
+    renderer.setBalance(m_seq->getBalance());
+    renderer.setNoteDuration(m_seq->getNoteDuration());
+    renderer.setSendNoteOff(m_seq->getSendNoteOff());
+    if (m_song->endBar() > 0 &&
+        QMessageBox::question(this, title, tr("Render the whole song timeline, "
+                              "instead of some bars of the current pattern?")) == QMessageBox::Yes) {
+        renderer.setTimeline(std::make_shared<SongTimeline>(*m_song));
+        return true;
+    }
+    if (m_patternMode)
+        renderer.setPattern(std::make_shared<CompiledPattern>(*m_model));
+    bool ok;
+    int bars = QInputDialog::getInt(this, title, tr("Bars:"), RENDER_BARS, 1, RENDER_BARS_MAX, 1, &ok);
+    renderer.setBars(bars);
+    return ok;
+}
+
+void KMetronome::slotRenderMidi()
+{
+    QString fileName = QFileDialog::getSaveFileName(this, tr("Render MIDI File"), QString(),
+                                                    tr("MIDI Files (*.mid)"));
+    if (fileName.isEmpty())
+        return;
+    if (QFileInfo(fileName).suffix().isEmpty())
+        fileName += ".mid";
+    OfflineRenderer renderer;
+    if (!setupRenderer(renderer, tr("Render MIDI File")))
+        return;
+    QElapsedTimer timer;
+    timer.start();
+    if (!renderer.writeMidi(fileName)) {
+        QMessageBox::warning(this, tr("Render MIDI File"), renderer.errorString());
+        return;
+    }
+    statusBar()->showMessage(tr("Rendered %1 in %2 ms").arg(QFileInfo(fileName).fileName())
+                             .arg(timer.elapsed()), STATUS_MESSAGE_TIMEOUT);
+}
+
+void KMetronome::slotRenderWave()
+{
+    QString fileName = QFileDialog::getSaveFileName(this, tr("Render Audio File"), QString(),
+                                                    tr("WAV Files (*.wav)"));
+    if (fileName.isEmpty())
+        return;
+    if (QFileInfo(fileName).suffix().isEmpty())
+        fileName += ".wav";
+    OfflineRenderer renderer;
+    if (!setupRenderer(renderer, tr("Render Audio File")))
+        return;
+    QElapsedTimer timer;
+    timer.start();
+    if (!renderer.writeWave(fileName)) {
+        QMessageBox::warning(this, tr("Render Audio File"), renderer.errorString());
+        return;
+    }
+    statusBar()->showMessage(tr("Rendered %1 (%2 s of audio) in %3 ms").arg(QFileInfo(fileName).fileName())
+                             .arg(renderer.waveSeconds(), 0, 'f', 1).arg(timer.elapsed()), STATUS_MESSAGE_TIMEOUT);
+}
+
 void KMetronome::display(int bar, int beat)
 {
     m_ui.m_measureLCD->setNumber(QString("%1:%2").arg(bar,  2, 10, QChar(' '))
@@ -715,26 +1249,16 @@ void KMetronome::tempoComboChanged(int v)
     m_ui.m_tempo->setValue(m_ui.m_air->itemData(v).toInt());
 }
 
-void KMetronome::setPatterns(const QStringList& patterns)
-{
-    m_ui.m_pattern->clear();
-    m_ui.m_pattern->addItem(tr("Automatic", "the pattern is created automatically"));
-    m_ui.m_pattern->addItems(patterns);
-}
-
 QString KMetronome::getSelectedPattern()
 {
-    return m_ui.m_pattern->currentText();
+    return m_patternModel->nameAt(m_ui.m_pattern->currentIndex());
 }
 
 void KMetronome::setSelectedPattern(const QString& pattern)
 {
-    if (pattern.isEmpty()) {
-        patternChanged(0);
-    } else {
-        m_ui.m_pattern->setCurrentText(pattern);
-        patternChanged(m_ui.m_pattern->currentIndex());
-    }
+    int idx = pattern.isEmpty() ? 0 : qMax(m_patternModel->indexOf(pattern), 0);
+    m_ui.m_pattern->setCurrentIndex(idx);
+    patternChanged(idx);
 }
 
 QString KMetronome::configuredLanguage()
@@ -770,6 +1294,14 @@ void KMetronome::slotSwitchLanguage(QAction *action)
     }
 }
 
+void KMetronome::slotLanguageMenu()
+{
+    if (!m_languageMenuReady) {
+        createLanguageMenu();
+        m_languageMenuReady = true;
+    }
+}
+
 void KMetronome::createLanguageMenu()
 {
     QString currentLang = configuredLanguage();
@@ -821,7 +1353,10 @@ void KMetronome::applyVisualStyle()
 void KMetronome::refreshIcons()
 {
     m_ui.actionImportPatterns->setIcon(IconUtils::GetIcon("document-import", m_internalIcons));
+    m_ui.actionImportMidiFolder->setIcon(IconUtils::GetIcon("document-import", m_internalIcons));
     m_ui.actionExportPatterns->setIcon(IconUtils::GetIcon("document-export", m_internalIcons));
+    m_ui.actionRenderMidi->setIcon(IconUtils::GetIcon("document-export", m_internalIcons));
+    m_ui.actionRenderWave->setIcon(IconUtils::GetIcon("document-export", m_internalIcons));
     m_ui.actionPlayStop->setIcon(IconUtils::GetIcon("media-playback-start", m_internalIcons));
     m_ui.actionEditPatterns->setIcon(IconUtils::GetIcon("document-edit", m_internalIcons));
     m_ui.actionConfiguration->setIcon(IconUtils::GetIcon("configure", m_internalIcons));
@@ -847,7 +1382,8 @@ void KMetronome::retranslateUi()
     }
     m_ui.retranslateUi(this);
     m_seq->retranslateUi();
-    m_helpWindow->retranslateUi();
-    createLanguageMenu();
+    if (m_helpWindow != nullptr)
+        m_helpWindow->retranslateUi();
+    m_languageMenuReady = false;
     updatePatterns();
 }
@@ -19,18 +19,30 @@
 #ifndef KMETRONOME_H
 #define KMETRONOME_H
 
+#include <memory>
 #include <QMainWindow>
 #include <QPointer>
 #include <QTranslator>
 #include "ui_kmetronome.h"
 #include "helpwindow.h"
+#include "patterntransfer.h"
 
 class SequencerAdapter;
+class AudioClickEngine;
 class DrumGrid;
 class DrumGridModel;
+class KMetroPreferences;
 class Instrument;
 class InstrumentList;
+class InstrumentLibrary;
+class MetricsExporter;
+class OfflineRenderer;
+class PatternArrangement;
+class PatternLibrary;
+class PatternListModel;
+class SongTimeline;
 class QCloseEvent;
+class QProgressBar;
 
 class KMetronome : public QMainWindow
 {
@@ -48,12 +60,12 @@ public:
     void setBeatsBar(int newValue) { m_ui.m_beatsBar->setValue(newValue); }
     void setFigure(int newValue);
     void enableControls(bool e);
-    void setPatterns(const QStringList& patterns);
     bool patternMode() { return m_patternMode; }
     QString getSelectedPattern();
     void setSelectedPattern(const QString& pattern);
     QString configuredLanguage();
     void retranslateUi();
+    void enableMetrics(const QString& fileName, int interval);
 
 protected:
     void closeEvent(QCloseEvent *event) override;
@@ -67,6 +79,15 @@ public Q_SLOTS:
     void cont();
     void setTempo(int newTempo);
     void setTimeSignature(int numerator, int denominator);
+    void clearArrangement();
+    bool addArrangementStep(const QString& pattern, int bars);
+    void setArrangementLoop(bool loop);
+    QStringList arrangement();
+    void playArrangement();
+    bool setSongTimeline(const QString& text);
+    bool loadSongTimeline(const QString& fileName);
+    QString songTimeline();
+    void playSong();
 
     void displayTempo(int);
     void displayWeakVelocity(int v) { m_ui.m_dial1->setValue(v); }
@@ -92,18 +113,38 @@ protected Q_SLOTS:
     void updatePatterns();
     void slotExportPatterns();
     void slotImportPatterns();
+    void slotImportMidiFolder();
+    void slotRenderMidi();
+    void slotRenderWave();
+    void patternTransferFinished();
     void slotSwitchLanguage(QAction *action);
+    void slotLanguageMenu();
+    void instrumentsLoaded();
+    void instrumentsProgress(int done, int total);
+    void instrumentsChanged();
+    void audioLatencyChanged(qint64 usecs);
+    void audioFailed(const QString& message);
 
 private:
     void setupAccel();
     void setupActions();
+    void startPlayback();
     void saveConfiguration();
     void readConfiguration();
     void readDrumGridPattern();
     void applyInstrumentSettings();
+    void applyAudioSettings();
+    void replaceAudioEngine(const std::shared_ptr<AudioClickEngine>& engine);
     void exportPatterns(const QString& path);
     void importPatterns(const QString& path);
+    bool askImportPolicy(PatternTransfer::ConflictPolicy& policy);
+    bool askImportFigure(int& figure);
+    void startPatternTransfer(PatternTransfer* transfer, const QString& label);
+    bool setupRenderer(OfflineRenderer& renderer, const QString& title);
     void createLanguageMenu();
+    void startInstrumentsLoad();
+    void waitForInstruments();
+    HelpWindow* helpWindow();
     void applyVisualStyle();
     void refreshIcons();
 
@@ -113,7 +154,17 @@ private:
     SequencerAdapter* m_seq;
     QPointer<DrumGrid> m_drumgrid;
     QPointer<HelpWindow> m_helpWindow;
+    QPointer<KMetroPreferences> m_preferences;
+    MetricsExporter* m_metrics;
+    std::shared_ptr<AudioClickEngine> m_audio;
     InstrumentList* m_instrumentList;
+    InstrumentLibrary* m_library;
+    PatternLibrary* m_patterns;
+    PatternListModel* m_patternModel;
+    PatternArrangement* m_arrangement;
+    SongTimeline* m_song;
+    QPointer<PatternTransfer> m_transfer;
+    QProgressBar* m_loadProgress;
     DrumGridModel* m_model;
     QString m_instrument;
     QString m_bank;
@@ -122,9 +173,13 @@ private:
     QTranslator* m_trp;
     QTranslator* m_trq;
     QAction* m_currentLang;
+    bool m_languageMenuReady;
     QString m_style;
     bool m_darkMode;
     bool m_internalIcons;
+    bool m_audioOutput;
+    QString m_audioDevice;
+    int m_audioPeriod;
 };
 
 #endif // KMETRONOME_H
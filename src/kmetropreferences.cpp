@@ -16,16 +16,56 @@
  *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
  ***************************************************************************/
 
+#include <QCompleter>
+#include <QListView>
+#include <QSignalBlocker>
 #include <QStyle>
 #include <QStyleFactory>
 #include "kmetropreferences.h"
+#include "instrumentlibrary.h"
+#include "instrumentmodels.h"
 #include "iconutils.h"
 
+/**
+ * Sets a list model on a combo box, avoiding a scan of every item for the
+ * size hint, and optionally enables type-ahead filtering of the items.
+ */
+static void setupListCombo(QComboBox* combo, QAbstractItemModel* model, bool typeAhead)
+{
+    combo->setModel(model);
+    combo->setSizeAdjustPolicy(QComboBox::AdjustToMinimumContentsLengthWithIcon);
+    combo->setMinimumContentsLength(16);
+    QListView* view = qobject_cast<QListView*>(combo->view());
+    if (view != nullptr) {
+        view->setUniformItemSizes(true);
+    }
+    if (typeAhead) {
+        combo->setEditable(true);
+        combo->setInsertPolicy(QComboBox::NoInsert);
+        QCompleter* completer = new QCompleter(model, combo);
+        completer->setCaseSensitivity(Qt::CaseInsensitive);
+        completer->setFilterMode(Qt::MatchContains);
+        completer->setCompletionMode(QCompleter::PopupCompletion);
+        combo->setCompleter(completer);
+    }
+}
+
 KMetroPreferences::KMetroPreferences(QWidget *parent)
-    : QDialog(parent)
+    : QDialog(parent),
+    m_insList(nullptr),
+    m_library(nullptr)
 {
     m_ui.setupUi(this);
     setWindowTitle(tr("Preferences"));
+    m_instrumentModel = new InstrumentNamesModel(this);
+    m_bankModel = new KeyNamesModel(this);
+    m_programModel = new KeyNamesModel(this);
+    m_noteModel = new KeyNamesModel(this);
+    setupListCombo(m_ui.m_instrument, m_instrumentModel, true);
+    setupListCombo(m_ui.m_bank, m_bankModel, true);
+    setupListCombo(m_ui.m_program, m_programModel, true);
+    setupListCombo(m_ui.m_weak_note, m_noteModel, false);
+    setupListCombo(m_ui.m_strong_note, m_noteModel, false);
     connect( m_ui.m_instrument, SIGNAL(currentIndexChanged(int)),
              SLOT(slotInstrumentChanged(int)));
     connect( m_ui.m_bank, SIGNAL(currentIndexChanged(int)),
@@ -57,11 +97,31 @@ void KMetroPreferences::setInputConnection(QString newValue)
 void KMetroPreferences::fillInstruments(InstrumentList* instruments)
 {
     m_insList = instruments;
-    InstrumentList::ConstIterator it;
-    for(it = m_insList->constBegin(); it != m_insList->constEnd(); ++it) {
-        //kDebug() << it.key();
-        m_ui.m_instrument->addItem(it.key());
+    {
+        QSignalBlocker blocker(m_ui.m_instrument);
+        m_instrumentModel->setInstruments(instruments);
+        m_ui.m_instrument->setCurrentIndex(m_instrumentModel->rowCount() > 0 ? 0 : -1);
     }
+    slotInstrumentChanged(m_ui.m_instrument->currentIndex());
+}
+
+/**
+ * The instrument list contents changed: fill the combos again, keeping
+ * the current selections when they are still available.
+ */
+void KMetroPreferences::refreshInstruments()
+{
+    QString instrument = getInstrumentName();
+    QString bank = getBankName();
+    QString program = getProgramName();
+    int weakNote = getWeakNote();
+    int strongNote = getStrongNote();
+    fillInstruments(m_insList);
+    setInstrumentName(instrument);
+    setBankName(bank);
+    setProgramName(program);
+    setWeakNote(weakNote);
+    setStrongNote(strongNote);
 }
 
 void KMetroPreferences::fillStyles()
@@ -77,51 +137,49 @@ void KMetroPreferences::fillStyles()
     }
 }
 
-void KMetroPreferences::slotInstrumentChanged(int /*idx*/)
+void KMetroPreferences::slotInstrumentChanged(int idx)
 {
-    QString name = m_ui.m_instrument->currentText();
-    m_ins = m_insList->value(name);
+    QString name = m_instrumentModel->nameAt(idx);
+    if (m_library != nullptr && !name.isEmpty())
+        m_library->pageIn(name, *m_insList);
+    m_ins = m_insList != nullptr ? m_insList->value(name) : Instrument();
+    QMap<int,QString> banks;
     const InstrumentPatches& patches = m_ins.patches();
     InstrumentPatches::ConstIterator j;
-    m_ui.m_bank->clear();
-    m_ui.m_program->clear();
-    m_ui.m_weak_note->clear();
-    m_ui.m_strong_note->clear();
     for( j = patches.constBegin(); j != patches.constEnd(); ++j ) {
-        InstrumentData patch = j.value();
-        m_ui.m_bank->addItem(patch.name(), j.key());
+        banks.insert(j.key(), j.value().name());
+    }
+    {
+        QSignalBlocker blocker(m_ui.m_bank);
+        m_bankModel->setNames(banks);
+        m_ui.m_bank->setCurrentIndex(banks.isEmpty() ? -1 : 0);
     }
+    slotBankChanged(m_ui.m_bank->currentIndex());
 }
 
 void KMetroPreferences::slotBankChanged(int idx)
 {
-    m_ui.m_program->clear();
-    m_ui.m_weak_note->clear();
-    m_ui.m_strong_note->clear();
-    if (idx < 0)
-        return;
-    int bank = m_ui.m_bank->itemData(idx).toInt();
-    const InstrumentData& patch = m_ins.patch(bank);
-    InstrumentData::ConstIterator k;
-    for( k = patch.constBegin(); k != patch.constEnd(); ++k ) {
-        m_ui.m_program->addItem(k.value(), k.key());
+    {
+        QSignalBlocker blocker(m_ui.m_program);
+        if (idx < 0) {
+            m_programModel->setNames(QMap<int,QString>());
+        } else {
+            m_programModel->setNames(m_ins.patch(m_bankModel->keyAt(idx)).map());
+        }
+        m_ui.m_program->setCurrentIndex(m_programModel->rowCount() > 0 ? 0 : -1);
     }
+    slotProgramChanged(m_ui.m_program->currentIndex());
 }
 
 void KMetroPreferences::slotProgramChanged(int idx)
 {
-    if (idx < 0)
+    if (idx < 0) {
+        m_noteModel->setNames(QMap<int,QString>());
         return;
-    int bank = m_ui.m_bank->itemData(m_ui.m_bank->currentIndex()).toInt();
-    int patch = m_ui.m_program->itemData(idx).toInt();
-    m_ui.m_weak_note->clear();
-    m_ui.m_strong_note->clear();
-    const InstrumentData& notes = m_ins.notes(bank, patch);
-    InstrumentData::ConstIterator k;
-    for( k = notes.constBegin(); k != notes.constEnd(); ++k ) {
-        m_ui.m_weak_note->addItem(k.value(), k.key());
-        m_ui.m_strong_note->addItem(k.value(), k.key());
     }
+    int bank = m_bankModel->keyAt(m_ui.m_bank->currentIndex());
+    int patch = m_programModel->keyAt(idx);
+    m_noteModel->setNames(m_ins.notes(bank, patch).map());
 }
 
 int KMetroPreferences::getWeakNote()
@@ -136,31 +194,27 @@ int KMetroPreferences::getStrongNote()
 
 void KMetroPreferences::setWeakNote(int newValue)
 {
-    QString test = QString::number(newValue);
-    int idx = m_ui.m_weak_note->findData(test);
-    m_ui.m_weak_note->setCurrentIndex(idx);
+    m_ui.m_weak_note->setCurrentIndex(m_noteModel->indexOfKey(newValue));
 }
 
 void KMetroPreferences::setStrongNote(int newValue)
 {
-    QString test = QString::number(newValue);
-    int idx = m_ui.m_strong_note->findData(test);
-    m_ui.m_strong_note->setCurrentIndex(idx);
+    m_ui.m_strong_note->setCurrentIndex(m_noteModel->indexOfKey(newValue));
 }
 
 QString KMetroPreferences::getInstrumentName()
 {
-    return m_ui.m_instrument->currentText();
+    return m_instrumentModel->nameAt(m_ui.m_instrument->currentIndex());
 }
 
 QString KMetroPreferences::getProgramName()
 {
-    return m_ui.m_program->currentText();
+    return m_programModel->nameAt(m_ui.m_program->currentIndex());
 }
 
 QString KMetroPreferences::getBankName()
 {
-    return m_ui.m_bank->currentText();
+    return m_bankModel->nameAt(m_ui.m_bank->currentIndex());
 }
 
 QString KMetroPreferences::getStyle()
@@ -170,15 +224,21 @@ QString KMetroPreferences::getStyle()
 
 void KMetroPreferences::setInstrumentName(QString name)
 {
-    m_ui.m_instrument->setCurrentText(name);
+    int idx = m_instrumentModel->indexOf(name);
+    if (idx >= 0)
+        m_ui.m_instrument->setCurrentIndex(idx);
 }
 
 void KMetroPreferences::setProgramName(QString name)
 {
-    m_ui.m_program->setCurrentText(name);
+    int idx = m_programModel->indexOfName(name);
+    if (idx >= 0)
+        m_ui.m_program->setCurrentIndex(idx);
 }
 
 void KMetroPreferences::setBankName(QString name)
 {
-    m_ui.m_bank->setCurrentText(name);
+    int idx = m_bankModel->indexOfName(name);
+    if (idx >= 0)
+        m_ui.m_bank->setCurrentIndex(idx);
 }
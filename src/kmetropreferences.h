@@ -23,6 +23,10 @@
 #include "ui_kmetropreferencesbase.h"
 #include "instrument.h"
 
+class InstrumentLibrary;
+class InstrumentNamesModel;
+class KeyNamesModel;
+
 class KMetroPreferences : public QDialog
 {
     Q_OBJECT
@@ -33,6 +37,8 @@ public:
     void fillInputConnections(QStringList lst) { m_ui.m_in_connection->insertItems(0, lst); }
     void fillOutputConnections(QStringList lst) { m_ui.m_out_connection->insertItems(0, lst); }
     void fillInstruments(InstrumentList* instruments);
+    void refreshInstruments();
+    void setInstrumentLibrary(InstrumentLibrary* library) { m_library = library; }
     void fillStyles();
     bool getAutoConnect() { return m_ui.m_autoconn->isChecked(); }
     QString getOutputConnection() { return m_ui.m_out_connection->currentText(); }
@@ -49,6 +55,9 @@ public:
     int getStrongNote();
     bool getDarkMode() { return m_ui.m_dark_mode->isChecked(); }
     bool getInternalIcons() { return m_ui.m_internal_icons->isChecked(); }
+    bool getAudioOutput() { return m_ui.m_audio_output->isChecked(); }
+    QString getAudioDevice() { return m_ui.m_audio_device->text(); }
+    int getAudioPeriod() { return m_ui.m_audio_period->value(); }
 
     void setAutoConnect(bool newValue) { m_ui.m_autoconn->setChecked(newValue); }
     void setOutputConnection(QString newValue);
@@ -64,6 +73,9 @@ public:
     void setBankName(QString name);
     void setDarkMode(bool mode) { m_ui.m_dark_mode->setChecked(mode); }
     void setInternalIcons(bool icons) { m_ui.m_internal_icons->setChecked(icons); }
+    void setAudioOutput(bool enabled) { m_ui.m_audio_output->setChecked(enabled); }
+    void setAudioDevice(const QString& device) { m_ui.m_audio_device->setText(device); }
+    void setAudioPeriod(int frames) { m_ui.m_audio_period->setValue(frames); }
 
 public slots:
     void slotInstrumentChanged(int idx);
@@ -73,6 +85,11 @@ public slots:
 private:
     Ui::KMetroPreferencesBase m_ui;
     InstrumentList* m_insList;
+    InstrumentLibrary* m_library;
+    InstrumentNamesModel* m_instrumentModel;
+    KeyNamesModel* m_bankModel;
+    KeyNamesModel* m_programModel;
+    KeyNamesModel* m_noteModel;
     Instrument m_ins;
 };
 
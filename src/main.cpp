@@ -16,12 +16,156 @@
  *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
  ***************************************************************************/
 
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <vector>
 #include <QApplication>
 #include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QScopedPointer>
+#include <QStandardPaths>
+#include <QTimer>
 #include "kmetronome.h"
+#include "clicksynth.h"
+#include "compiledpattern.h"
+#include "defs.h"
+#include "mixkernel.h"
+#include "offlinerenderer.h"
+#include "patternlibrary.h"
+#include "songtimeline.h"
+#include "startuptrace.h"
+
+/**
+ * Renders a click track to a MIDI file, or to a WAV file when wave is
+ * true, with the saved settings, without the main window or the
+ * sequencer. Returns the exit code.
+ */
+static int renderClickTrack(const QString& fileName, bool wave, int bars,
+                            const QString& patternName, const QString& songFile)
+{
+    OfflineRenderer renderer;
+    renderer.readSettings();
+    renderer.setBars(qBound(1, bars, RENDER_BARS_MAX));
+    if (!songFile.isEmpty()) {
+        std::shared_ptr<SongTimeline> timeline = std::make_shared<SongTimeline>();
+        if (!timeline->load(songFile)) {
+            fprintf(stderr, "%s: %s\n", qPrintable(songFile), qPrintable(timeline->errorString()));
+            return 1;
+        }
+        renderer.setTimeline(timeline);
+    } else if (!patternName.isEmpty()) {
+        PatternLibrary library(QStandardPaths::writableLocation(QStandardPaths::AppLocalDataLocation));
+        Pattern pattern;
+        if (!library.open(PatternLibrary::ReadOnly) || !library.load(patternName, pattern)) {
+            fprintf(stderr, "Unknown pattern: %s\n", qPrintable(patternName));
+            return 1;
+        }
+        renderer.setPattern(std::make_shared<CompiledPattern>(pattern));
+    }
+    QElapsedTimer timer;
+    timer.start();
+    if (!(wave ? renderer.writeWave(fileName) : renderer.writeMidi(fileName))) {
+        fprintf(stderr, "%s: %s\n", qPrintable(fileName), qPrintable(renderer.errorString()));
+        return 1;
+    }
+    qint64 elapsed = timer.nsecsElapsed();
+    if (wave) {
+        fprintf(stderr, "Rendered %s, %.1f s of audio, in %lld ms (%.0fx real time)\n",
+                qPrintable(fileName), renderer.waveSeconds(), elapsed / 1000000,
+                renderer.waveSeconds() * 1e9 / qMax(elapsed, qint64(1)));
+    } else {
+        fprintf(stderr, "Rendered %s in %lld ms\n", qPrintable(fileName), elapsed / 1000000);
+    }
+    return 0;
+}
+
+/* Frames of each block mixed by the synthesizer benchmark */
+static const int BENCHMARK_BLOCK(256);
+
+/**
+ * Mixes AUDIO_VOICES_MAX voices of a wave with a kernel for half a second,
+ * and returns the number of voices it could mix in real time.
+ */
+static double kernelVoices(MixKernel::Function kernel, const std::vector<float>& wave)
+{
+    std::vector<float> buffer(BENCHMARK_BLOCK);
+    const int blocks = int(wave.size()) / BENCHMARK_BLOCK;
+    qint64 frames = 0;
+    QElapsedTimer timer;
+    timer.start();
+    do {
+        std::fill(buffer.begin(), buffer.end(), 0.0f);
+        for (int b = 0; b < blocks; ++b) {
+            for (int v = 0; v < AUDIO_VOICES_MAX; ++v)
+                kernel(buffer.data(), wave.data() + b * BENCHMARK_BLOCK, 0.5f, BENCHMARK_BLOCK);
+        }
+        frames += qint64(blocks) * BENCHMARK_BLOCK * AUDIO_VOICES_MAX;
+    } while (timer.elapsed() < 500);
+    return frames / (timer.nsecsElapsed() / 1e9) / AUDIO_SAMPLE_RATE;
+}
+
+/* The same with the whole click synthesizer, up to its 16 bit output */
+static double synthVoices()
+{
+    ClickSynth synth;
+    std::vector<qint16> output(BENCHMARK_BLOCK * 2);
+    const qint64 length = qint64(AUDIO_SAMPLE_RATE) * AUDIO_CLICK_LENGTH / 1000;
+    qint64 frames = 0;
+    QElapsedTimer timer;
+    timer.start();
+    do {
+        for (int v = 0; v < AUDIO_VOICES_MAX; ++v)
+            synth.noteOn(35 + v % 47, 100, v % BENCHMARK_BLOCK);
+        while (synth.voices() > 0)
+            synth.render(output.data(), BENCHMARK_BLOCK);
+        frames += length * AUDIO_VOICES_MAX;
+    } while (timer.elapsed() < 500);
+    return frames / (timer.nsecsElapsed() / 1e9) / AUDIO_SAMPLE_RATE;
+}
+
+/**
+ * Reports how many voices the scalar and the vectorized mixing kernels,
+ * and the whole synthesizer, can mix on one core at 48 kHz. Returns the
+ * exit code.
+ */
+static int benchmarkSynth()
+{
+    const int size = 4 * BENCHMARK_BLOCK;
+    std::vector<float> wave(size);
+    quint32 noise = 1;
+    for (int i = 0; i < size; ++i) {
+        noise = noise * 1664525u + 1013904223u;
+        wave[i] = float(noise >> 8) / float(1 << 23) - 1.0f;
+    }
+    printf("Voices per core at %d Hz: scalar %.0f, %s %.0f, click synthesizer %.0f\n",
+           AUDIO_SAMPLE_RATE, kernelVoices(MixKernel::mixScalar, wave),
+           MixKernel::name(), kernelVoices(MixKernel::function(), wave), synthVoices());
+    return 0;
+}
+
+/**
+ * Whether the command line asks for a mode that quits without showing
+ * the main window, and so doesn't need a display server.
+ */
+static bool isBatchMode(int argc, char **argv)
+{
+    static const char* const options[] = { "--render-midi", "--render-wav", "--benchmark-synth" };
+    for (int i = 1; i < argc; ++i) {
+        const QByteArray arg(argv[i]);
+        if (arg == "--")
+            break;
+        for (const char* option : options) {
+            if (arg == option || arg.startsWith(QByteArray(option) + '='))
+                return true;
+        }
+    }
+    return false;
+}
 
 int main (int argc, char **argv)
 {
+    StartupTrace::start();
     const QString QSTR_APPNAME("Drumstick Metronome");
     const QString QSTR_DOMAIN("kmetronome.sourceforge.net");
     const QString QSTR_DESCRIPTION("ALSA Sequencer based MIDI Metronome");
@@ -31,19 +175,78 @@ int main (int argc, char **argv)
     QCoreApplication::setOrganizationDomain(QSTR_DOMAIN);
     QCoreApplication::setApplicationName(QSTR_APPNAME);
     QCoreApplication::setApplicationVersion(QSTR_VERSION);
-    QApplication app(argc, argv);
+    QScopedPointer<QCoreApplication> app(isBatchMode(argc, argv) ?
+        new QCoreApplication(argc, argv) : new QApplication(argc, argv));
+    StartupTrace::mark("application created");
 
     QCommandLineParser parser;
     parser.setApplicationDescription(QSTR_DESCRIPTION);
     auto helpOption = parser.addHelpOption();
     auto versionOption = parser.addVersionOption();
-    parser.process(app);
+    QCommandLineOption metricsFileOption("metrics-file",
+        QCoreApplication::translate("main", "Periodically write Prometheus metrics to <file>."),
+        QCoreApplication::translate("main", "file"));
+    parser.addOption(metricsFileOption);
+    QCommandLineOption metricsIntervalOption("metrics-interval",
+        QCoreApplication::translate("main", "Seconds between metrics updates (default: %1).").arg(METRICS_INTERVAL),
+        QCoreApplication::translate("main", "seconds"), QString::number(METRICS_INTERVAL));
+    parser.addOption(metricsIntervalOption);
+    QCommandLineOption traceStartupOption("trace-startup",
+        QCoreApplication::translate("main", "Print the duration of each startup phase, the time to window and the time to the first metronome click."));
+    parser.addOption(traceStartupOption);
+    QCommandLineOption songOption("song",
+        QCoreApplication::translate("main", "Play the tempo and meter map read from <file>, a song timeline or a MIDI file."),
+        QCoreApplication::translate("main", "file"));
+    parser.addOption(songOption);
+    QCommandLineOption renderMidiOption("render-midi",
+        QCoreApplication::translate("main", "Write a click track to the MIDI <file> and quit, without playing it."),
+        QCoreApplication::translate("main", "file"));
+    parser.addOption(renderMidiOption);
+    QCommandLineOption renderWaveOption("render-wav",
+        QCoreApplication::translate("main", "Write a click track to the WAV audio <file> and quit, without playing it."),
+        QCoreApplication::translate("main", "file"));
+    parser.addOption(renderWaveOption);
+    QCommandLineOption barsOption("bars",
+        QCoreApplication::translate("main", "Number of bars to render, when there is no song (default: %1).").arg(RENDER_BARS),
+        QCoreApplication::translate("main", "bars"), QString::number(RENDER_BARS));
+    parser.addOption(barsOption);
+    QCommandLineOption patternOption("pattern",
+        QCoreApplication::translate("main", "Render the stored pattern <name> instead of the automatic rhythm."),
+        QCoreApplication::translate("main", "name"));
+    parser.addOption(patternOption);
+    QCommandLineOption benchmarkSynthOption("benchmark-synth",
+        QCoreApplication::translate("main", "Report how many click synthesizer voices can be mixed on one core."));
+    parser.addOption(benchmarkSynthOption);
+    parser.process(*app);
+    StartupTrace::setEnabled(parser.isSet(traceStartupOption));
+    StartupTrace::mark("command line parsed");
 
     if (parser.isSet(versionOption) || parser.isSet(helpOption)) {
         return 0;
     }
+    if (parser.isSet(benchmarkSynthOption)) {
+        return benchmarkSynth();
+    }
+    if (parser.isSet(renderMidiOption)) {
+        return renderClickTrack(parser.value(renderMidiOption), false, parser.value(barsOption).toInt(),
+                                parser.value(patternOption), parser.value(songOption));
+    }
+    if (parser.isSet(renderWaveOption)) {
+        return renderClickTrack(parser.value(renderWaveOption), true, parser.value(barsOption).toInt(),
+                                parser.value(patternOption), parser.value(songOption));
+    }
 
     KMetronome mainWin;
+    StartupTrace::mark("main window constructed");
+    if (parser.isSet(metricsFileOption)) {
+        mainWin.enableMetrics(parser.value(metricsFileOption),
+                              parser.value(metricsIntervalOption).toInt());
+    }
     mainWin.show();
-    return app.exec();
+    StartupTrace::mark("main window shown");
+    if (parser.isSet(songOption) && mainWin.loadSongTimeline(parser.value(songOption))) {
+        QTimer::singleShot(0, &mainWin, &KMetronome::playSong);
+    }
+    StartupTrace::watchWindow(&mainWin);
+    return app->exec();
 }
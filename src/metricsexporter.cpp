@@ -0,0 +1,136 @@
+/***************************************************************************
+ *   KMetronome - ALSA Sequencer based MIDI metronome                      *
+ *   Copyright (C) 2005-2021 Pedro Lopez-Cabanillas <plcl@users.sf.net>    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
+ ***************************************************************************/
+
+#include <QSaveFile>
+#include <QTextStream>
+#include <QDebug>
+#include "metricsexporter.h"
+#include "audioclickengine.h"
+#include "sequenceradapter.h"
+#include "defs.h"
+
+MetricsExporter::MetricsExporter(SequencerAdapter* seq, QObject *parent)
+    : QObject(parent),
+    m_seq(seq)
+{
+    m_timer.setInterval(METRICS_INTERVAL * 1000);
+    connect(&m_timer, &QTimer::timeout, this, &MetricsExporter::writeMetrics);
+}
+
+MetricsExporter::~MetricsExporter()
+{
+    stop();
+}
+
+void MetricsExporter::setInterval(int seconds)
+{
+    m_timer.setInterval(qMax(1, seconds) * 1000);
+}
+
+void MetricsExporter::start()
+{
+    if (m_seq == nullptr || m_fileName.isEmpty())
+        return;
+    m_seq->setMetricsEnabled(true);
+    writeMetrics();
+    m_timer.start();
+}
+
+void MetricsExporter::stop()
+{
+    m_timer.stop();
+    if (m_seq != nullptr)
+        m_seq->setMetricsEnabled(false);
+}
+
+static void writeMetric(QTextStream& ts, const char* name, const char* type,
+                        const char* help, quint64 value)
+{
+    ts << "# HELP kmetronome_" << name << ' ' << help << '\n';
+    ts << "# TYPE kmetronome_" << name << ' ' << type << '\n';
+    ts << "kmetronome_" << name << ' ' << value << '\n';
+}
+
+QString MetricsExporter::metricsText() const
+{
+    QString text;
+    if (m_seq == nullptr)
+        return text;
+    const SequencerMetrics& m = m_seq->metrics();
+    QTextStream ts(&text);
+    writeMetric(ts, "bars_played_total", "counter",
+                "Bars played since the program started.",
+                SequencerMetrics::get(m.barsPlayed));
+    writeMetric(ts, "beats_played_total", "counter",
+                "Beats (pattern columns) played since the program started.",
+                SequencerMetrics::get(m.beatsPlayed));
+    writeMetric(ts, "events_scheduled_total", "counter",
+                "Events scheduled on the ALSA sequencer queue.",
+                SequencerMetrics::get(m.eventsScheduled));
+    writeMetric(ts, "late_echoes_total", "counter",
+                "Echo events delivered later than expected by more than 2 ms.",
+                SequencerMetrics::get(m.lateEchoes));
+    writeMetric(ts, "missed_prefetches_total", "counter",
+                "Arrangement bars played as silence because their pattern was not ready.",
+                SequencerMetrics::get(m.missedPrefetches));
+    writeMetric(ts, "jitter_microseconds", "gauge",
+                "Timing deviation of the last echo event.",
+                SequencerMetrics::get(m.lastJitter));
+    writeMetric(ts, "max_jitter_microseconds", "gauge",
+                "Largest timing deviation of an echo event.",
+                SequencerMetrics::get(m.maxJitter));
+    writeMetric(ts, "output_pool_high_water", "gauge",
+                "Largest number of output pool cells in use.",
+                SequencerMetrics::get(m.poolHighWater));
+    writeMetric(ts, "gui_frame_time_microseconds", "gauge",
+                "Time spent updating the bar:beat display the last time.",
+                SequencerMetrics::get(m.lastFrameTime));
+    writeMetric(ts, "max_gui_frame_time_microseconds", "gauge",
+                "Longest time spent updating the bar:beat display.",
+                SequencerMetrics::get(m.maxFrameTime));
+    writeMetric(ts, "playing", "gauge",
+                "Whether the metronome is currently playing.",
+                m_seq->isPlaying() ? 1 : 0);
+    std::shared_ptr<AudioClickEngine> audio = m_seq->audioEngine();
+    if (audio) {
+        writeMetric(ts, "audio_latency_microseconds", "gauge",
+                    "Frames queued on the audio device, as time, after the last period written.",
+                    quint64(audio->latency()));
+        writeMetric(ts, "audio_xruns_total", "counter",
+                    "Audio buffer underruns.",
+                    audio->xruns());
+        writeMetric(ts, "audio_late_notes_total", "counter",
+                    "Clicks received by the audio engine after their frame was rendered.",
+                    audio->lateNotes());
+    }
+    ts.flush();
+    return text;
+}
+
+void MetricsExporter::writeMetrics()
+{
+    QSaveFile file(m_fileName);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        qWarning() << "Failure writing metrics to" << m_fileName;
+        return;
+    }
+    file.write(metricsText().toUtf8());
+    if (!file.commit()) {
+        qWarning() << "Failure writing metrics to" << m_fileName;
+    }
+}
@@ -0,0 +1,58 @@
+/***************************************************************************
+ *   KMetronome - ALSA Sequencer based MIDI metronome                      *
+ *   Copyright (C) 2005-2021 Pedro Lopez-Cabanillas <plcl@users.sf.net>    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
+ ***************************************************************************/
+
+#ifndef METRICSEXPORTER_H
+#define METRICSEXPORTER_H
+
+#include <QObject>
+#include <QTimer>
+#include <QPointer>
+
+class SequencerAdapter;
+
+/**
+ * Periodically rewrites a Prometheus text format file with the counters
+ * kept by SequencerAdapter. The file is replaced atomically, so it can be
+ * read at any time by the node_exporter textfile collector or any scraper.
+ */
+class MetricsExporter : public QObject
+{
+    Q_OBJECT
+
+public:
+    MetricsExporter(SequencerAdapter* seq, QObject *parent = nullptr);
+    virtual ~MetricsExporter();
+
+    void setFileName(const QString& fileName) { m_fileName = fileName; }
+    QString fileName() const { return m_fileName; }
+    void setInterval(int seconds);
+    int interval() const { return m_timer.interval() / 1000; }
+    void start();
+    void stop();
+    QString metricsText() const;
+
+public slots:
+    void writeMetrics();
+
+private:
+    QPointer<SequencerAdapter> m_seq;
+    QString m_fileName;
+    QTimer m_timer;
+};
+
+#endif // METRICSEXPORTER_H
@@ -0,0 +1,129 @@
+/***************************************************************************
+ *   KMetronome - ALSA Sequencer based MIDI metronome                      *
+ *   Copyright (C) 2005-2021 Pedro Lopez-Cabanillas <plcl@users.sf.net>    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
+ ***************************************************************************/
+
+
+#include "mixkernel.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || (defined(__i386__) && defined(__SSE__))
+#define MIX_SSE
+#include <immintrin.h>
+#if defined(__GNUC__)
+#define MIX_AVX2
+#endif
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define MIX_NEON
+#include <arm_neon.h>
+#endif
+
+namespace MixKernel
+{
+
+void mixScalar(float* out, const float* in, float gain, int frames)
+{
+    for (int i = 0; i < frames; ++i)
+        out[i] += gain * in[i];
+}
+
+#if defined(MIX_SSE)
+static void mixSse(float* out, const float* in, float gain, int frames)
+{
+    const __m128 g = _mm_set1_ps(gain);
+    int i = 0;
+    for (; i + 4 <= frames; i += 4) {
+        __m128 s = _mm_mul_ps(g, _mm_loadu_ps(in + i));
+        _mm_storeu_ps(out + i, _mm_add_ps(_mm_loadu_ps(out + i), s));
+    }
+    mixScalar(out + i, in + i, gain, frames - i);
+}
+#endif
+
+#if defined(MIX_AVX2)
+/* Two vectors per iteration, to keep both adders busy */
+__attribute__((target("avx2")))
+static void mixAvx2(float* out, const float* in, float gain, int frames)
+{
+    const __m256 g = _mm256_set1_ps(gain);
+    int i = 0;
+    for (; i + 16 <= frames; i += 16) {
+        __m256 s0 = _mm256_mul_ps(g, _mm256_loadu_ps(in + i));
+        __m256 s1 = _mm256_mul_ps(g, _mm256_loadu_ps(in + i + 8));
+        _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_loadu_ps(out + i), s0));
+        _mm256_storeu_ps(out + i + 8, _mm256_add_ps(_mm256_loadu_ps(out + i + 8), s1));
+    }
+    for (; i + 8 <= frames; i += 8) {
+        __m256 s = _mm256_mul_ps(g, _mm256_loadu_ps(in + i));
+        _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_loadu_ps(out + i), s));
+    }
+    mixScalar(out + i, in + i, gain, frames - i);
+}
+#endif
+
+#if defined(MIX_NEON)
+static void mixNeon(float* out, const float* in, float gain, int frames)
+{
+    const float32x4_t g = vdupq_n_f32(gain);
+    int i = 0;
+    for (; i + 4 <= frames; i += 4) {
+        float32x4_t s = vmulq_f32(g, vld1q_f32(in + i));
+        vst1q_f32(out + i, vaddq_f32(vld1q_f32(out + i), s));
+    }
+    mixScalar(out + i, in + i, gain, frames - i);
+}
+#endif
+
+static Function select(const char** selected)
+{
+#if defined(MIX_AVX2)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        *selected = "AVX2";
+        return mixAvx2;
+    }
+#endif
+#if defined(MIX_SSE)
+    *selected = "SSE";
+    return mixSse;
+#elif defined(MIX_NEON)
+    *selected = "NEON";
+    return mixNeon;
+#else
+    *selected = "scalar";
+    return mixScalar;
+#endif
+}
+
+static const char* s_name = "scalar";
+static const Function s_function = select(&s_name);
+
+void mix(float* out, const float* in, float gain, int frames)
+{
+    s_function(out, in, gain, frames);
+}
+
+/* The version chosen for this processor */
+Function function()
+{
+    return s_function;
+}
+
+const char* name()
+{
+    return s_name;
+}
+
+}
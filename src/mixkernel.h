@@ -0,0 +1,40 @@
+/***************************************************************************
+ *   KMetronome - ALSA Sequencer based MIDI metronome                      *
+ *   Copyright (C) 2005-2021 Pedro Lopez-Cabanillas <plcl@users.sf.net>    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
+ ***************************************************************************/
+
+
+#ifndef MIXKERNEL_H
+#define MIXKERNEL_H
+
+/**
+ * The inner loop of the click synthesizer: adding a voice, scaled by its
+ * gain, to the mix buffer. There are SSE and AVX2 versions on x86, chosen
+ * at run time by the features of the processor, a NEON version on ARM,
+ * and the scalar reference for everything else. All of them multiply and
+ * add in the same order, so they give the same result as the reference.
+ */
+namespace MixKernel
+{
+    typedef void (*Function)(float* out, const float* in, float gain, int frames);
+
+    void mix(float* out, const float* in, float gain, int frames);
+    void mixScalar(float* out, const float* in, float gain, int frames);
+    Function function();
+    const char* name();
+}
+
+#endif // MIXKERNEL_H
@@ -0,0 +1,72 @@
+/***************************************************************************
+ *   KMetronome - ALSA Sequencer based MIDI metronome                      *
+ *   Copyright (C) 2005-2021 Pedro Lopez-Cabanillas <plcl@users.sf.net>    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
+ ***************************************************************************/
+
+#include <vector>
+#include <QtTest>
+#include "mixkernel.h"
+
+/* Mix buffer size, and the largest alignment offset and tail tried */
+const int MIX_TEST_SIZE(1024);
+const int MIX_TEST_OFFSETS(8);
+const int MIX_TEST_TAILS(40);
+
+/**
+ * Checks the mixing kernel chosen for this processor against the scalar
+ * reference, with every alignment and tail length.
+ */
+class MixKernelTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void initTestCase();
+    void matchesScalar();
+};
+
+void MixKernelTest::initTestCase()
+{
+    qDebug("Mixing kernel: %s", MixKernel::name());
+}
+
+void MixKernelTest::matchesScalar()
+{
+    std::vector<float> wave(MIX_TEST_SIZE);
+    quint32 noise = 1;
+    for (int i = 0; i < MIX_TEST_SIZE; ++i) {
+        noise = noise * 1664525u + 1013904223u;
+        wave[i] = float(noise >> 8) / float(1 << 23) - 1.0f;
+    }
+    std::vector<float> expected(MIX_TEST_SIZE, 0.25f);
+    std::vector<float> actual(expected);
+    for (int offset = 0; offset < MIX_TEST_OFFSETS; ++offset) {
+        for (int frames = 0; frames < MIX_TEST_TAILS; ++frames) {
+            float gain = 0.1f + offset * 0.1f;
+            int count = MIX_TEST_SIZE - offset - frames;
+            MixKernel::mixScalar(expected.data() + offset, wave.data() + frames, gain, count);
+            MixKernel::mix(actual.data() + offset, wave.data() + frames, gain, count);
+            for (int i = 0; i < MIX_TEST_SIZE; ++i) {
+                QVERIFY2(actual[i] == expected[i],
+                         qPrintable(QString("frame %1, offset %2, tail %3").arg(i).arg(offset).arg(frames)));
+            }
+        }
+    }
+}
+
+QTEST_GUILESS_MAIN(MixKernelTest)
+
+#include "mixkerneltest.moc"
@@ -0,0 +1,160 @@
+/***************************************************************************
+ *   KMetronome - ALSA Sequencer based MIDI metronome                      *
+ *   Copyright (C) 2005-2021 Pedro Lopez-Cabanillas <plcl@users.sf.net>    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
+ ***************************************************************************/
+
+
+#include <QSaveFile>
+#include <QSettings>
+#include "compiledpattern.h"
+#include "offlinerenderer.h"
+#include "smfclickwriter.h"
+#include "songtimeline.h"
+#include "wavclickwriter.h"
+
+OfflineRenderer::OfflineRenderer() :
+    m_bpm(TEMPO_DEFAULT),
+    m_waveSeconds(0),
+    m_channel(METRONOME_CHANNEL),
+    m_volume(METRONOME_VOLUME),
+    m_balance(METRONOME_PAN),
+    m_noteDuration(NOTE_DURATION),
+    m_bars(RENDER_BARS),
+    m_sendNoteOff(true)
+{ }
+
+/**
+ * Takes the settings saved by the main window.
+ */
+void OfflineRenderer::readSettings()
+{
+    QSettings settings;
+    settings.beginGroup("Settings");
+    m_channel = settings.value("channel", METRONOME_CHANNEL).toInt();
+    m_generator.setWeakNote(settings.value("weakNote", METRONOME_WEAK_NOTE).toInt());
+    m_generator.setStrongNote(settings.value("strongNote", METRONOME_STRONG_NOTE).toInt());
+    m_generator.setResolution(settings.value("resolution", METRONOME_RESOLUTION).toInt());
+    m_generator.setWeakVelocity(settings.value("weakVelocity", METRONOME_VELOCITY).toInt());
+    m_generator.setStrongVelocity(settings.value("strongVelocity", METRONOME_VELOCITY).toInt());
+    m_generator.setRhythmNumerator(settings.value("rhythmNumerator", RHYTHM_TS_NUM).toInt());
+    m_generator.setRhythmDenominator(settings.value("rhythmDenominator", RHYTHM_TS_DEN).toInt());
+    m_volume = settings.value("volume", METRONOME_VOLUME).toInt();
+    m_balance = settings.value("balance", METRONOME_PAN).toInt();
+    m_bpm = settings.value("tempo", TEMPO_DEFAULT).toInt();
+    m_noteDuration = settings.value("duration", NOTE_DURATION).toInt();
+    m_sendNoteOff = settings.value("sendNoteOff", true).toBool();
+    settings.endGroup();
+}
+
+/**
+ * Sends all the bars to the sink, starting with the tempo and the time
+ * signature. Returns the tick where the last bar ends.
+ */
+int OfflineRenderer::render(ClickSink& sink) const
+{
+    int tick = 0;
+    if (m_timeline) {
+        SongTimeline timeline(*m_timeline);
+        timeline.setResolution(m_generator.resolution());
+        int end = timeline.endBar() > 0 ? timeline.endBar() : m_bars + 1;
+        sink.clickTempo(0, timeline.tempoAt(0));
+        for (int bar = 1; bar < end; ++bar)
+            tick = m_generator.songBar(sink, timeline, bar);
+    } else if (m_pattern) {
+        sink.clickTempo(0, m_bpm);
+        sink.clickMeter(0, m_pattern->beats(), m_pattern->figure());
+        for (int bar = 0; bar < m_bars; ++bar)
+            tick = m_generator.patternBar(sink, *m_pattern, bar % m_pattern->bars(), tick);
+    } else {
+        sink.clickTempo(0, m_bpm);
+        sink.clickMeter(0, m_generator.rhythmNumerator(), m_generator.rhythmDenominator());
+        for (int bar = 0; bar < m_bars; ++bar)
+            tick = m_generator.simpleBar(sink, tick);
+    }
+    return tick;
+}
+
+/**
+ * Writes the click track to a Standard MIDI File. The file is replaced
+ * only when it has been completely written.
+ */
+bool OfflineRenderer::writeMidi(const QString& fileName)
+{
+    m_error.clear();
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        m_error = file.errorString();
+        return false;
+    }
+    SmfClickWriter writer(&file);
+    writer.setChannel(m_channel);
+    writer.setNoteDuration(m_noteDuration, m_sendNoteOff);
+    if (!writer.begin(m_generator.resolution())) {
+        m_error = writer.errorString();
+        file.cancelWriting();
+        return false;
+    }
+    writer.controlChange(0, VOLUME_CC, m_volume);
+    writer.controlChange(0, PAN_CC, m_balance);
+    int end = render(writer);
+    if (!writer.finish(end)) {
+        m_error = writer.errorString();
+        file.cancelWriting();
+        return false;
+    }
+    if (!file.commit()) {
+        m_error = file.errorString();
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Writes the click track to a WAV file, rendered by the click synthesizer
+ * of the internal audio output. The file is replaced only when it has
+ * been completely written.
+ */
+bool OfflineRenderer::writeWave(const QString& fileName)
+{
+    m_error.clear();
+    m_waveSeconds = 0;
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)) {
+        m_error = file.errorString();
+        return false;
+    }
+    WavClickWriter writer(&file);
+    writer.setResolution(m_generator.resolution());
+    writer.setVolume(m_volume);
+    writer.setBalance(m_balance);
+    if (!writer.begin()) {
+        m_error = writer.errorString();
+        file.cancelWriting();
+        return false;
+    }
+    int end = render(writer);
+    if (!writer.finish(end)) {
+        m_error = writer.errorString();
+        file.cancelWriting();
+        return false;
+    }
+    if (!file.commit()) {
+        m_error = file.errorString();
+        return false;
+    }
+    m_waveSeconds = qreal(writer.frames()) / writer.sampleRate();
+    return true;
+}
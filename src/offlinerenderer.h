@@ -0,0 +1,83 @@
+/***************************************************************************
+ *   KMetronome - ALSA Sequencer based MIDI metronome                      *
+ *   Copyright (C) 2005-2021 Pedro Lopez-Cabanillas <plcl@users.sf.net>    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
+ ***************************************************************************/
+
+
+#ifndef OFFLINERENDERER_H
+#define OFFLINERENDERER_H
+
+#include <memory>
+#include <QCoreApplication>
+#include <QString>
+#include "clickgenerator.h"
+
+class CompiledPattern;
+class SongTimeline;
+
+/**
+ * Renders click tracks without the ALSA sequencer, as fast as the output
+ * can be written.
+ *
+ * The bars are made by the same ClickGenerator that the sequencer uses:
+ * some bars of the automatic rhythm or of a drum pattern, or the whole
+ * song timeline when there is one. The settings are those of the main
+ * window, taken from it or read from the saved configuration.
+ *
+ * Click tracks are written as Standard MIDI Files, or as WAV files with
+ * the clicks of the internal audio synthesizer.
+ */
+class OfflineRenderer
+{
+    Q_DECLARE_TR_FUNCTIONS(OfflineRenderer)
+
+public:
+    OfflineRenderer();
+
+    ClickGenerator& generator() { return m_generator; }
+    void readSettings();
+    void setBpm(qreal bpm) { m_bpm = bpm; }
+    void setChannel(int channel) { m_channel = channel; }
+    void setVolume(int volume) { m_volume = volume; }
+    void setBalance(int balance) { m_balance = balance; }
+    void setNoteDuration(int ticks) { m_noteDuration = ticks; }
+    void setSendNoteOff(bool enable) { m_sendNoteOff = enable; }
+    void setBars(int bars) { m_bars = bars; }
+    void setPattern(const std::shared_ptr<const CompiledPattern>& pattern) { m_pattern = pattern; }
+    void setTimeline(const std::shared_ptr<const SongTimeline>& timeline) { m_timeline = timeline; }
+
+    int render(ClickSink& sink) const;
+    bool writeMidi(const QString& fileName);
+    bool writeWave(const QString& fileName);
+    qreal waveSeconds() const { return m_waveSeconds; }
+    QString errorString() const { return m_error; }
+
+private:
+    ClickGenerator m_generator;
+    std::shared_ptr<const CompiledPattern> m_pattern;
+    std::shared_ptr<const SongTimeline> m_timeline;
+    qreal m_bpm;
+    qreal m_waveSeconds;
+    int m_channel;
+    int m_volume;
+    int m_balance;
+    int m_noteDuration;
+    int m_bars;
+    bool m_sendNoteOff;
+    QString m_error;
+};
+
+#endif // OFFLINERENDERER_H
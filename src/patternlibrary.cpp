@@ -0,0 +1,988 @@
+/***************************************************************************
+ *   KMetronome - ALSA Sequencer based MIDI metronome                      *
+ *   Copyright (C) 2005-2021 Pedro Lopez-Cabanillas <plcl@users.sf.net>    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
+ ***************************************************************************/
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QLockFile>
+#include <QSaveFile>
+#include <QSettings>
+#include "patternlibrary.h"
+
+const QString PATTERN_DATA_FILE("patterns.dat");
+const QString PATTERN_INDEX_FILE("patterns.idx");
+const QString PATTERN_LOCK_FILE("patterns.lock");
+/* Milliseconds waiting for another process writing the library */
+const int PATTERN_LOCK_TIMEOUT(5000);
+const QByteArray PATTERN_DATA_HEADER("# KMetronome pattern library 1 ");
+const quint32 PATTERN_INDEX_MAGIC(0x49504d4b); /* "KMPI" */
+const quint32 PATTERN_INDEX_VERSION(4);
+/* Compact when superseded records take this many bytes and half the file */
+const qint64 PATTERN_COMPACT_MIN(64 * 1024);
+/* Fold the journal of a pattern into a full record after this many changes */
+const int PATTERN_JOURNAL_MAX(16);
+/* Compact anyway when the journal records take this many bytes */
+const qint64 PATTERN_JOURNAL_LIMIT(64 * 1024);
+const QByteArray QSTR_ROWS("Rows");
+
+/* Record names are percent encoded, to keep them on a single line */
+static QByteArray encodeName(const QString& name)
+{
+    QByteArray utf8 = name.toUtf8();
+    QByteArray result;
+    result.reserve(utf8.size());
+    foreach(char c, utf8) {
+        if (c == '%' || c == '\n' || c == '\r') {
+            result += '%';
+            result += QByteArray::number(uchar(c), 16).rightJustified(2, '0').toUpper();
+        } else {
+            result += c;
+        }
+    }
+    return result;
+}
+
+static QString decodeName(const QByteArray& encoded)
+{
+    return QString::fromUtf8(QByteArray::fromPercentEncoding(encoded));
+}
+
+/* The name of a "[name]" or "![name]" line, without the line end */
+static QByteArray lineName(const QByteArray& line, int start)
+{
+    int end = line.size();
+    while (end > start && (line[end - 1] == '\n' || line[end - 1] == '\r'))
+        --end;
+    if (end <= start || line[end - 1] != ']')
+        return QByteArray();
+    return line.mid(start, end - start - 1);
+}
+
+/* Tags are stored as a comma separated list */
+static QStringList splitTags(const QByteArray& value)
+{
+    QStringList tags;
+    foreach(const QByteArray& tag, value.split(',')) {
+        QByteArray t = tag.trimmed();
+        if (!t.isEmpty())
+            tags += QString::fromUtf8(t);
+    }
+    return tags;
+}
+
+/* Case insensitive match of some text in the name or any of the tags */
+bool PatternInfo::matches(const QString& text) const
+{
+    if (text.isEmpty() || name.contains(text, Qt::CaseInsensitive))
+        return true;
+    foreach(const QString& tag, tags) {
+        if (tag.contains(text, Qt::CaseInsensitive))
+            return true;
+    }
+    return false;
+}
+
+/* Updates the metadata of a pattern with a "key=value" line of its record */
+static void parseInfo(const QByteArray& line, PatternInfo& info)
+{
+    int eq = line.indexOf('=');
+    if (eq < 1)
+        return;
+    QByteArray key = line.left(eq);
+    QByteArray value = line.mid(eq + 1).trimmed();
+    if (key == QSTR_FIGURE.toLatin1()) {
+        info.figure = value.toInt();
+    } else if (key == QSTR_BEATS.toLatin1()) {
+        info.beats = value.toInt();
+    } else if (key == QSTR_BARS.toLatin1()) {
+        info.bars = value.toInt();
+    } else if (key == QSTR_TAGS.toLatin1()) {
+        info.tags = splitTags(value);
+    } else if (key == QSTR_ROWS) {
+        info.rows = value.toInt();
+    } else if (key.at(0) >= '0' && key.at(0) <= '9') {
+        info.rows++;
+    }
+}
+
+qint64 PatternLibrary::Entry::journalSize() const
+{
+    qint64 size = 0;
+    foreach(const Extent& x, journal)
+        size += x.length;
+    return size;
+}
+
+qint64 PatternLibrary::Entry::size() const
+{
+    return length + journalSize();
+}
+
+PatternLibrary::PatternLibrary(const QString& directory) :
+    m_dataFile(QDir(directory).filePath(PATTERN_DATA_FILE)),
+    m_indexFile(QDir(directory).filePath(PATTERN_INDEX_FILE)),
+    m_lockFile(QDir(directory).filePath(PATTERN_LOCK_FILE)),
+    m_dataSize(0),
+    m_garbage(0),
+    m_journal(0),
+    m_open(false),
+    m_created(false),
+    m_indexDirty(false),
+    m_compacting(false),
+    m_readOnly(false)
+{ }
+
+PatternLibrary::~PatternLibrary()
+{
+    close();
+}
+
+/**
+ * Opens the library, creating an empty one if it doesn't exist yet; in
+ * that case isCreated() returns true. A library opened read only is
+ * never created, compacted or written to, not even its index, so it may
+ * be read by a process while another one is writing it.
+ */
+bool PatternLibrary::open(OpenMode mode)
+{
+    QMutexLocker locker(&m_mutex);
+    if (m_open)
+        return true;
+    m_readOnly = (mode == ReadOnly);
+    m_entries.clear();
+    m_garbage = 0;
+    m_journal = 0;
+    m_created = false;
+    if (!QFileInfo::exists(m_dataFile)) {
+        if (m_readOnly || !QDir().mkpath(QFileInfo(m_dataFile).absolutePath()))
+            return false;
+        QLockFile lock(m_lockFile);
+        if (!lock.tryLock(PATTERN_LOCK_TIMEOUT))
+            return false;
+        // another process may have created it meanwhile
+        if (!QFileInfo::exists(m_dataFile)) {
+            if (!create())
+                return false;
+            m_created = true;
+            m_open = true;
+            return true;
+        }
+    }
+    QByteArray stamp;
+    if (!readStamp(stamp))
+        return false;
+    m_stamp = stamp;
+    reload();
+    m_open = true;
+    compactIfNeeded();
+    return true;
+}
+
+void PatternLibrary::close()
+{
+    QMutexLocker locker(&m_mutex);
+    if (!m_open)
+        return;
+    compactIfNeeded();
+    if (m_indexDirty && !m_readOnly) {
+        QLockFile lock(m_lockFile);
+        if (lockWriters(lock))
+            writeIndex();
+    }
+    m_open = false;
+}
+
+/* The stamp in the header of the data file, changed by every compaction */
+bool PatternLibrary::readStamp(QByteArray& stamp) const
+{
+    QFile file(m_dataFile);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    QByteArray header = file.readLine();
+    if (!header.startsWith(PATTERN_DATA_HEADER)) {
+        qWarning("%s: not a pattern library", m_dataFile.toUtf8().constData());
+        return false;
+    }
+    stamp = header.mid(PATTERN_DATA_HEADER.size()).trimmed();
+    return true;
+}
+
+/* Builds the index from the index file, and the records appended after it */
+void PatternLibrary::reload()
+{
+    m_entries.clear();
+    m_garbage = 0;
+    m_journal = 0;
+    m_dataSize = 0;
+    if (!readIndex()) {
+        m_entries.clear();
+        m_garbage = 0;
+        m_journal = 0;
+        m_dataSize = 0;
+        m_indexDirty = true;
+    }
+    scan(m_dataSize);
+}
+
+/**
+ * Takes the lock serializing the writers of all the processes sharing the
+ * library, then catches up with what the others wrote meanwhile: records
+ * appended after the known size are scanned, and a data file compacted
+ * by another process is indexed again.
+ */
+bool PatternLibrary::lockWriters(QLockFile& lock)
+{
+    if (m_readOnly)
+        return false;
+    if (!lock.tryLock(PATTERN_LOCK_TIMEOUT)) {
+        qWarning("%s: the pattern library is locked", m_lockFile.toUtf8().constData());
+        return false;
+    }
+    QByteArray stamp;
+    if (!readStamp(stamp))
+        return false;
+    if (stamp != m_stamp) {
+        m_stamp = stamp;
+        reload();
+    } else if (QFileInfo(m_dataFile).size() > m_dataSize) {
+        scan(m_dataSize);
+    }
+    return true;
+}
+
+bool PatternLibrary::create()
+{
+    QDir().mkpath(QFileInfo(m_dataFile).absolutePath());
+    m_stamp = QByteArray::number(QDateTime::currentMSecsSinceEpoch());
+    QSaveFile file(m_dataFile);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    QByteArray header = PATTERN_DATA_HEADER + m_stamp + '\n';
+    file.write(header);
+    if (!file.commit())
+        return false;
+    m_dataSize = header.size();
+    m_indexDirty = true;
+    return true;
+}
+
+bool PatternLibrary::readIndex()
+{
+    QFile file(m_indexFile);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    QDataStream in(&file);
+    in.setVersion(QDataStream::Qt_5_0);
+    quint32 magic, version, count;
+    QByteArray stamp;
+    qint64 dataSize, garbage;
+    in >> magic >> version >> stamp >> dataSize >> garbage >> count;
+    if (in.status() != QDataStream::Ok || magic != PATTERN_INDEX_MAGIC ||
+        version != PATTERN_INDEX_VERSION || stamp != m_stamp ||
+        dataSize > QFileInfo(m_dataFile).size())
+        return false;
+    for (quint32 i = 0; i < count && in.status() == QDataStream::Ok; ++i) {
+        Entry e;
+        qint32 figure, beats, bars, rows;
+        quint32 changes;
+        in >> e.info.name >> e.offset >> e.length >> figure >> beats >> bars >> rows
+           >> e.info.tags >> changes;
+        e.info.figure = figure;
+        e.info.beats = beats;
+        e.info.bars = bars;
+        e.info.rows = rows;
+        for (quint32 j = 0; j < changes && in.status() == QDataStream::Ok; ++j) {
+            Extent x;
+            in >> x.offset >> x.length;
+            e.journal.append(x);
+        }
+        m_journal += e.journalSize();
+        m_entries.insert(e.info.name, e);
+    }
+    if (in.status() != QDataStream::Ok)
+        return false;
+    m_dataSize = dataSize;
+    m_garbage = garbage;
+    return true;
+}
+
+bool PatternLibrary::writeIndex()
+{
+    QSaveFile file(m_indexFile);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    QDataStream out(&file);
+    out.setVersion(QDataStream::Qt_5_0);
+    out << PATTERN_INDEX_MAGIC << PATTERN_INDEX_VERSION << m_stamp
+        << m_dataSize << m_garbage << quint32(m_entries.count());
+    QMap<QString, Entry>::ConstIterator it;
+    for (it = m_entries.constBegin(); it != m_entries.constEnd(); ++it) {
+        const Entry& e = it.value();
+        out << it.key() << e.offset << e.length << qint32(e.info.figure)
+            << qint32(e.info.beats) << qint32(e.info.bars) << qint32(e.info.rows) << e.info.tags
+            << quint32(e.journal.count());
+        foreach(const Extent& x, e.journal)
+            out << x.offset << x.length;
+    }
+    if (!file.commit())
+        return false;
+    m_indexDirty = false;
+    return true;
+}
+
+/**
+ * Reads the records of the data file from the given offset, updating the
+ * index. An incomplete record at the end, left by an interrupted write,
+ * is ignored.
+ */
+void PatternLibrary::scan(qint64 from)
+{
+    QFile file(m_dataFile);
+    if (!file.open(QIODevice::ReadOnly))
+        return;
+    if (from < 0 || from > file.size())
+        from = 0;
+    file.seek(from);
+    qint64 pos = from;
+    qint64 start = -1;
+    bool isChange = false;
+    PatternInfo info;
+    qint64 covered = from;
+    while (!file.atEnd()) {
+        QByteArray line = file.readLine();
+        qint64 next = pos + line.size();
+        if (line.startsWith('[') || line.startsWith("+[")) {
+            // a record without its blank line end is dropped
+            if (start >= 0)
+                m_garbage += pos - start;
+            start = pos;
+            isChange = line.startsWith('+');
+            QString name = decodeName(lineName(line, isChange ? 2 : 1));
+            info = isChange ? m_entries.value(name).info : PatternInfo();
+            info.name = name;
+        } else if (line.startsWith("![")) {
+            dropEntry(decodeName(lineName(line, 2)));
+            m_garbage += line.size();
+            m_indexDirty = true;
+            covered = next;
+        } else if (start >= 0 && (line == "\n" || line == "\r\n")) {
+            qint32 length = qint32(next - start);
+            QMap<QString, Entry>::Iterator it = m_entries.find(info.name);
+            if (!isChange) {
+                dropEntry(info.name);
+                Entry e;
+                e.offset = start;
+                e.length = length;
+                e.info = info;
+                m_entries.insert(info.name, e);
+            } else if (it != m_entries.end()) {
+                Extent x;
+                x.offset = start;
+                x.length = length;
+                it->journal.append(x);
+                it->info = info;
+                m_journal += length;
+            } else {
+                // changes to a pattern removed meanwhile
+                m_garbage += length;
+            }
+            m_indexDirty = true;
+            start = -1;
+            covered = next;
+        } else if (start >= 0) {
+            parseInfo(line, info);
+        } else {
+            covered = next;
+        }
+        pos = next;
+    }
+    m_dataSize = (start >= 0) ? start : covered;
+}
+
+bool PatternLibrary::append(const QByteArray& record, qint64& offset)
+{
+    QFile file(m_dataFile);
+    if (!file.open(QIODevice::ReadWrite | QIODevice::Append))
+        return false;
+    qint64 size = file.size();
+    if (size > 0) {
+        char last = 0;
+        file.seek(size - 1);
+        file.getChar(&last);
+        if (last != '\n') {
+            file.seek(size);
+            file.write("\n");
+        }
+    }
+    offset = file.size();
+    bool ok = (file.write(record) == record.size()) && file.flush();
+    m_dataSize = file.size();
+    m_indexDirty = true;
+    return ok;
+}
+
+QByteArray PatternLibrary::serialize(const Pattern& pattern)
+{
+    QByteArray record;
+    record += '[' + encodeName(pattern.name) + "]\n";
+    record += QSTR_FIGURE.toLatin1() + '=' + QByteArray::number(pattern.figure) + '\n';
+    record += QSTR_BEATS.toLatin1() + '=' + QByteArray::number(pattern.beats) + '\n';
+    if (pattern.bars != PATTERN_BARS)
+        record += QSTR_BARS.toLatin1() + '=' + QByteArray::number(pattern.bars) + '\n';
+    if (!pattern.tags.isEmpty())
+        record += QSTR_TAGS.toLatin1() + '=' + pattern.tags.join(',').toUtf8() + '\n';
+    for (int r = 0; r < pattern.keys.count() && r < pattern.rows.count(); ++r) {
+        record += QByteArray::number(pattern.keys.at(r)) + '=' +
+                  pattern.rows.at(r).join(',').toUtf8() + '\n';
+    }
+    record += '\n';
+    return record;
+}
+
+bool PatternLibrary::parse(const QByteArray& record, Pattern& pattern)
+{
+    QList<QByteArray> lines = record.split('\n');
+    if (lines.isEmpty() || !lines.first().startsWith('['))
+        return false;
+    pattern = Pattern();
+    pattern.name = decodeName(lineName(lines.first(), 1));
+    const QByteArray figure = QSTR_FIGURE.toLatin1();
+    const QByteArray beats = QSTR_BEATS.toLatin1();
+    for (int i = 1; i < lines.count(); ++i) {
+        QByteArray line = lines.at(i);
+        if (line.endsWith('\r'))
+            line.chop(1);
+        int eq = line.indexOf('=');
+        if (eq < 1)
+            continue;
+        QByteArray key = line.left(eq);
+        QByteArray value = line.mid(eq + 1);
+        if (key == figure) {
+            pattern.figure = value.toInt();
+        } else if (key == beats) {
+            pattern.beats = value.toInt();
+        } else if (key == QSTR_BARS.toLatin1()) {
+            pattern.bars = value.toInt();
+        } else if (key == QSTR_TAGS.toLatin1()) {
+            pattern.tags = splitTags(value);
+        } else {
+            bool isNumber;
+            int k = key.toInt(&isNumber);
+            if (isNumber) {
+                pattern.keys.append(k);
+                pattern.rows.append(QString::fromUtf8(value).split(','));
+            }
+        }
+    }
+    pattern.boundLayout();
+    return true;
+}
+
+/**
+ * The journal record turning before into after, or an empty one if they
+ * are equal. Returns false when the changes can't be expressed that way:
+ * when a key is repeated, or the rows kept have been reordered or new rows
+ * are not at the end.
+ */
+bool PatternLibrary::serializeChanges(const Pattern& before, const Pattern& after, QByteArray& record)
+{
+    record.clear();
+    if (before.keys.count() != before.rows.count() || after.keys.count() != after.rows.count())
+        return false;
+    QMap<int, int> oldRows;
+    for (int r = 0; r < before.keys.count(); ++r) {
+        if (oldRows.contains(before.keys.at(r)))
+            return false;
+        oldRows.insert(before.keys.at(r), r);
+    }
+    QMap<int, int> newRows;
+    QList<int> expected;
+    for (int r = 0; r < after.keys.count(); ++r) {
+        if (newRows.contains(after.keys.at(r)))
+            return false;
+        newRows.insert(after.keys.at(r), r);
+    }
+    foreach(int key, before.keys) {
+        if (newRows.contains(key))
+            expected.append(key);
+    }
+    foreach(int key, after.keys) {
+        if (!oldRows.contains(key))
+            expected.append(key);
+    }
+    if (expected != after.keys)
+        return false;
+    QByteArray changes;
+    if (after.figure != before.figure)
+        changes += QSTR_FIGURE.toLatin1() + '=' + QByteArray::number(after.figure) + '\n';
+    if (after.beats != before.beats)
+        changes += QSTR_BEATS.toLatin1() + '=' + QByteArray::number(after.beats) + '\n';
+    if (after.bars != before.bars)
+        changes += QSTR_BARS.toLatin1() + '=' + QByteArray::number(after.bars) + '\n';
+    if (after.tags != before.tags)
+        changes += QSTR_TAGS.toLatin1() + '=' + after.tags.join(',').toUtf8() + '\n';
+    foreach(int key, before.keys) {
+        if (!newRows.contains(key))
+            changes += '-' + QByteArray::number(key) + '\n';
+    }
+    for (int r = 0; r < after.keys.count(); ++r) {
+        int key = after.keys.at(r);
+        if (!oldRows.contains(key) || before.rows.at(oldRows.value(key)) != after.rows.at(r))
+            changes += QByteArray::number(key) + '=' + after.rows.at(r).join(',').toUtf8() + '\n';
+    }
+    if (changes.isEmpty())
+        return true;
+    record += "+[" + encodeName(after.name) + "]\n";
+    record += changes;
+    record += QSTR_ROWS + '=' + QByteArray::number(after.keys.count()) + '\n';
+    record += '\n';
+    return true;
+}
+
+bool PatternLibrary::applyChanges(const QByteArray& record, Pattern& pattern)
+{
+    QList<QByteArray> lines = record.split('\n');
+    if (lines.isEmpty() || !lines.first().startsWith("+["))
+        return false;
+    const QByteArray figure = QSTR_FIGURE.toLatin1();
+    const QByteArray beats = QSTR_BEATS.toLatin1();
+    for (int i = 1; i < lines.count(); ++i) {
+        QByteArray line = lines.at(i);
+        if (line.endsWith('\r'))
+            line.chop(1);
+        if (line.startsWith('-')) {
+            int r = pattern.keys.indexOf(line.mid(1).toInt());
+            if (r >= 0) {
+                pattern.keys.removeAt(r);
+                pattern.rows.removeAt(r);
+            }
+            continue;
+        }
+        int eq = line.indexOf('=');
+        if (eq < 1)
+            continue;
+        QByteArray key = line.left(eq);
+        QByteArray value = line.mid(eq + 1);
+        if (key == figure) {
+            pattern.figure = value.toInt();
+        } else if (key == beats) {
+            pattern.beats = value.toInt();
+        } else if (key == QSTR_BARS.toLatin1()) {
+            pattern.bars = value.toInt();
+        } else if (key == QSTR_TAGS.toLatin1()) {
+            pattern.tags = splitTags(value);
+        } else {
+            bool isNumber;
+            int k = key.toInt(&isNumber);
+            if (isNumber) {
+                QStringList row = QString::fromUtf8(value).split(',');
+                int r = pattern.keys.indexOf(k);
+                if (r >= 0) {
+                    pattern.rows[r] = row;
+                } else {
+                    pattern.keys.append(k);
+                    pattern.rows.append(row);
+                }
+            }
+        }
+    }
+    pattern.boundLayout();
+    return true;
+}
+
+QStringList PatternLibrary::names() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_entries.keys();
+}
+
+int PatternLibrary::count() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_entries.count();
+}
+
+bool PatternLibrary::contains(const QString& name) const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_entries.contains(name);
+}
+
+/**
+ * The name itself if no pattern has it yet, or else the name followed by
+ * the first free number, like "name (2)".
+ */
+QString PatternLibrary::uniqueName(const QString& name) const
+{
+    QMutexLocker locker(&m_mutex);
+    QString result = name;
+    for (int n = 2; m_entries.contains(result); ++n)
+        result = QString("%1 (%2)").arg(name).arg(n);
+    return result;
+}
+
+PatternInfo PatternLibrary::info(const QString& name) const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_entries.value(name).info;
+}
+
+qint64 PatternLibrary::garbage() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_garbage;
+}
+
+bool PatternLibrary::needsCompaction() const
+{
+    QMutexLocker locker(&m_mutex);
+    return m_open && !m_readOnly && !m_compacting && wantsCompaction();
+}
+
+bool PatternLibrary::load(const QString& name, Pattern& pattern) const
+{
+    QMutexLocker locker(&m_mutex);
+    QMap<QString, Entry>::ConstIterator it = m_entries.constFind(name);
+    if (it == m_entries.constEnd())
+        return false;
+    return loadEntry(it.value(), pattern);
+}
+
+/* Reads the full record of a pattern and replays its journal */
+bool PatternLibrary::loadEntry(const Entry& entry, Pattern& pattern) const
+{
+    QFile file(m_dataFile);
+    if (!file.open(QIODevice::ReadOnly) || !file.seek(entry.offset))
+        return false;
+    QByteArray record = file.read(entry.length);
+    // a different name means the file was compacted by another process
+    if (record.size() != entry.length || !parse(record, pattern) || pattern.name != entry.info.name)
+        return false;
+    foreach(const Extent& x, entry.journal) {
+        if (!file.seek(x.offset))
+            return false;
+        record = file.read(x.length);
+        if (record.size() != x.length || !applyChanges(record, pattern))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Stores a pattern with a full record, replacing any stored one.
+ */
+bool PatternLibrary::save(const Pattern& pattern)
+{
+    QMutexLocker locker(&m_mutex);
+    if (!m_open || pattern.name.isEmpty())
+        return false;
+    QLockFile lock(m_lockFile);
+    if (!lockWriters(lock))
+        return false;
+    return store(pattern, serialize(pattern), false);
+}
+
+/**
+ * Stores the changes made to a pattern by an editor, given the version
+ * it loaded or saved last. Only a journal record with the changes is
+ * appended, unless the pattern is not stored or has been replaced since,
+ * its journal is already long or a full record would be as small. The
+ * stored records are never read.
+ */
+bool PatternLibrary::save(const Pattern& pattern, const Pattern& previous)
+{
+    QMutexLocker locker(&m_mutex);
+    if (!m_open || pattern.name.isEmpty())
+        return false;
+    QLockFile lock(m_lockFile);
+    if (!lockWriters(lock))
+        return false;
+    QByteArray record = serialize(pattern);
+    QMap<QString, Entry>::ConstIterator it = m_entries.constFind(pattern.name);
+    if (previous.name != pattern.name || it == m_entries.constEnd() ||
+        it->journal.count() >= PATTERN_JOURNAL_MAX)
+        return store(pattern, record, false);
+    // replaced meanwhile, as far as the index can tell
+    const PatternInfo& info = it->info;
+    if (info.figure != previous.figure || info.beats != previous.beats ||
+        info.bars != previous.bars || info.rows != previous.keys.count() ||
+        info.tags != previous.tags)
+        return store(pattern, record, false);
+    QByteArray changes;
+    if (!serializeChanges(previous, pattern, changes))
+        return store(pattern, record, false);
+    if (changes.isEmpty())
+        return true;
+    if (changes.size() < record.size())
+        return store(pattern, changes, true);
+    return store(pattern, record, false);
+}
+
+/* Appends a full or a journal record of a pattern and indexes it */
+bool PatternLibrary::store(const Pattern& pattern, const QByteArray& record, bool isChange)
+{
+    qint64 offset = 0;
+    if (!append(record, offset))
+        return false;
+    PatternInfo info;
+    info.name = pattern.name;
+    info.figure = pattern.figure;
+    info.beats = pattern.beats;
+    info.bars = pattern.bars;
+    info.rows = pattern.keys.count();
+    info.tags = pattern.tags;
+    if (isChange) {
+        QMap<QString, Entry>::Iterator it = m_entries.find(pattern.name);
+        Extent x;
+        x.offset = offset;
+        x.length = record.size();
+        it->journal.append(x);
+        it->info = info;
+        m_journal += x.length;
+    } else {
+        dropEntry(pattern.name);
+        Entry e;
+        e.offset = offset;
+        e.length = record.size();
+        e.info = info;
+        m_entries.insert(pattern.name, e);
+    }
+    return true;
+}
+
+/**
+ * The patterns whose name or tags contain the text, using only the index.
+ */
+QList<PatternInfo> PatternLibrary::search(const QString& text) const
+{
+    QMutexLocker locker(&m_mutex);
+    QList<PatternInfo> result;
+    QMap<QString, Entry>::ConstIterator it;
+    for (it = m_entries.constBegin(); it != m_entries.constEnd(); ++it) {
+        if (it.value().info.matches(text))
+            result.append(it.value().info);
+    }
+    return result;
+}
+
+bool PatternLibrary::remove(const QString& name)
+{
+    QMutexLocker locker(&m_mutex);
+    if (!m_open || m_readOnly)
+        return false;
+    QLockFile lock(m_lockFile);
+    if (!lockWriters(lock) || !m_entries.contains(name))
+        return false;
+    QByteArray tombstone = "![" + encodeName(name) + "]\n";
+    qint64 offset = 0;
+    if (!append(tombstone, offset))
+        return false;
+    dropEntry(name);
+    m_garbage += tombstone.size();
+    return true;
+}
+
+/* Accounts the records of a pattern as garbage and forgets it */
+void PatternLibrary::dropEntry(const QString& name)
+{
+    QMap<QString, Entry>::Iterator it = m_entries.find(name);
+    if (it == m_entries.end())
+        return;
+    m_garbage += it->size();
+    m_journal -= it->journalSize();
+    m_entries.erase(it);
+}
+
+/*
+ * Superseded records are wasted space, and journal records make loading
+ * slower; both are dropped when they take a large part of the file, and
+ * the journals also when they grow large by themselves.
+ */
+bool PatternLibrary::wantsCompaction() const
+{
+    qint64 waste = m_garbage + m_journal;
+    return (waste >= PATTERN_COMPACT_MIN && waste * 2 >= m_dataSize) ||
+           m_journal >= PATTERN_JOURNAL_LIMIT;
+}
+
+void PatternLibrary::compactIfNeeded()
+{
+    if (m_readOnly || !wantsCompaction())
+        return;
+    QLockFile lock(m_lockFile);
+    if (lockWriters(lock) && wantsCompaction())
+        compactData();
+}
+
+/**
+ * Rewrites the data file with only the current record of each pattern,
+ * folding the journals into full records, and the index to match it.
+ *
+ * The new file is written without holding the lock, from a copy of the
+ * index, so the library can still be read and modified meanwhile; the
+ * records appended in the meantime are copied after the others and
+ * scanned again when the new file replaces the old one.
+ */
+bool PatternLibrary::compact()
+{
+    QMutexLocker locker(&m_mutex);
+    if (!m_open || m_readOnly || m_compacting)
+        return false;
+    {
+        QLockFile lock(m_lockFile);
+        if (!lockWriters(lock))
+            return false;
+    }
+    QMap<QString, Entry> entries = m_entries;
+    qint64 size = m_dataSize;
+    QByteArray oldStamp = m_stamp;
+    m_compacting = true;
+    locker.unlock();
+
+    QByteArray stamp = QByteArray::number(QDateTime::currentMSecsSinceEpoch());
+    QSaveFile output(m_dataFile);
+    qint64 pos = 0;
+    bool ok = output.open(QIODevice::WriteOnly) && writeRecords(output, stamp, entries, pos);
+
+    locker.relock();
+    m_compacting = false;
+    QLockFile lock(m_lockFile);
+    // another process may have compacted the file meanwhile
+    if (!ok || !m_open || !lockWriters(lock) || m_stamp != oldStamp) {
+        output.cancelWriting();
+        return false;
+    }
+    qint64 appended = m_dataSize - size;
+    if (appended > 0) {
+        QFile input(m_dataFile);
+        if (!input.open(QIODevice::ReadOnly) || !input.seek(size) ||
+            output.write(input.read(appended)) != appended) {
+            output.cancelWriting();
+            return false;
+        }
+    }
+    if (!output.commit())
+        return false;
+    m_entries = entries;
+    m_stamp = stamp;
+    m_dataSize = pos;
+    m_garbage = 0;
+    m_journal = 0;
+    if (appended > 0)
+        scan(pos);
+    return writeIndex();
+}
+
+/* Compacts while holding the lock, when opening or closing the library */
+bool PatternLibrary::compactData()
+{
+    QByteArray stamp = QByteArray::number(QDateTime::currentMSecsSinceEpoch());
+    QSaveFile output(m_dataFile);
+    if (!output.open(QIODevice::WriteOnly))
+        return false;
+    QMap<QString, Entry> entries = m_entries;
+    qint64 pos = 0;
+    if (!writeRecords(output, stamp, entries, pos)) {
+        output.cancelWriting();
+        return false;
+    }
+    if (!output.commit())
+        return false;
+    m_entries = entries;
+    m_stamp = stamp;
+    m_dataSize = pos;
+    m_garbage = 0;
+    m_journal = 0;
+    return writeIndex();
+}
+
+/**
+ * Writes a new data file with the given stamp and the current record of
+ * the entries, moving them to their new location. It only reads the data
+ * file, so it doesn't need the lock while nothing but appending happens.
+ */
+bool PatternLibrary::writeRecords(QIODevice& output, const QByteArray& stamp,
+                                  QMap<QString, Entry>& entries, qint64& pos) const
+{
+    QFile input(m_dataFile);
+    if (!input.open(QIODevice::ReadOnly))
+        return false;
+    QByteArray header = PATTERN_DATA_HEADER + stamp + '\n';
+    if (output.write(header) != header.size())
+        return false;
+    pos = header.size();
+    QMap<QString, Entry>::Iterator it;
+    for (it = entries.begin(); it != entries.end(); ++it) {
+        QByteArray record;
+        if (it->journal.isEmpty()) {
+            input.seek(it->offset);
+            record = input.read(it->length);
+            if (record.size() != it->length)
+                return false;
+        } else {
+            Pattern pattern;
+            if (!loadEntry(it.value(), pattern))
+                return false;
+            record = serialize(pattern);
+        }
+        if (output.write(record) != record.size())
+            return false;
+        it->offset = pos;
+        it->length = record.size();
+        it->journal.clear();
+        pos += record.size();
+    }
+    return true;
+}
+
+/**
+ * Moves the patterns stored by older versions as "Pattern_" groups of the
+ * application settings into the library.
+ */
+void PatternLibrary::migrateSettings()
+{
+    const int n(QSTR_PATTERN.size());
+    QSettings settings;
+    foreach(const QString& group, settings.childGroups()) {
+        if (!group.startsWith(QSTR_PATTERN))
+            continue;
+        Pattern pattern;
+        pattern.name = group.mid(n);
+        settings.beginGroup(group);
+        pattern.figure = settings.value(QSTR_FIGURE, PATTERN_FIGURE).toInt();
+        pattern.beats = settings.value(QSTR_BEATS, PATTERN_COLUMNS).toInt();
+        pattern.bars = settings.value(QSTR_BARS, PATTERN_BARS).toInt();
+        pattern.tags = settings.value(QSTR_TAGS).toStringList();
+        QStringList keys = settings.childKeys();
+        keys.sort();
+        foreach(const QString& key, keys) {
+            bool isNumber;
+            int k = key.toInt(&isNumber);
+            if (isNumber) {
+                pattern.keys.append(k);
+                pattern.rows.append(settings.value(key, QStringList()).toStringList());
+            }
+        }
+        settings.endGroup();
+        if (save(pattern))
+            settings.remove(group);
+    }
+    settings.sync();
+}
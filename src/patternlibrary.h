@@ -0,0 +1,194 @@
+/***************************************************************************
+ *   KMetronome - ALSA Sequencer based MIDI metronome                      *
+ *   Copyright (C) 2005-2021 Pedro Lopez-Cabanillas <plcl@users.sf.net>    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
+ ***************************************************************************/
+
+#ifndef PATTERNLIBRARY_H
+#define PATTERNLIBRARY_H
+
+#include <QByteArray>
+#include <QList>
+#include <QMap>
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include "defs.h"
+
+class QIODevice;
+class QLockFile;
+
+/**
+ * A drum pattern: figure, number of beats per bar, number of bars and one
+ * row of hits for each percussion key, holding the beats of all the bars.
+ */
+class Pattern
+{
+public:
+    Pattern() : figure(PATTERN_FIGURE), beats(PATTERN_COLUMNS), bars(PATTERN_BARS) {}
+
+    /* Keeps a layout read from a file within what the grid can hold */
+    void boundLayout()
+    {
+        bars = qBound(1, bars, PATTERN_BARS_MAX);
+        beats = qBound(1, beats, PATTERN_COLUMNS_MAX / bars);
+    }
+
+    QString name;
+    int figure;
+    int beats;
+    int bars;
+    QStringList tags;
+    QList<int> keys;
+    QList<QStringList> rows;
+};
+
+/**
+ * What the library index knows about a pattern without reading its body.
+ */
+class PatternInfo
+{
+public:
+    PatternInfo() : figure(PATTERN_FIGURE), beats(PATTERN_COLUMNS), bars(PATTERN_BARS), rows(0) {}
+
+    QString timeSignature() const { return QString("%1/%2").arg(beats).arg(figure); }
+    bool matches(const QString& text) const;
+
+    QString name;
+    int figure;
+    int beats;
+    int bars;
+    int rows;
+    QStringList tags;
+};
+
+/**
+ * The store of user patterns.
+ *
+ * Patterns are kept in a line oriented data file. Saving a pattern appends
+ * a new record, and removing one appends a tombstone, so both cost the
+ * size of a single record. A binary index file maps each name to the
+ * offset and length of its latest record; it is written when the library
+ * is closed, and on opening only the records appended after the indexed
+ * size are scanned, so a missing or stale index is recovered from the data
+ * file alone. Superseded records are dropped by compacting the data file
+ * once they take a large part of it.
+ *
+ * An editor saving a pattern that is already stored passes the version
+ * it loaded, and usually only a journal record with the changes is
+ * appended: the figure, beats, bars or tags when modified, and the rows
+ * changed, added or removed. Loading replays the journal records over the
+ * full record. The journal of a pattern is folded into a new full record
+ * when it grows long, and compacting folds all of them.
+ *
+ * Besides the record location, the index keeps the figure, beats, bars,
+ * number of rows and tags of every pattern, so patterns can be listed,
+ * described and searched without reading their bodies.
+ *
+ * All the public methods are serialized by a mutex, so the library may
+ * be used from a worker thread, like the one importing pattern files,
+ * while the user interface keeps reading it. Compacting holds the mutex
+ * only to copy the index and to replace the data file.
+ *
+ * Another process, like the command line renderer, may open the library
+ * read only: it never writes, compacts or rewrites the index. Writers in
+ * different processes are serialized by a lock file next to the data
+ * file, and each of them rescans the records appended by the others
+ * before writing its own.
+ */
+class PatternLibrary
+{
+public:
+    enum OpenMode { ReadWrite, ReadOnly };
+
+    explicit PatternLibrary(const QString& directory);
+    ~PatternLibrary();
+
+    bool open(OpenMode mode = ReadWrite);
+    void close();
+    bool isCreated() const { return m_created; }
+
+    QStringList names() const;
+    int count() const;
+    bool contains(const QString& name) const;
+    QString uniqueName(const QString& name) const;
+    PatternInfo info(const QString& name) const;
+    QList<PatternInfo> search(const QString& text) const;
+    bool load(const QString& name, Pattern& pattern) const;
+    bool save(const Pattern& pattern);
+    bool save(const Pattern& pattern, const Pattern& previous);
+    bool remove(const QString& name);
+
+    qint64 garbage() const;
+    bool needsCompaction() const;
+    bool compact();
+    void migrateSettings();
+
+    static QByteArray serialize(const Pattern& pattern);
+    static bool parse(const QByteArray& record, Pattern& pattern);
+    static bool serializeChanges(const Pattern& before, const Pattern& after, QByteArray& record);
+    static bool applyChanges(const QByteArray& record, Pattern& pattern);
+
+private:
+    struct Extent {
+        qint64 offset;
+        qint32 length;
+    };
+
+    struct Entry {
+        Entry() : offset(0), length(0) {}
+        qint64 size() const;
+        qint64 journalSize() const;
+        qint64 offset;
+        qint32 length;
+        QVector<Extent> journal;
+        PatternInfo info;
+    };
+
+    bool create();
+    bool readStamp(QByteArray& stamp) const;
+    void reload();
+    bool lockWriters(QLockFile& lock);
+    bool readIndex();
+    bool writeIndex();
+    void scan(qint64 from);
+    bool append(const QByteArray& record, qint64& offset);
+    bool store(const Pattern& pattern, const QByteArray& record, bool isChange);
+    void compactIfNeeded();
+    bool wantsCompaction() const;
+    void dropEntry(const QString& name);
+    bool loadEntry(const Entry& entry, Pattern& pattern) const;
+    bool compactData();
+    bool writeRecords(QIODevice& output, const QByteArray& stamp,
+                      QMap<QString, Entry>& entries, qint64& pos) const;
+
+    mutable QMutex m_mutex;
+    QString m_dataFile;
+    QString m_indexFile;
+    QString m_lockFile;
+    QByteArray m_stamp;
+    QMap<QString, Entry> m_entries;
+    qint64 m_dataSize;
+    qint64 m_garbage;
+    qint64 m_journal;
+    bool m_open;
+    bool m_created;
+    bool m_indexDirty;
+    bool m_compacting;
+    bool m_readOnly;
+};
+
+#endif // PATTERNLIBRARY_H
@@ -0,0 +1,376 @@
+/***************************************************************************
+ *   KMetronome - ALSA Sequencer based MIDI metronome                      *
+ *   Copyright (C) 2005-2021 Pedro Lopez-Cabanillas <plcl@users.sf.net>    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
+ ***************************************************************************/
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QScopedPointer>
+#include <QTemporaryDir>
+#include <QThread>
+#include <QtTest>
+#include "patternlibrary.h"
+
+/* Patterns filling the library compacted while saving, and the tries */
+const int COMPACT_PATTERNS(1000);
+const int COMPACT_ATTEMPTS(20);
+
+/* Compacts a library on its own thread */
+class CompactThread : public QThread
+{
+public:
+    explicit CompactThread(PatternLibrary& library) : m_library(library), m_compacted(false) {}
+    bool compacted() const { return m_compacted; }
+
+protected:
+    void run() override { m_compacted = m_library.compact(); }
+
+private:
+    PatternLibrary& m_library;
+    bool m_compacted;
+};
+
+/**
+ * Checks that the pattern library keeps what was saved across reopening,
+ * whatever the state of its index, an interrupted write, or the records
+ * appended while it was being compacted.
+ */
+class PatternLibraryTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void init();
+    void cleanup();
+    void save();
+    void journalSave();
+    void remove();
+    void missingIndex();
+    void staleIndex();
+    void truncatedRecord();
+    void readOnly();
+    void compactWhileSaving();
+
+private:
+    QString dataFile() const { return QDir(m_dir->path()).filePath("patterns.dat"); }
+    QString indexFile() const { return QDir(m_dir->path()).filePath("patterns.idx"); }
+    static Pattern makePattern(const QString& name, int seed);
+    static Pattern changeRow(const Pattern& pattern, int row);
+    static void compare(PatternLibrary& library, const Pattern& expected);
+
+    QScopedPointer<QTemporaryDir> m_dir;
+};
+
+void PatternLibraryTest::init()
+{
+    m_dir.reset(new QTemporaryDir);
+    QVERIFY(m_dir->isValid());
+}
+
+void PatternLibraryTest::cleanup()
+{
+    m_dir.reset();
+}
+
+/* Eight rows of sixteen velocities, different for every seed */
+Pattern PatternLibraryTest::makePattern(const QString& name, int seed)
+{
+    Pattern pattern;
+    pattern.name = name;
+    pattern.figure = 4;
+    pattern.beats = 4 + seed % 3;
+    pattern.tags << "test" << QString("seed %1").arg(seed);
+    for (int r = 0; r < 8; ++r) {
+        QStringList row;
+        for (int c = 0; c < PATTERN_COLUMNS; ++c)
+            row << QString::number((seed + r * PATTERN_COLUMNS + c) % 128);
+        pattern.keys << 35 + r;
+        pattern.rows << row;
+    }
+    return pattern;
+}
+
+Pattern PatternLibraryTest::changeRow(const Pattern& pattern, int row)
+{
+    Pattern changed = pattern;
+    changed.rows[row][0] = QString::number((pattern.rows[row][0].toInt() + 1) % 128);
+    return changed;
+}
+
+void PatternLibraryTest::compare(PatternLibrary& library, const Pattern& expected)
+{
+    Pattern pattern;
+    QVERIFY2(library.load(expected.name, pattern), qPrintable(expected.name));
+    QCOMPARE(pattern.name, expected.name);
+    QCOMPARE(pattern.figure, expected.figure);
+    QCOMPARE(pattern.beats, expected.beats);
+    QCOMPARE(pattern.bars, expected.bars);
+    QCOMPARE(pattern.tags, expected.tags);
+    QCOMPARE(pattern.keys, expected.keys);
+    QCOMPARE(pattern.rows, expected.rows);
+    PatternInfo info = library.info(expected.name);
+    QCOMPARE(info.beats, expected.beats);
+    QCOMPARE(info.rows, expected.keys.count());
+    QCOMPARE(info.tags, expected.tags);
+}
+
+void PatternLibraryTest::save()
+{
+    Pattern first = makePattern("First", 1);
+    Pattern second = makePattern("Second", 2);
+    {
+        PatternLibrary library(m_dir->path());
+        QVERIFY(library.open());
+        QVERIFY(library.isCreated());
+        QVERIFY(library.save(first));
+        QVERIFY(library.save(second));
+        QVERIFY(library.save(makePattern("First", 3)));
+        QVERIFY(library.save(first));
+        QCOMPARE(library.count(), 2);
+        compare(library, first);
+        compare(library, second);
+    }
+    PatternLibrary library(m_dir->path());
+    QVERIFY(library.open());
+    QVERIFY(!library.isCreated());
+    QCOMPARE(library.names(), QStringList() << "First" << "Second");
+    compare(library, first);
+    compare(library, second);
+}
+
+void PatternLibraryTest::journalSave()
+{
+    Pattern pattern = makePattern("Journal", 1);
+    Pattern changed = changeRow(pattern, 3);
+    {
+        PatternLibrary library(m_dir->path());
+        QVERIFY(library.open());
+        QVERIFY(library.save(pattern));
+        qint64 size = QFileInfo(dataFile()).size();
+        QVERIFY(library.save(changed, pattern));
+        // only the changed row is appended
+        qint64 appended = QFileInfo(dataFile()).size() - size;
+        QVERIFY(appended > 0);
+        QVERIFY(appended < PatternLibrary::serialize(changed).size());
+        compare(library, changed);
+        pattern = changed;
+        changed.tags << "more";
+        changed.keys << 50;
+        changed.rows << changed.rows.first();
+        changed.keys.removeAt(0);
+        changed.rows.removeAt(0);
+        QVERIFY(library.save(changed, pattern));
+        compare(library, changed);
+    }
+    PatternLibrary library(m_dir->path());
+    QVERIFY(library.open());
+    compare(library, changed);
+    QVERIFY(library.compact());
+    QCOMPARE(library.garbage(), qint64(0));
+    compare(library, changed);
+}
+
+void PatternLibraryTest::remove()
+{
+    Pattern kept = makePattern("Kept", 1);
+    {
+        PatternLibrary library(m_dir->path());
+        QVERIFY(library.open());
+        QVERIFY(library.save(kept));
+        QVERIFY(library.save(makePattern("Removed", 2)));
+        QVERIFY(library.remove("Removed"));
+        QVERIFY(!library.remove("Removed"));
+        QVERIFY(!library.remove("Missing"));
+        QVERIFY(!library.contains("Removed"));
+        QVERIFY(library.garbage() > 0);
+    }
+    PatternLibrary library(m_dir->path());
+    QVERIFY(library.open());
+    QCOMPARE(library.names(), QStringList() << "Kept");
+    compare(library, kept);
+    Pattern pattern;
+    QVERIFY(!library.load("Removed", pattern));
+}
+
+void PatternLibraryTest::missingIndex()
+{
+    Pattern first = makePattern("First", 1);
+    Pattern second = changeRow(makePattern("Second", 2), 5);
+    {
+        PatternLibrary library(m_dir->path());
+        QVERIFY(library.open());
+        QVERIFY(library.save(first));
+        QVERIFY(library.save(makePattern("Second", 2)));
+        QVERIFY(library.save(second, makePattern("Second", 2)));
+    }
+    QVERIFY(QFile::exists(indexFile()));
+    QVERIFY(QFile::remove(indexFile()));
+    {
+        PatternLibrary library(m_dir->path());
+        QVERIFY(library.open());
+        QCOMPARE(library.count(), 2);
+        compare(library, first);
+        compare(library, second);
+    }
+    QVERIFY(QFile::exists(indexFile()));
+}
+
+void PatternLibraryTest::staleIndex()
+{
+    Pattern first = makePattern("First", 1);
+    Pattern changed = changeRow(first, 2);
+    Pattern third = makePattern("Third", 3);
+    {
+        PatternLibrary library(m_dir->path());
+        QVERIFY(library.open());
+        QVERIFY(library.save(first));
+        QVERIFY(library.save(makePattern("Second", 2)));
+    }
+    const QString oldIndex = indexFile() + ".old";
+    QVERIFY(QFile::copy(indexFile(), oldIndex));
+    {
+        PatternLibrary library(m_dir->path());
+        QVERIFY(library.open());
+        QVERIFY(library.save(changed, first));
+        QVERIFY(library.remove("Second"));
+        QVERIFY(library.save(third));
+    }
+    // the index of the first session only knows the records before these
+    QVERIFY(QFile::remove(indexFile()));
+    QVERIFY(QFile::rename(oldIndex, indexFile()));
+    PatternLibrary library(m_dir->path());
+    QVERIFY(library.open());
+    QCOMPARE(library.names(), QStringList() << "First" << "Third");
+    compare(library, changed);
+    compare(library, third);
+}
+
+void PatternLibraryTest::truncatedRecord()
+{
+    Pattern first = makePattern("First", 1);
+    Pattern third = makePattern("Third", 3);
+    {
+        PatternLibrary library(m_dir->path());
+        QVERIFY(library.open());
+        QVERIFY(library.save(first));
+        QVERIFY(library.save(makePattern("Second", 2)));
+    }
+    // an interrupted write of the last record
+    QFile file(dataFile());
+    QVERIFY(file.resize(file.size() - 10));
+    {
+        PatternLibrary library(m_dir->path());
+        QVERIFY(library.open());
+        QCOMPARE(library.names(), QStringList() << "First");
+        compare(library, first);
+        QVERIFY(library.save(third));
+        compare(library, third);
+    }
+    QVERIFY(QFile::remove(indexFile()));
+    PatternLibrary library(m_dir->path());
+    QVERIFY(library.open());
+    QCOMPARE(library.names(), QStringList() << "First" << "Third");
+    compare(library, first);
+    compare(library, third);
+}
+
+void PatternLibraryTest::readOnly()
+{
+    {
+        PatternLibrary library(m_dir->path());
+        QVERIFY(!library.open(PatternLibrary::ReadOnly));
+        QVERIFY(!QFile::exists(dataFile()));
+        QVERIFY(library.open());
+        QVERIFY(library.save(makePattern("First", 1)));
+    }
+    QVERIFY(QFile::remove(indexFile()));
+    QByteArray data;
+    {
+        QFile file(dataFile());
+        QVERIFY(file.open(QIODevice::ReadOnly));
+        data = file.readAll();
+    }
+    PatternLibrary library(m_dir->path());
+    QVERIFY(library.open(PatternLibrary::ReadOnly));
+    compare(library, makePattern("First", 1));
+    QVERIFY(!library.save(makePattern("Second", 2)));
+    QVERIFY(!library.remove("First"));
+    QVERIFY(!library.compact());
+    library.close();
+    QVERIFY(!QFile::exists(indexFile()));
+    QFile file(dataFile());
+    QVERIFY(file.open(QIODevice::ReadOnly));
+    QCOMPARE(file.readAll(), data);
+}
+
+/**
+ * Saves a new pattern and the changes to another one after compact() has
+ * copied the index, and before it replaces the data file. Compacting on
+ * another thread makes the timing uncertain, so this is tried until the
+ * garbage, only reset by the replacement, is still there after saving.
+ */
+void PatternLibraryTest::compactWhileSaving()
+{
+    PatternLibrary library(m_dir->path());
+    QVERIFY(library.open());
+    QList<Pattern> expected;
+    QList<Pattern> added;
+    bool interleaved = false;
+    for (int attempt = 0; attempt < COMPACT_ATTEMPTS && !interleaved; ++attempt) {
+        // superseded records taking most of the file
+        for (int seed = 0; seed < 3; ++seed) {
+            for (int i = 0; i < COMPACT_PATTERNS; ++i)
+                QVERIFY(library.save(makePattern(QString("Pattern %1").arg(i), attempt * 3 + seed)));
+        }
+        QVERIFY(library.needsCompaction());
+        Pattern before;
+        QVERIFY(library.load("Pattern 0", before));
+        Pattern changed = changeRow(before, 7);
+        added << makePattern(QString("Added %1").arg(attempt), attempt);
+
+        CompactThread thread(library);
+        thread.start();
+        while (!thread.isFinished() && (library.needsCompaction() || library.garbage() == 0))
+            QThread::yieldCurrentThread();
+        QVERIFY(library.save(added.last()));
+        QVERIFY(library.save(changed, before));
+        interleaved = library.garbage() > 0;
+        QVERIFY(thread.wait());
+        QVERIFY(thread.compacted());
+        QCOMPARE(library.garbage(), qint64(0));
+
+        expected = added;
+        expected << changed;
+        for (int i = 1; i < COMPACT_PATTERNS; ++i)
+            expected << makePattern(QString("Pattern %1").arg(i), attempt * 3 + 2);
+        foreach(const Pattern& pattern, expected)
+            compare(library, pattern);
+    }
+    QVERIFY2(interleaved, "no save happened while compacting");
+    library.close();
+
+    QVERIFY(QFile::remove(indexFile()));
+    PatternLibrary reopened(m_dir->path());
+    QVERIFY(reopened.open());
+    QCOMPARE(reopened.count(), COMPACT_PATTERNS + added.count());
+    foreach(const Pattern& pattern, expected)
+        compare(reopened, pattern);
+}
+
+QTEST_GUILESS_MAIN(PatternLibraryTest)
+
+#include "patternlibrarytest.moc"
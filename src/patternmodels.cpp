@@ -0,0 +1,155 @@
+/***************************************************************************
+ *   KMetronome - ALSA Sequencer based MIDI metronome                      *
+ *   Copyright (C) 2005-2021 Pedro Lopez-Cabanillas <plcl@users.sf.net>    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
+ ***************************************************************************/
+
+#include <algorithm>
+#include <QAbstractItemView>
+#include <QComboBox>
+#include <QLineEdit>
+#include "patternmodels.h"
+
+static bool lessByName(const PatternInfo& a, const PatternInfo& b)
+{
+    return a.name < b.name;
+}
+
+PatternListModel::PatternListModel(QObject *parent)
+    : QAbstractListModel(parent),
+    m_library(nullptr),
+    m_fetched(false)
+{ }
+
+void PatternListModel::setLibrary(const PatternLibrary* library)
+{
+    m_library = library;
+    refresh();
+}
+
+void PatternListModel::setLeadingItem(const QString& text)
+{
+    m_leadingItem = text;
+    refresh();
+}
+
+void PatternListModel::setFilter(const QString& text)
+{
+    m_filter = text;
+    refresh();
+}
+
+void PatternListModel::refresh()
+{
+    beginResetModel();
+    m_patterns.clear();
+    m_fetched = false;
+    endResetModel();
+}
+
+void PatternListModel::fetchPatterns() const
+{
+    if (!m_fetched && m_library != nullptr) {
+        m_patterns = m_library->search(m_filter);
+        m_fetched = true;
+    }
+}
+
+int PatternListModel::rowCount(const QModelIndex &parent) const
+{
+    if (parent.isValid())
+        return 0;
+    fetchPatterns();
+    return leading() + m_patterns.count();
+}
+
+QVariant PatternListModel::data(const QModelIndex &index, int role) const
+{
+    if (!index.isValid())
+        return QVariant();
+    int row = index.row() - leading();
+    if (row < 0) {
+        if (role == Qt::DisplayRole || role == Qt::EditRole)
+            return m_leadingItem;
+        return QVariant();
+    }
+    fetchPatterns();
+    if (row >= m_patterns.count())
+        return QVariant();
+    const PatternInfo& info = m_patterns.at(row);
+    if (role == Qt::DisplayRole || role == Qt::EditRole)
+        return info.name;
+    if (role == Qt::ToolTipRole) {
+        QString tip = tr("%1, %n row(s)", "pattern time signature and rows", info.rows)
+                        .arg(info.timeSignature());
+        if (info.bars > 1)
+            tip += ", " + tr("%n bar(s)", "pattern length", info.bars);
+        if (!info.tags.isEmpty())
+            tip += "\n" + tr("Tags: %1").arg(info.tags.join(", "));
+        return tip;
+    }
+    return QVariant();
+}
+
+QString PatternListModel::nameAt(int row) const
+{
+    fetchPatterns();
+    row -= leading();
+    if (row < 0 || row >= m_patterns.count())
+        return QString();
+    return m_patterns.at(row).name;
+}
+
+int PatternListModel::indexOf(const QString& name) const
+{
+    fetchPatterns();
+    PatternInfo key;
+    key.name = name;
+    QList<PatternInfo>::ConstIterator it = std::lower_bound(m_patterns.constBegin(), m_patterns.constEnd(), key, lessByName);
+    if (it == m_patterns.constEnd() || it->name != name)
+        return -1;
+    return leading() + int(it - m_patterns.constBegin());
+}
+
+PatternCompleter::PatternCompleter(QComboBox* combo, const PatternLibrary* library)
+    : QCompleter(combo),
+    m_model(new PatternListModel(this))
+{
+    m_model->setLibrary(library);
+    setModel(m_model);
+    setCompletionMode(QCompleter::UnfilteredPopupCompletion);
+    setMaxVisibleItems(combo->maxVisibleItems());
+    combo->setEditable(true);
+    combo->setInsertPolicy(QComboBox::NoInsert);
+    combo->lineEdit()->setCompleter(this);
+    connect(combo->lineEdit(), &QLineEdit::textEdited, this, &PatternCompleter::search);
+    connect(this, QOverload<const QString&>::of(&QCompleter::activated),
+            this, &PatternCompleter::patternSelected);
+}
+
+void PatternCompleter::setLibrary(const PatternLibrary* library)
+{
+    m_model->setLibrary(library);
+}
+
+void PatternCompleter::search(const QString& text)
+{
+    m_model->setFilter(text);
+    if (text.isEmpty() || m_model->rowCount() == 0) {
+        popup()->hide();
+    } else {
+        complete();
+    }
+}
@@ -0,0 +1,88 @@
+/***************************************************************************
+ *   KMetronome - ALSA Sequencer based MIDI metronome                      *
+ *   Copyright (C) 2005-2021 Pedro Lopez-Cabanillas <plcl@users.sf.net>    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
+ ***************************************************************************/
+
+#ifndef PATTERNMODELS_H
+#define PATTERNMODELS_H
+
+#include <QtCore/QAbstractListModel>
+#include <QtCore/QList>
+#include <QtWidgets/QCompleter>
+#include "patternlibrary.h"
+
+class QComboBox;
+
+/**
+ * List model over the index of a PatternLibrary, optionally restricted to
+ * the patterns matching a filter text. The display role is the pattern
+ * name and the tool tip describes it; no pattern body is ever read. An
+ * optional leading item, like "Automatic", is not a pattern and is never
+ * filtered out.
+ */
+class PatternListModel : public QAbstractListModel
+{
+    Q_OBJECT
+
+public:
+    PatternListModel(QObject *parent = nullptr);
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+
+    void setLibrary(const PatternLibrary* library);
+    void setLeadingItem(const QString& text);
+    void setFilter(const QString& text);
+    void refresh();
+    QString nameAt(int row) const;
+    int indexOf(const QString& name) const;
+
+private:
+    void fetchPatterns() const;
+    int leading() const { return m_leadingItem.isEmpty() ? 0 : 1; }
+
+    const PatternLibrary* m_library;
+    QString m_leadingItem;
+    QString m_filter;
+    mutable QList<PatternInfo> m_patterns;
+    mutable bool m_fetched;
+};
+
+/**
+ * Incremental search for the pattern combo boxes: while typing in the
+ * combo box, a popup lists the patterns whose name or tags contain the
+ * text, and choosing one emits patternSelected().
+ */
+class PatternCompleter : public QCompleter
+{
+    Q_OBJECT
+
+public:
+    PatternCompleter(QComboBox* combo, const PatternLibrary* library);
+
+    void setLibrary(const PatternLibrary* library);
+
+Q_SIGNALS:
+    void patternSelected(const QString& name);
+
+private Q_SLOTS:
+    void search(const QString& text);
+
+private:
+    PatternListModel* m_model;
+};
+
+#endif /* PATTERNMODELS_H */
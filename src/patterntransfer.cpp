@@ -0,0 +1,565 @@
+/***************************************************************************
+ *   KMetronome - ALSA Sequencer based MIDI metronome                      *
+ *   Copyright (C) 2005-2021 Pedro Lopez-Cabanillas <plcl@users.sf.net>    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
+ ***************************************************************************/
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMap>
+#include <QRunnable>
+#include <QSaveFile>
+#include <QThreadPool>
+#include "patterntransfer.h"
+#include "smfpatternreader.h"
+
+/* Progress of imports is reported in thousandths of the file size */
+const int TRANSFER_PROGRESS_STEPS(1000);
+/* QSettings stores the keys outside of any group in this one */
+const QString INI_GENERAL_GROUP("General");
+
+static int hexValue(QChar c)
+{
+    ushort u = c.unicode();
+    if (u >= '0' && u <= '9')
+        return u - '0';
+    if (u >= 'a' && u <= 'f')
+        return u - 'a' + 10;
+    if (u >= 'A' && u <= 'F')
+        return u - 'A' + 10;
+    return -1;
+}
+
+static QByteArray hexCode(ushort u, int digits)
+{
+    return QByteArray::number(u, 16).rightJustified(digits, '0').toUpper();
+}
+
+static void chopLineEnd(QByteArray& line)
+{
+    while (line.endsWith('\n') || line.endsWith('\r'))
+        line.chop(1);
+}
+
+/* Group and key names: "\" stands for "/", "%XX" and "%UXXXX" for other characters */
+static QString unescapedKey(const QByteArray& raw)
+{
+    QString key = QString::fromUtf8(raw);
+    QString result;
+    result.reserve(key.size());
+    int i = 0;
+    while (i < key.size()) {
+        QChar c = key.at(i);
+        if (c == QLatin1Char('\\')) {
+            result += QLatin1Char('/');
+            ++i;
+        } else if (c == QLatin1Char('%')) {
+            int start = i + 1;
+            int digits = 2;
+            if (start < key.size() && key.at(start) == QLatin1Char('U')) {
+                ++start;
+                digits = 4;
+            }
+            bool ok = (start + digits <= key.size());
+            ushort code = 0;
+            for (int j = start; ok && j < start + digits; ++j) {
+                int v = hexValue(key.at(j));
+                ok = (v >= 0);
+                code = code * 16 + v;
+            }
+            if (ok) {
+                result += QChar(code);
+                i = start + digits;
+            } else {
+                result += c;
+                ++i;
+            }
+        } else {
+            result += c;
+            ++i;
+        }
+    }
+    return result;
+}
+
+static QByteArray escapedKey(const QString& key)
+{
+    QByteArray result;
+    result.reserve(key.size());
+    foreach(const QChar& c, key) {
+        ushort u = c.unicode();
+        if (u == '/') {
+            result += '\\';
+        } else if ((u >= 'a' && u <= 'z') || (u >= 'A' && u <= 'Z') ||
+                   (u >= '0' && u <= '9') || u == '_' || u == '-' || u == '.') {
+            result += char(u);
+        } else if (u <= 0xFF) {
+            result += '%' + hexCode(u, 2);
+        } else {
+            result += "%U" + hexCode(u, 4);
+        }
+    }
+    return result;
+}
+
+/*
+ * Values are comma separated lists of strings, which may be quoted and
+ * contain C style escapes; unquoted white space around the items is
+ * dropped, and an unquoted ";" starts a comment.
+ */
+static QStringList unescapedList(const QString& text)
+{
+    QStringList result;
+    if (text == QLatin1String("@Invalid()"))
+        return result;
+    const QString value = text.startsWith(QLatin1String("@@")) ? text.mid(1) : text;
+    QString current;
+    int keep = 0;
+    bool inQuotes = false;
+    int i = 0;
+    while (i < value.size()) {
+        QChar c = value.at(i++);
+        if (c == QLatin1Char('"')) {
+            inQuotes = !inQuotes;
+            keep = current.size();
+        } else if (c == QLatin1Char('\\') && i < value.size()) {
+            QChar e = value.at(i++);
+            switch (e.unicode()) {
+            case 'a': current += QLatin1Char('\a'); break;
+            case 'b': current += QLatin1Char('\b'); break;
+            case 'f': current += QLatin1Char('\f'); break;
+            case 'n': current += QLatin1Char('\n'); break;
+            case 'r': current += QLatin1Char('\r'); break;
+            case 't': current += QLatin1Char('\t'); break;
+            case 'v': current += QLatin1Char('\v'); break;
+            case 'x': {
+                ushort code = 0;
+                while (i < value.size() && hexValue(value.at(i)) >= 0)
+                    code = code * 16 + hexValue(value.at(i++));
+                current += QChar(code);
+                break;
+            }
+            default:
+                if (e >= QLatin1Char('0') && e <= QLatin1Char('7')) {
+                    ushort code = e.unicode() - '0';
+                    for (int n = 0; n < 2 && i < value.size() && value.at(i) >= QLatin1Char('0')
+                         && value.at(i) <= QLatin1Char('7'); ++n)
+                        code = code * 8 + (value.at(i++).unicode() - '0');
+                    current += QChar(code);
+                } else {
+                    current += e;
+                }
+            }
+            keep = current.size();
+        } else if (!inQuotes && c == QLatin1Char(',')) {
+            current.truncate(keep);
+            result += current;
+            current.clear();
+            keep = 0;
+        } else if (!inQuotes && c == QLatin1Char(';')) {
+            break;
+        } else if (!inQuotes && c.isSpace()) {
+            if (!current.isEmpty())
+                current += c;
+        } else {
+            current += c;
+            keep = current.size();
+        }
+    }
+    current.truncate(keep);
+    result += current;
+    return result;
+}
+
+static QByteArray escapedString(const QString& str)
+{
+    QByteArray body;
+    bool quote = !str.isEmpty() && (str.at(0).isSpace() || str.at(str.size() - 1).isSpace());
+    bool escapeNextIfDigit = false;
+    if (str.startsWith(QLatin1Char('@')))
+        body += '@';
+    foreach(const QChar& c, str) {
+        ushort u = c.unicode();
+        if (u == ';' || u == ',' || u == '=')
+            quote = true;
+        if (escapeNextIfDigit && hexValue(c) >= 0) {
+            body += "\\x" + hexCode(u, 4);
+            continue;
+        }
+        escapeNextIfDigit = false;
+        switch (u) {
+        case '\n': body += "\\n"; break;
+        case '\r': body += "\\r"; break;
+        case '\t': body += "\\t"; break;
+        case '"': body += "\\\""; break;
+        case '\\': body += "\\\\"; break;
+        default:
+            if (u < 0x20 || u >= 0x7F) {
+                body += "\\x" + hexCode(u, 4);
+                escapeNextIfDigit = true;
+            } else {
+                body += char(u);
+            }
+        }
+    }
+    return quote ? '"' + body + '"' : body;
+}
+
+static QByteArray escapedList(const QStringList& list)
+{
+    if (list.isEmpty())
+        return "@Invalid()";
+    QByteArray result;
+    for (int i = 0; i < list.count(); ++i) {
+        if (i > 0)
+            result += ", ";
+        result += escapedString(list.at(i));
+    }
+    return result;
+}
+
+PatternFileReader::PatternFileReader(QIODevice* device) :
+    m_device(device),
+    m_hasPending(false)
+{ }
+
+/* A logical line: a line ending with "\" continues in the next one */
+bool PatternFileReader::readLine(QByteArray& line)
+{
+    if (m_device->atEnd())
+        return false;
+    line = m_device->readLine();
+    chopLineEnd(line);
+    while (line.endsWith('\\') && !m_device->atEnd()) {
+        QByteArray more = m_device->readLine();
+        chopLineEnd(more);
+        line.chop(1);
+        line += more;
+    }
+    return true;
+}
+
+/**
+ * Reads the next pattern group. The header of the following group is
+ * consumed and kept for the next call. Returns false at the end.
+ */
+bool PatternFileReader::next(Pattern& pattern)
+{
+    QByteArray line;
+    QMap<QString, QStringList> rows;
+    bool inGroup = m_hasPending;
+    pattern = Pattern();
+    pattern.name = m_pending;
+    m_hasPending = false;
+    while (readLine(line)) {
+        QByteArray trimmed = line.trimmed();
+        if (trimmed.isEmpty() || trimmed.startsWith(';') || trimmed.startsWith('#'))
+            continue;
+        if (trimmed.startsWith('[')) {
+            int end = trimmed.lastIndexOf(']');
+            QString name = unescapedKey(trimmed.mid(1, (end > 0 ? end : trimmed.size()) - 1));
+            if (inGroup) {
+                m_pending = name;
+                m_hasPending = true;
+                break;
+            }
+            pattern.name = name;
+            inGroup = true;
+            continue;
+        }
+        int eq = trimmed.indexOf('=');
+        if (!inGroup || eq < 1)
+            continue;
+        QString key = unescapedKey(trimmed.left(eq).trimmed());
+        QStringList values = unescapedList(QString::fromUtf8(trimmed.mid(eq + 1)));
+        if (key == QSTR_FIGURE) {
+            pattern.figure = values.value(0).toInt();
+        } else if (key == QSTR_BEATS) {
+            pattern.beats = values.value(0).toInt();
+        } else if (key == QSTR_BARS) {
+            pattern.bars = values.value(0).toInt();
+        } else if (key == QSTR_TAGS) {
+            values.removeAll(QString());
+            pattern.tags = values;
+        } else {
+            bool isNumber;
+            key.toInt(&isNumber);
+            if (isNumber)
+                rows.insert(key, values);
+        }
+    }
+    if (!inGroup)
+        return false;
+    if (pattern.name == INI_GENERAL_GROUP)
+        return next(pattern);
+    if (pattern.name == '%' + INI_GENERAL_GROUP)
+        pattern.name = INI_GENERAL_GROUP;
+    QMap<QString, QStringList>::ConstIterator it;
+    for (it = rows.constBegin(); it != rows.constEnd(); ++it) {
+        pattern.keys.append(it.key().toInt());
+        pattern.rows.append(it.value());
+    }
+    return true;
+}
+
+PatternFileWriter::PatternFileWriter(QIODevice* device) :
+    m_device(device),
+    m_first(true)
+{ }
+
+bool PatternFileWriter::write(const Pattern& pattern)
+{
+    QByteArray out;
+    if (!m_first)
+        out += '\n';
+    m_first = false;
+    if (pattern.name == INI_GENERAL_GROUP)
+        out += "[%" + INI_GENERAL_GROUP.toLatin1() + "]\n";
+    else
+        out += '[' + escapedKey(pattern.name) + "]\n";
+    for (int r = 0; r < pattern.keys.count() && r < pattern.rows.count(); ++r) {
+        out += QByteArray::number(pattern.keys.at(r)) + '=' + escapedList(pattern.rows.at(r)) + '\n';
+    }
+    if (pattern.bars != PATTERN_BARS)
+        out += QSTR_BARS.toLatin1() + '=' + QByteArray::number(pattern.bars) + '\n';
+    out += QSTR_BEATS.toLatin1() + '=' + QByteArray::number(pattern.beats) + '\n';
+    out += QSTR_FIGURE.toLatin1() + '=' + QByteArray::number(pattern.figure) + '\n';
+    if (!pattern.tags.isEmpty())
+        out += QSTR_TAGS.toLatin1() + '=' + escapedList(pattern.tags) + '\n';
+    return m_device->write(out) == out.size();
+}
+
+/**
+ * Reads one MIDI file on a pool thread and hands the pattern to the
+ * transfer to be stored.
+ */
+class PatternTransfer::MidiFileTask : public QRunnable
+{
+public:
+    MidiFileTask(PatternTransfer* transfer, const QString& fileName) :
+        m_transfer(transfer),
+        m_fileName(fileName)
+    { }
+
+    void run() override
+    {
+        if (m_transfer->isCancelled())
+            return;
+        QFile file(m_fileName);
+        Pattern pattern;
+        QString error;
+        if (!file.open(QIODevice::ReadOnly)) {
+            error = file.errorString();
+        } else {
+            SmfPatternReader reader(&file);
+            if (!reader.read(m_transfer->m_figure, pattern))
+                error = reader.errorString();
+        }
+        QMutexLocker locker(&m_transfer->m_mutex);
+        if (error.isEmpty()) {
+            pattern.name = QFileInfo(m_fileName).completeBaseName();
+            if (!m_transfer->store(pattern))
+                m_transfer->cancel();
+        } else if (m_transfer->m_total == 1) {
+            m_transfer->m_error = error;
+        } else {
+            qWarning("Failure importing %s: %s", m_fileName.toUtf8().constData(),
+                     error.toUtf8().constData());
+            ++m_transfer->m_skipped;
+        }
+        int done = m_transfer->m_transferred + m_transfer->m_skipped;
+        m_transfer->report(done, m_transfer->m_total);
+    }
+
+private:
+    PatternTransfer* m_transfer;
+    QString m_fileName;
+};
+
+PatternTransfer::PatternTransfer(PatternLibrary* library, QObject* parent) :
+    QThread(parent),
+    m_library(library),
+    m_policy(OverwriteExisting),
+    m_figure(PATTERN_FIGURE),
+    m_import(true),
+    m_midi(false),
+    m_cancel(0),
+    m_transferred(0),
+    m_skipped(0),
+    m_total(0),
+    m_reported(-1)
+{ }
+
+PatternTransfer::~PatternTransfer()
+{
+    cancel();
+    wait();
+}
+
+void PatternTransfer::setImport(const QString& path, ConflictPolicy policy)
+{
+    m_path = path;
+    m_policy = policy;
+    m_import = true;
+    m_midi = false;
+}
+
+/**
+ * Imports a MIDI file, or all the MIDI files of a directory, quantized
+ * to the figure.
+ */
+void PatternTransfer::setMidiImport(const QString& path, int figure, ConflictPolicy policy)
+{
+    m_path = path;
+    m_figure = figure;
+    m_policy = policy;
+    m_import = true;
+    m_midi = true;
+}
+
+void PatternTransfer::setExport(const QString& path)
+{
+    m_path = path;
+    m_import = false;
+}
+
+/**
+ * Runs the transfer in the calling thread. Returns false if it failed or
+ * was cancelled; patterns already imported are kept in both cases.
+ */
+bool PatternTransfer::execute()
+{
+    m_transferred = 0;
+    m_skipped = 0;
+    m_total = 0;
+    m_reported = -1;
+    m_error.clear();
+    if (!m_import)
+        return exportPatterns();
+    return m_midi ? importMidiFiles() : importPatterns();
+}
+
+void PatternTransfer::run()
+{
+    execute();
+}
+
+void PatternTransfer::report(int done, int total)
+{
+    if (done != m_reported) {
+        m_reported = done;
+        emit progress(done, total);
+    }
+}
+
+bool PatternTransfer::importPatterns()
+{
+    QFile file(m_path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        m_error = file.errorString();
+        return false;
+    }
+    const qint64 size = qMax(file.size(), qint64(1));
+    PatternFileReader reader(&file);
+    Pattern pattern;
+    while (!isCancelled() && reader.next(pattern)) {
+        if (!store(pattern))
+            return false;
+        report(int(file.pos() * TRANSFER_PROGRESS_STEPS / size), TRANSFER_PROGRESS_STEPS);
+    }
+    return !isCancelled();
+}
+
+/**
+ * Saves an imported pattern according to the conflict policy. Returns
+ * false only when the library fails.
+ */
+bool PatternTransfer::store(Pattern& pattern)
+{
+    if (m_library->contains(pattern.name)) {
+        if (m_policy == SkipExisting) {
+            ++m_skipped;
+            return true;
+        }
+        if (m_policy == RenameImported)
+            pattern.name = m_library->uniqueName(pattern.name);
+    }
+    if (!m_library->save(pattern)) {
+        m_error = tr("Failure saving the pattern \"%1\"").arg(pattern.name);
+        return false;
+    }
+    ++m_transferred;
+    return true;
+}
+
+bool PatternTransfer::importMidiFiles()
+{
+    QStringList files;
+    QFileInfo info(m_path);
+    if (info.isDir()) {
+        QFileInfoList entries = QDir(m_path).entryInfoList(QStringList() << "*.mid" << "*.midi",
+            QDir::Files | QDir::Readable, QDir::Name | QDir::IgnoreCase);
+        foreach(const QFileInfo& f, entries)
+            files << f.absoluteFilePath();
+    } else {
+        files << m_path;
+    }
+    m_total = files.count();
+    QThreadPool pool;
+    pool.setMaxThreadCount(QThread::idealThreadCount());
+    foreach(const QString& fileName, files)
+        pool.start(new MidiFileTask(this, fileName));
+    pool.waitForDone();
+    return m_error.isEmpty() && !isCancelled();
+}
+
+/**
+ * The destination file is replaced only when every pattern has been
+ * written; a failed or cancelled export leaves it untouched.
+ */
+bool PatternTransfer::exportPatterns()
+{
+    QSaveFile file(m_path);
+    if (!file.open(QIODevice::WriteOnly)) {
+        m_error = file.errorString();
+        return false;
+    }
+    PatternFileWriter writer(&file);
+    const QStringList names = m_library->names();
+    for (int i = 0; i < names.count() && !isCancelled(); ++i) {
+        Pattern pattern;
+        if (!m_library->load(names.at(i), pattern)) {
+            ++m_skipped;
+            continue;
+        }
+        if (!writer.write(pattern)) {
+            m_error = file.errorString();
+            file.cancelWriting();
+            return false;
+        }
+        ++m_transferred;
+        report(i + 1, names.count());
+    }
+    if (isCancelled()) {
+        file.cancelWriting();
+        return false;
+    }
+    if (!file.commit()) {
+        m_error = file.errorString();
+        return false;
+    }
+    return true;
+}
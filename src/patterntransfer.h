@@ -0,0 +1,138 @@
+/***************************************************************************
+ *   KMetronome - ALSA Sequencer based MIDI metronome                      *
+ *   Copyright (C) 2005-2021 Pedro Lopez-Cabanillas <plcl@users.sf.net>    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
+ ***************************************************************************/
+
+#ifndef PATTERNTRANSFER_H
+#define PATTERNTRANSFER_H
+
+#include <QAtomicInt>
+#include <QByteArray>
+#include <QMutex>
+#include <QString>
+#include <QThread>
+#include "patternlibrary.h"
+
+class QIODevice;
+
+/**
+ * Reads the patterns of a .pat file one at a time.
+ *
+ * Pattern files use the INI layout of QSettings: a "[name]" group for
+ * each pattern, with the Figure, Beats and Tags keys, and a key for each
+ * percussion note whose value is the comma separated list of cells. Group
+ * names and values are unescaped like QSettings does, so files written by
+ * older versions are read unchanged, but only one group is kept in memory.
+ */
+class PatternFileReader
+{
+public:
+    explicit PatternFileReader(QIODevice* device);
+    bool next(Pattern& pattern);
+
+private:
+    bool readLine(QByteArray& line);
+
+    QIODevice* m_device;
+    QString m_pending;
+    bool m_hasPending;
+};
+
+/**
+ * Writes patterns to a .pat file one at a time, in the same layout and
+ * with the same escaping that QSettings uses.
+ */
+class PatternFileWriter
+{
+public:
+    explicit PatternFileWriter(QIODevice* device);
+    bool write(const Pattern& pattern);
+
+private:
+    QIODevice* m_device;
+    bool m_first;
+};
+
+/**
+ * Imports a .pat file into a PatternLibrary, or exports the library to a
+ * .pat file, streaming the patterns one by one. The transfer runs on its
+ * own thread when started, or in the calling thread with execute(), and
+ * reports its progress as a fraction done/total.
+ *
+ * Standard MIDI Files are imported as one pattern each, named after the
+ * file, from a single file or from every .mid file of a directory. The
+ * files are read by a thread pool, and the patterns are saved as soon as
+ * each one is ready; files that can't be read are counted as skipped.
+ *
+ * Imported patterns whose name already exists in the library are skipped,
+ * overwritten, or stored under a new name, according to the policy.
+ */
+class PatternTransfer : public QThread
+{
+    Q_OBJECT
+
+public:
+    enum ConflictPolicy {
+        SkipExisting,
+        OverwriteExisting,
+        RenameImported
+    };
+
+    explicit PatternTransfer(PatternLibrary* library, QObject* parent = nullptr);
+    virtual ~PatternTransfer();
+
+    void setImport(const QString& path, ConflictPolicy policy);
+    void setMidiImport(const QString& path, int figure, ConflictPolicy policy);
+    void setExport(const QString& path);
+    bool isImport() const { return m_import; }
+    bool execute();
+    void cancel() { m_cancel.storeRelease(1); }
+    bool isCancelled() const { return m_cancel.loadAcquire() != 0; }
+    int transferred() const { return m_transferred; }
+    int skipped() const { return m_skipped; }
+    QString errorString() const { return m_error; }
+
+Q_SIGNALS:
+    void progress(int done, int total);
+
+protected:
+    void run() override;
+
+private:
+    class MidiFileTask;
+
+    bool importPatterns();
+    bool importMidiFiles();
+    bool exportPatterns();
+    bool store(Pattern& pattern);
+    void report(int done, int total);
+
+    PatternLibrary* m_library;
+    QString m_path;
+    ConflictPolicy m_policy;
+    int m_figure;
+    bool m_import;
+    bool m_midi;
+    QMutex m_mutex;
+    QAtomicInt m_cancel;
+    int m_transferred;
+    int m_skipped;
+    int m_total;
+    int m_reported;
+    QString m_error;
+};
+
+#endif // PATTERNTRANSFER_H
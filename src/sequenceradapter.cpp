@@ -17,8 +17,13 @@
  ***************************************************************************/
 
 #include "sequenceradapter.h"
+#include "arrangement.h"
+#include "audioclickengine.h"
+#include "compiledpattern.h"
 #include "defs.h"
 #include "drumgridmodel.h"
+#include "songtimeline.h"
+#include "startuptrace.h"
 #include <drumstick/alsaqueue.h>
 #include <drumstick/alsaevent.h>
 #include <QStringList>
@@ -40,23 +45,26 @@ SequencerAdapter::SequencerAdapter(QObject *parent) :
     m_instrument(METRONOME_INSTRUMENT),
     m_bank(METRONOME_BANK),
     m_program(METRONOME_PROGRAM),
-    m_weak_note(METRONOME_WEAK_NOTE),
-    m_strong_note(METRONOME_STRONG_NOTE),
-    m_weak_velocity(METRONOME_VELOCITY),
-    m_strong_velocity(METRONOME_VELOCITY),
     m_channel(METRONOME_CHANNEL),
     m_volume(METRONOME_VOLUME),
     m_balance(METRONOME_PAN),
-    m_resolution(METRONOME_RESOLUTION),
     m_bpm(TEMPO_DEFAULT),
-    m_ts_num(RHYTHM_TS_NUM),
-    m_ts_div(RHYTHM_TS_DEN),
     m_noteDuration(NOTE_DURATION),
     m_bankSelMethod(3),
+    m_patternDuration(0),
+    m_patternBar(0),
+    m_nextTick(0),
+    m_step(0),
+    m_stepBar(0),
+    m_songBar(1),
+    m_finishing(false),
     m_autoconnect(false),
     m_playing(false),
     m_useNoteOff(true),
     m_patternMode(false),
+    m_metricsEnabled(false),
+    m_jitterReset(true),
+    m_lastEchoTick(0),
     m_outputConn(""),
     m_inputConn("")
 {
@@ -97,6 +105,64 @@ SequencerAdapter::~SequencerAdapter()
     m_Client->close();
 }
 
+void SequencerAdapter::setModel(DrumGridModel* model)
+{
+    if (m_model != nullptr)
+        disconnect(m_model, nullptr, this, nullptr);
+    m_model = model;
+    if (m_model != nullptr)
+        connect(m_model, &DrumGridModel::patternChanged, this, &SequencerAdapter::compilePattern);
+    compilePattern();
+}
+
+/**
+ * Replaces the snapshot of the pattern read by the ALSA thread. The bars
+ * already scheduled are not touched; the next ones are expanded from the
+ * new snapshot.
+ */
+void SequencerAdapter::compilePattern()
+{
+    std::shared_ptr<const CompiledPattern> pattern;
+    if (m_model != nullptr)
+        pattern = std::make_shared<const CompiledPattern>(*m_model);
+    std::atomic_store(&m_compiled, pattern);
+}
+
+/**
+ * Plays an arrangement instead of the pattern or the automatic rhythm the
+ * next time the metronome is started, or not if it is null.
+ */
+void SequencerAdapter::setArrangement(const std::shared_ptr<CompiledArrangement>& arrangement)
+{
+    std::atomic_store(&m_arrangement, arrangement);
+}
+
+/**
+ * Plays the bars of a song timeline, with its tempo and meter changes,
+ * the next time the metronome is started, or not if it is null. The
+ * timeline must have the resolution of the queue.
+ */
+void SequencerAdapter::setTimeline(const std::shared_ptr<const SongTimeline>& timeline)
+{
+    std::atomic_store(&m_timeline, timeline);
+}
+
+/**
+ * Plays the clicks through the internal audio output instead of sending
+ * MIDI notes, or through MIDI again when the engine is null. The echo and
+ * tempo events are still scheduled on the queue, driving the display.
+ * Only to be changed while stopped; the ALSA input thread may still hold
+ * the previous engine for a while, which is released after it.
+ */
+void SequencerAdapter::setAudioEngine(const std::shared_ptr<AudioClickEngine>& engine)
+{
+    if (engine) {
+        engine->setVolume(m_volume);
+        engine->setBalance(m_balance);
+    }
+    std::atomic_store(&m_audio, engine);
+}
+
 void SequencerAdapter::retranslateUi()
 {
     NO_CONNECTION = tr("No connection");
@@ -215,9 +281,9 @@ void SequencerAdapter::metronome_note_output(SequencerEvent* ev)
 {
     NoteOnEvent* note = static_cast<NoteOnEvent*>(ev);
     if (note->getTag() == TAG_WEAK)
-        note->setVelocity(m_weak_velocity);
+        note->setVelocity(m_generator.weakVelocity());
     else if (note->getTag() == TAG_STRONG)
-        note->setVelocity(m_strong_velocity);
+        note->setVelocity(m_generator.strongVelocity());
     metronome_event_output(note);
 }
 
@@ -227,6 +293,7 @@ void SequencerAdapter::metronome_schedule_event(SequencerEvent* ev, int tick)
     ev->setDestination(m_clientId, m_inputPortId);
     ev->scheduleTick(m_queueId, tick, false);
     m_Client->outputDirect(ev);
+    SequencerMetrics::add(m_metrics.eventsScheduled);
 }
 
 void SequencerAdapter::metronome_note(int note, int vel, int tick, int tag)
@@ -249,79 +316,149 @@ void SequencerAdapter::metronome_echo(int tick, int ev_type)
 
 void SequencerAdapter::metronome_simple_pattern(int tick) 
 {
-	int j, t, duration, tag, note;
-	t = tick;
-	duration = m_resolution * 4 / m_ts_div;
-	for (j = 0; j < m_ts_num; j++) {
-	    note= ( j ? m_weak_note : m_strong_note );
-	    tag = ( j ? TAG_WEAK : TAG_STRONG );
-	    metronome_note(note, METRONOME_VELOCITY, t, tag);
-		metronome_echo(t, SND_SEQ_EVENT_USR1);
-		t += duration;
-	}
-	metronome_echo(t, SND_SEQ_EVENT_USR0);
+    m_generator.simpleBar(*this, tick);
 }
 
-int SequencerAdapter::decodeVelocity(const QString drumVel)
+/**
+ * Schedules the next bar of the pattern, expanding only the hits of its
+ * own columns from the compiled snapshot, and advances to the following
+ * bar.
+ */
+void SequencerAdapter::metronome_grid_pattern(int tick)
 {
-    const qreal f = 127.0 / 9.0;
-    int num = 0;
-    bool isNum = false;
-    if (drumVel.isEmpty())
-        return 0;
-    if (drumVel == "f")
-        return m_strong_velocity;
-    else if (drumVel == "p")
-        return m_weak_velocity;
-    num = drumVel.toInt(&isNum);
-    if (isNum)
-        return qRound(f * num);
-    return 0;
+    std::shared_ptr<const CompiledPattern> pattern = std::atomic_load(&m_compiled);
+    if (!pattern)
+        return;
+    int bar = m_patternBar % pattern->bars();
+    metronome_pattern_bar(*pattern, bar, tick);
+    m_patternBar = bar + 1;
 }
 
-int SequencerAdapter::decodeTag(const QString drumVel)
+void SequencerAdapter::metronome_pattern_bar(const CompiledPattern& pattern, int bar, int tick)
 {
-    if (drumVel == "f")
-        return TAG_STRONG;
-    else if (drumVel == "p")
-        return TAG_WEAK;
-    return TAG_FIXED;
+    m_nextTick = m_generator.patternBar(*this, pattern, bar, tick);
 }
 
-void SequencerAdapter::metronome_grid_pattern(int tick)
+/* A bar of silence, with the beats of the automatic rhythm */
+void SequencerAdapter::metronome_rest(int tick)
 {
-    int i, j, t, duration, key, vel, tag;
-    t = tick;
-    duration = m_resolution * 4 / m_model->patternFigure();
-    for(i=0; i<m_model->columnCount(); ++i) {
-        for(j=0; j<m_model->rowCount(); ++j) {
-            QString n = m_model->patternHit(j, i);
-            if (!n.isEmpty()) {
-                key = m_model->patternKey(j).toInt();
-                vel = decodeVelocity(n);
-                tag = decodeTag(n);
-                metronome_note(key, vel, t, tag);
-            }
-        }
-        metronome_echo(t, SND_SEQ_EVENT_USR1);
-        t += duration;
+    m_nextTick = m_generator.restBar(*this, tick);
+}
+
+/* A queue tempo change at an exact tick */
+void SequencerAdapter::metronome_tempo_event(int tick, qreal bpm)
+{
+    TempoEvent ev(m_queueId, qRound(60000000.0 / bpm));
+    ev.setSource(m_outputPortId);
+    ev.scheduleTick(m_queueId, tick, false);
+    m_Client->outputDirect(&ev);
+    SequencerMetrics::add(m_metrics.eventsScheduled);
+}
+
+/**
+ * Schedules the next bar of the song timeline: the tempo changes at its
+ * start, and the clicks of its meter. Returns false at the end of the
+ * song.
+ */
+bool SequencerAdapter::metronome_song_bar()
+{
+    std::shared_ptr<const SongTimeline> timeline = std::atomic_load(&m_timeline);
+    if (!timeline || (timeline->endBar() > 0 && m_songBar >= timeline->endBar()))
+        return false;
+    m_generator.songBar(*this, *timeline, m_songBar);
+    m_songBar++;
+    return true;
+}
+
+/* Lets the audio engine follow the real time of the queue, once per bar */
+void SequencerAdapter::metronome_audio_sync()
+{
+    std::shared_ptr<AudioClickEngine> audio = std::atomic_load(&m_audio);
+    if (!audio)
+        return;
+    QueueStatus& status = m_Queue->getStatus();
+    if (status.isRunning())
+        audio->syncQueue(qint64(status.getClockTime() * 1000000));
+}
+
+void SequencerAdapter::clickNote(int key, int velocity, int tick, int tag)
+{
+    std::shared_ptr<AudioClickEngine> audio = std::atomic_load(&m_audio);
+    if (audio)
+        audio->scheduleNote(tick, key, velocity);
+    else
+        metronome_note(key, velocity, tick, tag);
+}
+
+void SequencerAdapter::clickBeat(int tick)
+{
+    metronome_echo(tick, SND_SEQ_EVENT_USR1);
+}
+
+void SequencerAdapter::clickBarEnd(int tick)
+{
+    metronome_echo(tick, SND_SEQ_EVENT_USR0);
+}
+
+void SequencerAdapter::clickTempo(int tick, qreal bpm)
+{
+    metronome_tempo_event(tick, bpm);
+    std::shared_ptr<AudioClickEngine> audio = std::atomic_load(&m_audio);
+    if (audio)
+        audio->scheduleTempo(tick, bpm);
+}
+
+/**
+ * Schedules the next bar of the arrangement, from the pattern prefetched
+ * for its step, and advances to the following bar. The GUI thread is told
+ * when a step begins, to prefetch the pattern of the next one. A pattern
+ * not prefetched in time is replaced by silence. Returns false after the
+ * last step of an arrangement not looping.
+ */
+bool SequencerAdapter::metronome_arrangement(int tick)
+{
+    std::shared_ptr<CompiledArrangement> arrangement = std::atomic_load(&m_arrangement);
+    if (!arrangement || m_step < 0 || m_step >= arrangement->count())
+        return false;
+    if (m_stepBar == 0)
+        emit signalArrangementStep(m_step);
+    std::shared_ptr<const CompiledPattern> pattern = arrangement->pattern(m_step);
+    if (pattern) {
+        metronome_pattern_bar(*pattern, m_stepBar % pattern->bars(), tick);
+    } else {
+        if (!arrangement->step(m_step).isRest())
+            SequencerMetrics::add(m_metrics.missedPrefetches);
+        metronome_rest(tick);
     }
-    metronome_echo(t, SND_SEQ_EVENT_USR0);
+    if (++m_stepBar >= arrangement->step(m_step).bars) {
+        m_stepBar = 0;
+        m_step = arrangement->next(m_step);
+    }
+    return true;
 }
 
 void SequencerAdapter::metronome_set_tempo() 
 {
     QueueTempo t = m_Queue->getTempo();
-    t.setPPQ(m_resolution);
+    t.setPPQ(m_generator.resolution());
     t.setNominalBPM(m_bpm);
 	m_Queue->setTempo(t);
 	m_Client->drainOutput();
+    m_jitterReset = true;
+    std::shared_ptr<AudioClickEngine> audio = std::atomic_load(&m_audio);
+    if (audio)
+        audio->setTempo(m_bpm);
 }
 
 void SequencerAdapter::metronome_set_controls()
 {
     sendControlChange(VOLUME_CC, m_volume);
     sendControlChange(PAN_CC, m_balance);
+    std::shared_ptr<AudioClickEngine> audio = std::atomic_load(&m_audio);
+    if (audio) {
+        audio->setVolume(m_volume);
+        audio->setBalance(m_balance);
+    }
 }
 
 void SequencerAdapter::parse_sysex(SequencerEvent *ev) 
@@ -369,18 +506,38 @@ void SequencerAdapter::parse_sysex(SequencerEvent *ev)
 void SequencerAdapter::handleSequencerEvent(SequencerEvent *ev)
 {
     int when = 0;
+    bool scheduled = true;
     switch (ev->getSequencerType()) {
     case SND_SEQ_EVENT_USR0:
-        when = ev->getTick() + m_patternDuration;
-        if (m_patternMode)
-            metronome_grid_pattern(when);
-        else
+        if (std::atomic_load(&m_timeline)) {
+            scheduled = metronome_song_bar();
+        } else if (std::atomic_load(&m_arrangement)) {
+            scheduled = metronome_arrangement(m_nextTick);
+        } else if (m_patternMode) {
+            metronome_grid_pattern(m_nextTick);
+        } else {
+            when = ev->getTick() + m_patternDuration;
             metronome_simple_pattern(when);
+        }
+        if (!scheduled) {
+            if (m_finishing)
+                emit signalStop();
+            m_finishing = true;
+        }
         m_bar++;
         m_beat = 0;
+        SequencerMetrics::add(m_metrics.barsPlayed);
+        metronome_audio_sync();
+        if (m_metricsEnabled) {
+            metrics_echo(ev);
+            metrics_pool();
+        }
         break;
     case SND_SEQ_EVENT_USR1:
         m_beat++;
+        SequencerMetrics::add(m_metrics.beatsPlayed);
+        if (m_metricsEnabled)
+            metrics_echo(ev);
         emit signalUpdate(m_bar, m_beat);
         break;
     case SND_SEQ_EVENT_START:
@@ -407,29 +564,106 @@ void SequencerAdapter::handleSequencerEvent(SequencerEvent *ev)
 
 void SequencerAdapter::metronome_start() 
 {
+    std::shared_ptr<const SongTimeline> timeline = std::atomic_load(&m_timeline);
+    if (timeline) {
+        QueueTempo t = m_Queue->getTempo();
+        t.setPPQ(m_generator.resolution());
+        t.setTempo(qRound(60000000.0 / timeline->tempoAt(0)));
+        m_Queue->setTempo(t);
+    }
+    std::shared_ptr<AudioClickEngine> audio = std::atomic_load(&m_audio);
+    if (audio)
+        audio->resetPlayback(m_generator.resolution(), timeline ? timeline->tempoAt(0) : m_bpm);
     m_Queue->start();
-	if (m_patternMode) {
-        m_patternDuration = m_resolution * 4 / m_model->patternFigure() * m_model->columnCount();
+    if (timeline) {
+        m_songBar = 1;
+        m_finishing = false;
+        if (!metronome_song_bar() || !metronome_song_bar())
+            m_finishing = true;
+    } else if (std::atomic_load(&m_arrangement)) {
+        m_step = 0;
+        m_stepBar = 0;
+        m_finishing = false;
+        metronome_arrangement(0);
+        if (!metronome_arrangement(m_nextTick))
+            m_finishing = true;
+    } else if (m_patternMode) {
+        compilePattern();
+        m_patternBar = 0;
         metronome_grid_pattern(0);
-        metronome_grid_pattern(m_patternDuration);
+        metronome_grid_pattern(m_nextTick);
 	} else {
-        m_patternDuration = m_resolution * 4 / m_ts_div * m_ts_num;
+        m_patternDuration = m_generator.barLength();
         metronome_simple_pattern(0);
         metronome_simple_pattern(m_patternDuration);
 	}
+    if (audio)
+        audio->startPlayback();
+    StartupTrace::firstClick();
 	m_bar = 1;
 	m_beat = 0;
 	m_playing = true;
+    m_jitterReset = true;
 }
 
 void SequencerAdapter::metronome_stop() 
 {
     m_Queue->stop();
+    std::shared_ptr<AudioClickEngine> audio = std::atomic_load(&m_audio);
+    if (audio)
+        audio->stopPlayback();
 	m_playing = false;
 }
 
 void SequencerAdapter::metronome_continue() 
 {
+    std::shared_ptr<AudioClickEngine> audio = std::atomic_load(&m_audio);
+    if (audio)
+        audio->startPlayback();
     m_Queue->continueRunning();
 	m_playing = true;
 }
+
+/**
+ * Compares the wall clock time elapsed between two consecutive echo events
+ * with the time expected from their tick distance at the current tempo,
+ * or along the tempo map of the song being played.
+ */
+void SequencerAdapter::metrics_echo(SequencerEvent *ev)
+{
+    unsigned int tick = ev->getTick();
+    if (m_jitterReset.exchange(false) || !m_echoTimer.isValid()) {
+        m_echoTimer.start();
+        m_lastEchoTick = tick;
+        return;
+    }
+    qint64 elapsed = m_echoTimer.nsecsElapsed() / 1000;
+    m_echoTimer.start();
+    qint64 expected;
+    std::shared_ptr<const SongTimeline> timeline = std::atomic_load(&m_timeline);
+    if (timeline)
+        expected = timeline->timeAt(tick) - timeline->timeAt(m_lastEchoTick);
+    else
+        expected = qint64(tick - m_lastEchoTick) * 60000000 / (m_bpm * m_generator.resolution());
+    m_lastEchoTick = tick;
+    qint64 delay = elapsed - expected;
+    quint64 jitter = quint64(qAbs(delay));
+    m_metrics.lastJitter.store(jitter, std::memory_order_relaxed);
+    SequencerMetrics::raise(m_metrics.maxJitter, jitter);
+    if (delay > LATE_ECHO_THRESHOLD)
+        SequencerMetrics::add(m_metrics.lateEchoes);
+}
+
+void SequencerAdapter::metrics_pool()
+{
+    PoolInfo& pool = m_Client->getPoolInfo();
+    int used = pool.getOutputPool() - pool.getOutputFree();
+    if (used > 0)
+        SequencerMetrics::raise(m_metrics.poolHighWater, quint64(used));
+}
+
+void SequencerAdapter::recordFrameTime(qint64 usecs)
+{
+    m_metrics.lastFrameTime.store(quint64(usecs), std::memory_order_relaxed);
+    SequencerMetrics::raise(m_metrics.maxFrameTime, quint64(usecs));
+}
@@ -25,15 +25,56 @@ namespace drumstick {
     class SequencerEvent;
 };
 
+#include <atomic>
+#include <memory>
+#include <QElapsedTimer>
 #include <drumstick/alsaclient.h>
+#include "clickgenerator.h"
 
+class AudioClickEngine;
+class CompiledArrangement;
+class CompiledPattern;
 class DrumGridModel;
+class SongTimeline;
 
-const int TAG_FIXED(0);
-const int TAG_WEAK(1);
-const int TAG_STRONG(2);
+/**
+ * Counters sampled by MetricsExporter. They are updated from the ALSA input
+ * thread and the GUI thread using relaxed atomics: readers only need
+ * eventually consistent values, never ordering between them.
+ */
+struct SequencerMetrics
+{
+    std::atomic<quint64> barsPlayed{0};
+    std::atomic<quint64> beatsPlayed{0};
+    std::atomic<quint64> eventsScheduled{0};
+    std::atomic<quint64> lateEchoes{0};
+    std::atomic<quint64> missedPrefetches{0};
+    std::atomic<quint64> lastJitter{0};   /* microseconds */
+    std::atomic<quint64> maxJitter{0};    /* microseconds */
+    std::atomic<quint64> poolHighWater{0};
+    std::atomic<quint64> lastFrameTime{0}; /* microseconds */
+    std::atomic<quint64> maxFrameTime{0};  /* microseconds */
+
+    static void add(std::atomic<quint64>& counter, quint64 value = 1)
+    {
+        counter.fetch_add(value, std::memory_order_relaxed);
+    }
+    static void raise(std::atomic<quint64>& gauge, quint64 value)
+    {
+        quint64 prev = gauge.load(std::memory_order_relaxed);
+        while (prev < value &&
+               !gauge.compare_exchange_weak(prev, value, std::memory_order_relaxed))
+            ;
+    }
+    static quint64 get(const std::atomic<quint64>& counter)
+    {
+        return counter.load(std::memory_order_relaxed);
+    }
+};
 
-class SequencerAdapter : public QObject, public drumstick::ALSA::SequencerEventHandler
+const qint64 LATE_ECHO_THRESHOLD(2000); /* microseconds */
+
+class SequencerAdapter : public QObject, public drumstick::ALSA::SequencerEventHandler, public ClickSink
 {
     Q_OBJECT
 
@@ -43,17 +84,17 @@ public:
 
     void setBank(int newValue) { m_bank = newValue; }
     void setProgram(int newValue) { m_program = newValue; }
-    void setWeakNote(int newValue) { m_weak_note = newValue; }
-    void setStrongNote(int newValue) { m_strong_note = newValue; }
-    void setWeakVelocity(int newValue) { m_weak_velocity = newValue; }
-    void setStrongVelocity(int newValue) { m_strong_velocity = newValue; }
+    void setWeakNote(int newValue) { m_generator.setWeakNote(newValue); }
+    void setStrongNote(int newValue) { m_generator.setStrongNote(newValue); }
+    void setWeakVelocity(int newValue) { m_generator.setWeakVelocity(newValue); }
+    void setStrongVelocity(int newValue) { m_generator.setStrongVelocity(newValue); }
     void setVolume(int newValue) { m_volume = newValue; }
     void setBalance(int newValue) { m_balance = newValue; }
     void setChannel(int newValue) { m_channel = newValue; }
-    void setResolution(int newValue) { m_resolution = newValue; }
+    void setResolution(int newValue) { m_generator.setResolution(newValue); }
     void setBpm(int newValue) { m_bpm = newValue; }
-    void setRhythmNumerator(int newValue) { m_ts_num = newValue; }
-    void setRhythmDenominator(int newValue) { m_ts_div = newValue; }
+    void setRhythmNumerator(int newValue) { m_generator.setRhythmNumerator(newValue); }
+    void setRhythmDenominator(int newValue) { m_generator.setRhythmDenominator(newValue); }
     void setAutoConnect(bool newValue) { m_autoconnect = newValue; }
     void setOutputConn(QString newValue) { m_outputConn = newValue; }
     void setInputConn(QString newValue) { m_inputConn = newValue; }
@@ -61,20 +102,24 @@ public:
     void setSendNoteOff(bool newValue) { m_useNoteOff = newValue; }
     void setPatternMode(bool newValue) { m_patternMode = newValue; }
     void setBankSelMethod(int newValue) { m_bankSelMethod = newValue; }
-    void setModel(DrumGridModel* model) { m_model = model; }
+    void setModel(DrumGridModel* model);
+    void setArrangement(const std::shared_ptr<CompiledArrangement>& arrangement);
+    void setTimeline(const std::shared_ptr<const SongTimeline>& timeline);
+    void setAudioEngine(const std::shared_ptr<AudioClickEngine>& engine);
+    std::shared_ptr<AudioClickEngine> audioEngine() const { return std::atomic_load(&m_audio); }
     int getBank() { return m_bank; }
     int getProgram() { return m_program; }
-    int getWeakNote() { return m_weak_note; }
-    int getStrongNote() { return m_strong_note; }
-    int getWeakVelocity() { return m_weak_velocity; }
-    int getStrongVelocity() { return m_strong_velocity; }
+    int getWeakNote() { return m_generator.weakNote(); }
+    int getStrongNote() { return m_generator.strongNote(); }
+    int getWeakVelocity() { return m_generator.weakVelocity(); }
+    int getStrongVelocity() { return m_generator.strongVelocity(); }
     int getVolume() { return m_volume; }
     int getBalance() { return m_balance; }
     int getChannel() { return m_channel; }
-    int getResolution() { return m_resolution; }
+    int getResolution() { return m_generator.resolution(); }
     int getBpm() { return m_bpm; }
-    int getRhythmNumerator() { return m_ts_num; }
-    int getRhythmDenominator() { return m_ts_div; }
+    int getRhythmNumerator() { return m_generator.rhythmNumerator(); }
+    int getRhythmDenominator() { return m_generator.rhythmDenominator(); }
     bool getAutoConnect() { return m_autoconnect; }
     bool isPlaying() { return m_playing; }
     QString getOutputConn() { return m_outputConn; }
@@ -83,6 +128,10 @@ public:
     bool getSendNoteOff() { return m_useNoteOff; }
     bool getPatternMode() { return m_patternMode; }
     int getBankSelMethod() { return m_bankSelMethod; }
+    void setMetricsEnabled(bool enabled) { m_metricsEnabled = enabled; }
+    bool getMetricsEnabled() { return m_metricsEnabled; }
+    const SequencerMetrics& metrics() const { return m_metrics; }
+    void recordFrameTime(qint64 usecs);
 
     void sendControlChange( int cc, int value );
     void sendInitialControls();
@@ -102,19 +151,31 @@ public:
     void disconnect_input();
     QStringList inputConnections();
     QStringList outputConnections();
-    int decodeVelocity(const QString drumVel);
-    int decodeTag(const QString drumVel);
 
     void parse_sysex(drumstick::ALSA::SequencerEvent *ev);
     void metronome_note(int note, int vel, int tick, int tag);
     void metronome_echo(int tick, int ev_type);
     void metronome_simple_pattern(int tick);
     void metronome_grid_pattern(int tick);
+    void metronome_pattern_bar(const CompiledPattern& pattern, int bar, int tick);
+    void metronome_rest(int tick);
+    bool metronome_arrangement(int tick);
+    bool metronome_song_bar();
+    void metronome_tempo_event(int tick, qreal bpm);
+    void metronome_audio_sync();
     void metronome_event_output(drumstick::ALSA::SequencerEvent* ev);
     void metronome_note_output(drumstick::ALSA::SequencerEvent* ev);
     void metronome_schedule_event(drumstick::ALSA::SequencerEvent* ev, int tick);
     int calc_lsb(int x);
     int calc_msb(int x);
+    void metrics_echo(drumstick::ALSA::SequencerEvent *ev);
+    void metrics_pool();
+
+// ClickSink methods
+    void clickNote(int key, int velocity, int tick, int tag) override;
+    void clickBeat(int tick) override;
+    void clickBarEnd(int tick) override;
+    void clickTempo(int tick, qreal bpm) override;
 
 //public Q_SLOTS:    
 //    void sequencerEvent(SequencerEvent *ev);
@@ -122,18 +183,26 @@ public:
 // SequencerEventHandler method
     void handleSequencerEvent(drumstick::ALSA::SequencerEvent *ev) override;
 
+public slots:
+    void compilePattern();
+
 signals:
     void signalUpdate(int,int);
     void signalPlay();
     void signalStop();
     void signalCont();
     void signalNotation(int,int);
+    void signalArrangementStep(int);
     
 private:
     drumstick::ALSA::MidiClient* m_Client;
     drumstick::ALSA::MidiPort* m_Port;
     drumstick::ALSA::MidiQueue* m_Queue;
     DrumGridModel* m_model;
+    std::shared_ptr<AudioClickEngine> m_audio; /* read by the ALSA input thread */
+    std::shared_ptr<const CompiledPattern> m_compiled;
+    std::shared_ptr<CompiledArrangement> m_arrangement;
+    std::shared_ptr<const SongTimeline> m_timeline;
     int m_clientId;
     int m_inputPortId;
     int m_outputPortId;
@@ -143,24 +212,29 @@ private:
     int m_instrument;
     int m_bank;
     int m_program;
-    int m_weak_note;
-    int m_strong_note;
-    int m_weak_velocity;
-    int m_strong_velocity;
     int m_channel;
     int m_volume;
     int m_balance;
-    int m_resolution;
     int m_bpm;
-    int m_ts_num; /* time signature: numerator */
-    int m_ts_div; /* time signature: denominator */
     int m_noteDuration;
     int m_bankSelMethod;
     int m_patternDuration;
+    int m_patternBar; /* next bar of the pattern to be scheduled */
+    int m_nextTick;   /* where the next bar of the pattern starts */
+    int m_step;       /* arrangement step of the next bar */
+    int m_stepBar;    /* bar of that step */
+    int m_songBar;    /* next bar of the song timeline */
+    bool m_finishing; /* the last bar of the arrangement is scheduled */
     bool m_autoconnect;
     bool m_playing;
     bool m_useNoteOff;
     bool m_patternMode;
+    std::atomic<bool> m_metricsEnabled; /* set by the GUI, read by the ALSA input thread */
+    ClickGenerator m_generator;
+    std::atomic<bool> m_jitterReset;
+    unsigned int m_lastEchoTick;
+    QElapsedTimer m_echoTimer;
+    SequencerMetrics m_metrics;
     QString m_outputConn;
     QString m_inputConn;
     QString NO_CONNECTION;
@@ -0,0 +1,212 @@
+/***************************************************************************
+ *   KMetronome - ALSA Sequencer based MIDI metronome                      *
+ *   Copyright (C) 2005-2021 Pedro Lopez-Cabanillas <plcl@users.sf.net>    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
+ ***************************************************************************/
+
+
+#include <climits>
+#include <QIODevice>
+#include "smfclickwriter.h"
+
+const quint8 SMF_NOTE_ON(0x90);
+const quint8 SMF_CONTROL_CHANGE(0xb0);
+const quint8 SMF_META(0xff);
+const quint8 SMF_TEMPO(0x51);
+const quint8 SMF_TIME_SIGNATURE(0x58);
+const quint8 SMF_END_OF_TRACK(0x2f);
+/* Bytes collected before writing them to the device */
+const int SMF_WRITE_BUFFER(65536);
+
+static void appendNumber(QByteArray& data, quint32 value, int size)
+{
+    for (int i = size - 1; i >= 0; --i)
+        data.append(char((value >> (i * 8)) & 0xff));
+}
+
+SmfClickWriter::SmfClickWriter(QIODevice* device) :
+    m_device(device),
+    m_trackStart(0),
+    m_trackLength(0),
+    m_channel(METRONOME_CHANNEL),
+    m_duration(NOTE_DURATION),
+    m_lastTick(0),
+    m_running(0),
+    m_noteOff(true)
+{ }
+
+/**
+ * Notes end after the given ticks, or are left without note off at all
+ * when noteOff is false, like the sequencer does.
+ */
+void SmfClickWriter::setNoteDuration(int ticks, bool noteOff)
+{
+    m_duration = qMax(ticks, 1);
+    m_noteOff = noteOff;
+}
+
+/**
+ * Writes the file header and the header of the track, whose length is
+ * written by finish().
+ */
+bool SmfClickWriter::begin(int division)
+{
+    QByteArray header("MThd");
+    appendNumber(header, 6, 4);
+    appendNumber(header, 0, 2);
+    appendNumber(header, 1, 2);
+    appendNumber(header, quint32(division), 2);
+    header.append("MTrk");
+    appendNumber(header, 0, 4);
+    m_trackStart = m_device->pos() + header.size() - 4;
+    m_trackLength = 0;
+    m_lastTick = 0;
+    m_running = 0;
+    m_buffer = header;
+    return flush();
+}
+
+bool SmfClickWriter::flush()
+{
+    if (m_buffer.isEmpty())
+        return true;
+    if (m_device->write(m_buffer) != m_buffer.size()) {
+        if (m_error.isEmpty())
+            m_error = m_device->errorString();
+        m_buffer.clear();
+        return false;
+    }
+    m_buffer.clear();
+    return true;
+}
+
+void SmfClickWriter::writeDelta(int tick)
+{
+    quint32 delta = quint32(qMax(tick - m_lastTick, 0));
+    m_lastTick = qMax(tick, m_lastTick);
+    char bytes[4];
+    int count = 0;
+    bytes[count++] = char(delta & 0x7f);
+    while ((delta >>= 7) > 0 && count < 4)
+        bytes[count++] = char((delta & 0x7f) | 0x80);
+    while (count > 0)
+        m_buffer.append(bytes[--count]);
+}
+
+void SmfClickWriter::writeChannelEvent(int tick, quint8 status, quint8 data1, quint8 data2)
+{
+    flushNoteOffs(tick);
+    int start = m_buffer.size();
+    writeDelta(tick);
+    if (status != m_running) {
+        m_buffer.append(char(status));
+        m_running = status;
+    }
+    m_buffer.append(char(data1));
+    m_buffer.append(char(data2));
+    m_trackLength += m_buffer.size() - start;
+    if (m_buffer.size() >= SMF_WRITE_BUFFER)
+        flush();
+}
+
+void SmfClickWriter::writeMetaEvent(int tick, quint8 type, const QByteArray& data)
+{
+    flushNoteOffs(tick);
+    int start = m_buffer.size();
+    writeDelta(tick);
+    m_buffer.append(char(SMF_META));
+    m_buffer.append(char(type));
+    m_buffer.append(char(data.size()));
+    m_buffer.append(data);
+    m_running = 0;
+    m_trackLength += m_buffer.size() - start;
+    if (m_buffer.size() >= SMF_WRITE_BUFFER)
+        flush();
+}
+
+/* The note offs due up to the tick, as note ons with velocity zero */
+void SmfClickWriter::flushNoteOffs(int tick)
+{
+    while (!m_noteOffs.empty() && m_noteOffs.top().first <= tick) {
+        NoteOff off = m_noteOffs.top();
+        m_noteOffs.pop();
+        int start = m_buffer.size();
+        writeDelta(off.first);
+        quint8 status = SMF_NOTE_ON | quint8(m_channel);
+        if (status != m_running) {
+            m_buffer.append(char(status));
+            m_running = status;
+        }
+        m_buffer.append(char(off.second));
+        m_buffer.append(char(0));
+        m_trackLength += m_buffer.size() - start;
+    }
+}
+
+void SmfClickWriter::controlChange(int tick, int cc, int value)
+{
+    writeChannelEvent(tick, SMF_CONTROL_CHANGE | quint8(m_channel), quint8(cc), quint8(value));
+}
+
+void SmfClickWriter::clickNote(int key, int velocity, int tick, int tag)
+{
+    Q_UNUSED(tag)
+    if (velocity <= 0)
+        return;
+    writeChannelEvent(tick, SMF_NOTE_ON | quint8(m_channel), quint8(key), quint8(qMin(velocity, 127)));
+    if (m_noteOff)
+        m_noteOffs.push(NoteOff(tick + m_duration, key));
+}
+
+void SmfClickWriter::clickTempo(int tick, qreal bpm)
+{
+    QByteArray data;
+    appendNumber(data, quint32(qRound(60000000.0 / bpm)), 3);
+    writeMetaEvent(tick, SMF_TEMPO, data);
+}
+
+void SmfClickWriter::clickMeter(int tick, int numerator, int denominator)
+{
+    int power = 0;
+    while ((1 << power) < denominator)
+        ++power;
+    QByteArray data;
+    data.append(char(numerator));
+    data.append(char(power));
+    data.append(char(24));  /* MIDI clocks per click */
+    data.append(char(8));   /* 32nd notes per quarter */
+    writeMetaEvent(tick, SMF_TIME_SIGNATURE, data);
+}
+
+/**
+ * Ends the track at the tick, or after the last note off, and writes its
+ * length in the track header.
+ */
+bool SmfClickWriter::finish(int tick)
+{
+    flushNoteOffs(INT_MAX);
+    writeMetaEvent(qMax(tick, m_lastTick), SMF_END_OF_TRACK, QByteArray());
+    if (!flush())
+        return false;
+    qint64 end = m_device->pos();
+    QByteArray length;
+    appendNumber(length, quint32(m_trackLength), 4);
+    if (!m_device->seek(m_trackStart) || m_device->write(length) != length.size() ||
+        !m_device->seek(end)) {
+        m_error = tr("The MIDI file can't be written");
+        return false;
+    }
+    return m_error.isEmpty();
+}
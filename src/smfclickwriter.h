@@ -0,0 +1,82 @@
+/***************************************************************************
+ *   KMetronome - ALSA Sequencer based MIDI metronome                      *
+ *   Copyright (C) 2005-2021 Pedro Lopez-Cabanillas <plcl@users.sf.net>    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
+ ***************************************************************************/
+
+
+#ifndef SMFCLICKWRITER_H
+#define SMFCLICKWRITER_H
+
+#include <functional>
+#include <queue>
+#include <utility>
+#include <vector>
+#include <QByteArray>
+#include <QCoreApplication>
+#include <QString>
+#include "clickgenerator.h"
+
+class QIODevice;
+
+/**
+ * Writes the bars of a ClickGenerator as a single track Standard MIDI File
+ * (format 0), streaming the events to a seekable device as they come.
+ *
+ * Notes, tempo and time signature changes are written with the delta times
+ * of the file; note offs are kept in a queue until their time comes. The
+ * length of the track is patched in its header when it is finished.
+ */
+class SmfClickWriter : public ClickSink
+{
+    Q_DECLARE_TR_FUNCTIONS(SmfClickWriter)
+
+public:
+    explicit SmfClickWriter(QIODevice* device);
+
+    void setChannel(int channel) { m_channel = channel; }
+    void setNoteDuration(int ticks, bool noteOff);
+    bool begin(int division);
+    void controlChange(int tick, int cc, int value);
+    bool finish(int tick);
+    QString errorString() const { return m_error; }
+
+    void clickNote(int key, int velocity, int tick, int tag) override;
+    void clickTempo(int tick, qreal bpm) override;
+    void clickMeter(int tick, int numerator, int denominator) override;
+
+private:
+    typedef std::pair<int, int> NoteOff;  /* tick and key */
+
+    void flushNoteOffs(int tick);
+    void writeDelta(int tick);
+    void writeChannelEvent(int tick, quint8 status, quint8 data1, quint8 data2);
+    void writeMetaEvent(int tick, quint8 type, const QByteArray& data);
+    bool flush();
+
+    QIODevice* m_device;
+    QByteArray m_buffer;
+    std::priority_queue<NoteOff, std::vector<NoteOff>, std::greater<NoteOff> > m_noteOffs;
+    qint64 m_trackStart;
+    qint64 m_trackLength;
+    int m_channel;
+    int m_duration;
+    int m_lastTick;
+    quint8 m_running;
+    bool m_noteOff;
+    QString m_error;
+};
+
+#endif // SMFCLICKWRITER_H
@@ -0,0 +1,132 @@
+/***************************************************************************
+ *   KMetronome - ALSA Sequencer based MIDI metronome                      *
+ *   Copyright (C) 2005-2021 Pedro Lopez-Cabanillas <plcl@users.sf.net>    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
+ ***************************************************************************/
+
+
+#include <QMap>
+#include <qmath.h>
+#include "defs.h"
+#include "patternlibrary.h"
+#include "smfpatternreader.h"
+
+const int SMF_TIME_SIGNATURE(0x58);
+const quint8 SMF_NOTE_ON(0x90);
+const int SMF_DRUM_CHANNEL(9);
+/* 4/4, for files without a time signature */
+const quint32 SMF_DEFAULT_TIME_SIGNATURE((4 << 8) | 2);
+const int SMF_FIGURE_MAX(64);
+
+SmfPatternReader::SmfPatternReader(QIODevice* device) :
+    SmfReader(device),
+    m_timeSignature(SMF_DEFAULT_TIME_SIGNATURE),
+    m_hasTimeSignature(false)
+{ }
+
+bool SmfPatternReader::metaEvent(qint64 tick, int type, quint32 length)
+{
+    Q_UNUSED(tick)
+    if (type == SMF_TIME_SIGNATURE && length >= 2 && !m_hasTimeSignature) {
+        quint32 value;
+        if (!readNumber(value, 2) || !skipBytes(length - 2))
+            return false;
+        int numerator = value >> 8;
+        int power = value & 0xff;
+        if (numerator >= 1 && numerator <= 32 && power <= 6) {
+            m_timeSignature = value;
+            m_hasTimeSignature = true;
+        }
+        return true;
+    }
+    return skipBytes(length);
+}
+
+void SmfPatternReader::channelEvent(qint64 tick, quint8 status, quint8 data1, quint8 data2)
+{
+    if (status == (SMF_NOTE_ON | SMF_DRUM_CHANNEL) && data2 > 0) {
+        Hit hit;
+        hit.tick = tick;
+        hit.key = data1;
+        hit.velocity = data2;
+        m_hits.append(hit);
+    }
+}
+
+/**
+ * Reads the whole file into the pattern, quantized to the figure, which
+ * is raised to the denominator of the time signature when shorter.
+ * Returns false if the file is not valid or has no percussion notes.
+ * The name and tags of the pattern are left empty.
+ */
+bool SmfPatternReader::read(int figure, Pattern& pattern)
+{
+    m_hits.clear();
+    m_timeSignature = SMF_DEFAULT_TIME_SIGNATURE;
+    m_hasTimeSignature = false;
+    if (!readFile())
+        return false;
+    if (m_hits.isEmpty()) {
+        m_error = tr("There are no notes in the percussion channel");
+        return false;
+    }
+    const int denominator = 1 << (m_timeSignature & 0xff);
+    figure = qBound(denominator, figure, SMF_FIGURE_MAX);
+    const int beats = int(m_timeSignature >> 8) * figure / denominator;
+    if (beats > PATTERN_COLUMNS_MAX) {
+        m_error = tr("The bars are too long for the figure");
+        return false;
+    }
+    const qreal step = division() * 4.0 / figure;
+    const qreal barLength = step * beats;
+
+    qint64 lastTick = 0;
+    foreach(const Hit& hit, m_hits)
+        lastTick = qMax(lastTick, hit.tick);
+    int bars = qMax(qFloor(lastTick / barLength) + 1, qRound(endTick() / barLength));
+    bars = qBound(1, bars, qMin(PATTERN_BARS_MAX, PATTERN_COLUMNS_MAX / beats));
+    const int columns = beats * bars;
+
+    QMap<int, QByteArray> rows;
+    foreach(const Hit& hit, m_hits) {
+        int col = qRound(hit.tick / step);
+        // a note just before the end of the loop belongs to its start
+        if (col == columns)
+            col = 0;
+        if (col >= columns)
+            continue;
+        QByteArray& row = rows[hit.key];
+        if (row.isEmpty())
+            row.fill(0, columns);
+        char cell = char('0' + qBound(1, qRound(hit.velocity * 9 / 127.0), 9));
+        if (cell > row.at(col))
+            row[col] = cell;
+    }
+
+    pattern = Pattern();
+    pattern.figure = figure;
+    pattern.beats = beats;
+    pattern.bars = bars;
+    QMap<int, QByteArray>::ConstIterator it;
+    for (it = rows.constBegin(); it != rows.constEnd(); ++it) {
+        QStringList cells;
+        cells.reserve(columns);
+        foreach(char c, it.value())
+            cells.append(c == 0 ? QString() : QString(QChar::fromLatin1(c)));
+        pattern.keys.append(it.key());
+        pattern.rows.append(cells);
+    }
+    return true;
+}
@@ -0,0 +1,60 @@
+/***************************************************************************
+ *   KMetronome - ALSA Sequencer based MIDI metronome                      *
+ *   Copyright (C) 2005-2021 Pedro Lopez-Cabanillas <plcl@users.sf.net>    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
+ ***************************************************************************/
+
+
+#ifndef SMFPATTERNREADER_H
+#define SMFPATTERNREADER_H
+
+#include <QVector>
+#include "smfreader.h"
+
+class Pattern;
+
+/**
+ * Reads a drum pattern from a Standard MIDI File.
+ *
+ * The note on events of the percussion channel (MIDI channel 10) are
+ * quantized to the nearest cell of the chosen figure, and their
+ * velocities become the "1" to "9" cell values. The first time signature
+ * sets the beats of each bar, and the bars span the notes found or the
+ * length of the longest track. Only the notes are kept in memory.
+ */
+class SmfPatternReader : public SmfReader
+{
+public:
+    explicit SmfPatternReader(QIODevice* device);
+
+    bool read(int figure, Pattern& pattern);
+
+protected:
+    bool metaEvent(qint64 tick, int type, quint32 length) override;
+    void channelEvent(qint64 tick, quint8 status, quint8 data1, quint8 data2) override;
+
+private:
+    struct Hit {
+        qint64 tick;
+        quint8 key;
+        quint8 velocity;
+    };
+
+    QVector<Hit> m_hits;
+    quint32 m_timeSignature;  /* numerator and power of two of the denominator */
+    bool m_hasTimeSignature;
+};
+
+#endif // SMFPATTERNREADER_H
@@ -0,0 +1,227 @@
+/***************************************************************************
+ *   KMetronome - ALSA Sequencer based MIDI metronome                      *
+ *   Copyright (C) 2005-2021 Pedro Lopez-Cabanillas <plcl@users.sf.net>    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
+ ***************************************************************************/
+
+
+#include <cstring>
+#include <QIODevice>
+#include "smfreader.h"
+
+const quint8 SMF_META(0xff);
+const quint8 SMF_SYSEX(0xf0);
+const quint8 SMF_SYSEX_CONTINUATION(0xf7);
+const int SMF_END_OF_TRACK(0x2f);
+
+SmfReader::SmfReader(QIODevice* device) :
+    m_device(device),
+    m_remaining(-1),
+    m_division(0),
+    m_endTick(0)
+{ }
+
+bool SmfReader::isSmf(QIODevice* device)
+{
+    return device->peek(4) == "MThd";
+}
+
+/* Reads from the device, without going past the end of the current track */
+bool SmfReader::readBytes(char* data, qint64 count)
+{
+    if (m_remaining >= 0) {
+        if (count > m_remaining) {
+            m_error = tr("Truncated track");
+            return false;
+        }
+        m_remaining -= count;
+    }
+    if (m_device->read(data, count) != count) {
+        m_error = tr("Unexpected end of file");
+        return false;
+    }
+    return true;
+}
+
+bool SmfReader::readByte(quint8& byte)
+{
+    return readBytes(reinterpret_cast<char*>(&byte), 1);
+}
+
+/* A big endian number of the given size in bytes */
+bool SmfReader::readNumber(quint32& value, int size)
+{
+    value = 0;
+    for (int i = 0; i < size; ++i) {
+        quint8 byte;
+        if (!readByte(byte))
+            return false;
+        value = (value << 8) | byte;
+    }
+    return true;
+}
+
+bool SmfReader::readVarLen(quint32& value)
+{
+    value = 0;
+    for (int i = 0; i < 4; ++i) {
+        quint8 byte;
+        if (!readByte(byte))
+            return false;
+        value = (value << 7) | (byte & 0x7f);
+        if ((byte & 0x80) == 0)
+            return true;
+    }
+    m_error = tr("Invalid variable length number");
+    return false;
+}
+
+bool SmfReader::skipBytes(qint64 count)
+{
+    if (m_remaining >= 0) {
+        if (count > m_remaining) {
+            m_error = tr("Truncated track");
+            return false;
+        }
+        m_remaining -= count;
+    }
+    if (count > 0 && m_device->skip(count) != count) {
+        m_error = tr("Unexpected end of file");
+        return false;
+    }
+    return true;
+}
+
+bool SmfReader::metaEvent(qint64 tick, int type, quint32 length)
+{
+    Q_UNUSED(tick)
+    Q_UNUSED(type)
+    return skipBytes(length);
+}
+
+void SmfReader::channelEvent(qint64 tick, quint8 status, quint8 data1, quint8 data2)
+{
+    Q_UNUSED(tick)
+    Q_UNUSED(status)
+    Q_UNUSED(data1)
+    Q_UNUSED(data2)
+}
+
+/**
+ * Reads the whole file from the device. Returns false if it is not valid.
+ */
+bool SmfReader::readFile()
+{
+    char id[4];
+    quint32 length, format, tracks, division;
+    m_endTick = 0;
+    m_remaining = -1;
+    m_error.clear();
+    if (!readBytes(id, 4) || memcmp(id, "MThd", 4) != 0) {
+        m_error = tr("Not a Standard MIDI File");
+        return false;
+    }
+    if (!readNumber(length, 4) || !readNumber(format, 2) ||
+        !readNumber(tracks, 2) || !readNumber(division, 2))
+        return false;
+    if (length < 6 || division == 0) {
+        m_error = tr("Invalid file header");
+        return false;
+    }
+    if (division & 0x8000) {
+        m_error = tr("SMPTE time division is not supported");
+        return false;
+    }
+    m_division = int(division);
+    if (!skipBytes(length - 6))
+        return false;
+    quint32 track = 0;
+    while (track < tracks) {
+        if (!readBytes(id, 4) || !readNumber(length, 4))
+            return false;
+        if (memcmp(id, "MTrk", 4) != 0) {
+            // unknown chunks are ignored
+            if (!skipBytes(length))
+                return false;
+            continue;
+        }
+        m_remaining = length;
+        if (!readTrack() || !skipBytes(m_remaining))
+            return false;
+        m_remaining = -1;
+        ++track;
+        // the tracks of format 2 files are independent songs
+        if (format == 2)
+            break;
+    }
+    return true;
+}
+
+/**
+ * Reads the events of a track until its end, resolving running status.
+ */
+bool SmfReader::readTrack()
+{
+    qint64 tick = 0;
+    quint8 running = 0;
+    while (m_remaining > 0) {
+        quint32 delta, length;
+        quint8 status;
+        if (!readVarLen(delta) || !readByte(status))
+            return false;
+        tick += delta;
+        if (status == SMF_META) {
+            quint8 type;
+            if (!readByte(type) || !readVarLen(length))
+                return false;
+            running = 0;
+            if (!metaEvent(tick, type, length))
+                return false;
+            if (type == SMF_END_OF_TRACK)
+                break;
+        } else if (status == SMF_SYSEX || status == SMF_SYSEX_CONTINUATION) {
+            if (!readVarLen(length) || !skipBytes(length))
+                return false;
+            running = 0;
+        } else {
+            quint8 data[2] = { 0, 0 };
+            int first = 0;
+            if (status < 0x80) {
+                // running status: this was the first data byte
+                if (running == 0) {
+                    m_error = tr("Invalid running status");
+                    return false;
+                }
+                data[0] = status;
+                status = running;
+                first = 1;
+            } else if (status < 0xf0) {
+                running = status;
+            } else {
+                m_error = tr("Invalid event");
+                return false;
+            }
+            int type = status & 0xf0;
+            int dataBytes = (type == 0xc0 || type == 0xd0) ? 1 : 2;
+            for (int i = first; i < dataBytes; ++i) {
+                if (!readByte(data[i]))
+                    return false;
+            }
+            channelEvent(tick, status, data[0], data[1]);
+        }
+    }
+    m_endTick = qMax(m_endTick, tick);
+    return true;
+}
@@ -0,0 +1,75 @@
+/***************************************************************************
+ *   KMetronome - ALSA Sequencer based MIDI metronome                      *
+ *   Copyright (C) 2005-2021 Pedro Lopez-Cabanillas <plcl@users.sf.net>    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
+ ***************************************************************************/
+
+
+#ifndef SMFREADER_H
+#define SMFREADER_H
+
+#include <QCoreApplication>
+#include <QString>
+
+class QIODevice;
+
+/**
+ * Streams the events of a Standard MIDI File from a device.
+ *
+ * The file is read one event at a time and handed to the virtual methods
+ * of the subclass; the data of the events nobody wants is skipped as it is
+ * read, so the memory used does not depend on the size of the tracks.
+ * Files with SMPTE time division are not supported.
+ */
+class SmfReader
+{
+    Q_DECLARE_TR_FUNCTIONS(SmfReader)
+
+public:
+    explicit SmfReader(QIODevice* device);
+    virtual ~SmfReader() {}
+
+    QString errorString() const { return m_error; }
+
+    static bool isSmf(QIODevice* device);
+
+protected:
+    bool readFile();
+    int division() const { return m_division; }
+    qint64 endTick() const { return m_endTick; }
+
+    /** A meta event; the data must be read or skipped with readNumber() and skipBytes() */
+    virtual bool metaEvent(qint64 tick, int type, quint32 length);
+    /** A note on, note off or other channel event, with its data bytes */
+    virtual void channelEvent(qint64 tick, quint8 status, quint8 data1, quint8 data2);
+
+    bool readNumber(quint32& value, int size);
+    bool skipBytes(qint64 count);
+
+    QString m_error;
+
+private:
+    bool readTrack();
+    bool readBytes(char* data, qint64 count);
+    bool readByte(quint8& byte);
+    bool readVarLen(quint32& value);
+
+    QIODevice* m_device;
+    qint64 m_remaining;  /* bytes left in the current track */
+    int m_division;
+    qint64 m_endTick;
+};
+
+#endif // SMFREADER_H
@@ -0,0 +1,123 @@
+/***************************************************************************
+ *   KMetronome - ALSA Sequencer based MIDI metronome                      *
+ *   Copyright (C) 2005-2021 Pedro Lopez-Cabanillas <plcl@users.sf.net>    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
+ ***************************************************************************/
+
+
+#include <algorithm>
+#include <qmath.h>
+#include "defs.h"
+#include "smftemporeader.h"
+#include "songtimeline.h"
+
+const int SMF_TEMPO(0x51);
+const int SMF_TIME_SIGNATURE(0x58);
+/* What a file without tempo or time signature events plays */
+const qreal SMF_DEFAULT_BPM(120.0);
+
+SmfTempoReader::SmfTempoReader(QIODevice* device) :
+    SmfReader(device)
+{ }
+
+/**
+ * Reads the whole file, replacing the changes of the timeline with the
+ * tempo map found. Returns false if the file is not valid.
+ */
+bool SmfTempoReader::read(SongTimeline& timeline)
+{
+    m_events.clear();
+    if (!readFile())
+        return false;
+    buildTimeline(timeline);
+    return true;
+}
+
+bool SmfTempoReader::metaEvent(qint64 tick, int type, quint32 length)
+{
+    MetaEvent ev;
+    ev.tick = tick;
+    ev.type = type;
+    if (type == SMF_TEMPO && length >= 3) {
+        if (!readNumber(ev.value, 3) || !skipBytes(length - 3))
+            return false;
+        if (ev.value > 0)
+            m_events.append(ev);
+        return true;
+    }
+    if (type == SMF_TIME_SIGNATURE && length >= 2) {
+        if (!readNumber(ev.value, 2) || !skipBytes(length - 2))
+            return false;
+        m_events.append(ev);
+        return true;
+    }
+    return skipBytes(length);
+}
+
+/**
+ * Places the changes read in bars and beats, walking the time signatures
+ * in order. A time signature is expected at the start of a bar; one found
+ * in the middle starts at the next bar.
+ */
+void SmfTempoReader::buildTimeline(SongTimeline& timeline) const
+{
+    QVector<MetaEvent> events = m_events;
+    std::stable_sort(events.begin(), events.end(), [](const MetaEvent& a, const MetaEvent& b) {
+        return a.tick < b.tick || (a.tick == b.tick && a.type == SMF_TIME_SIGNATURE && b.type != SMF_TIME_SIGNATURE);
+    });
+    QVector<SongTimeline::Meter> meters;
+    QVector<SongTimeline::Tempo> tempos;
+    SongTimeline::Meter meter;
+    meter.bar = 1;
+    meter.numerator = 4;
+    meter.denominator = 4;
+    meter.tick = 0;
+    meters.append(meter);
+    SongTimeline::Tempo tempo;
+    tempo.bar = 1;
+    tempo.beat = 1;
+    tempo.bpm = SMF_DEFAULT_BPM;
+    tempo.tick = 0;
+    tempo.usecs = 0;
+    tempos.append(tempo);
+    qreal meterTick = 0;
+    foreach(const MetaEvent& ev, events) {
+        qreal beatLength = division() * 4.0 / meter.denominator;
+        qreal barLength = beatLength * meter.numerator;
+        qreal bars = (ev.tick - meterTick) / barLength;
+        if (ev.type == SMF_TIME_SIGNATURE) {
+            int numerator = ev.value >> 8;
+            int power = ev.value & 0xff;
+            if (numerator < 1 || numerator > 32 || power > 6)
+                continue;
+            int elapsed = qCeil(bars - 1e-9);
+            meterTick += elapsed * barLength;
+            meter.bar += elapsed;
+            meter.numerator = numerator;
+            meter.denominator = 1 << power;
+            meters.append(meter);
+        } else {
+            int elapsed = qFloor(bars + 1e-9);
+            qreal beat = 1 + (ev.tick - meterTick - elapsed * barLength) / beatLength;
+            tempo.bar = meter.bar + elapsed;
+            tempo.beat = qRound(beat * 1000) / 1000.0;
+            tempo.bpm = qBound(qreal(TEMPO_MIN), qRound(60000000000.0 / ev.value) / 1000.0, qreal(TEMPO_MAX));
+            tempos.append(tempo);
+        }
+    }
+    qreal beatLength = division() * 4.0 / meter.denominator;
+    int end = meter.bar + qCeil((endTick() - meterTick) / (beatLength * meter.numerator) - 1e-9);
+    timeline.setChanges(meters, tempos, qMax(end, 2));
+}
@@ -0,0 +1,56 @@
+/***************************************************************************
+ *   KMetronome - ALSA Sequencer based MIDI metronome                      *
+ *   Copyright (C) 2005-2021 Pedro Lopez-Cabanillas <plcl@users.sf.net>    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
+ ***************************************************************************/
+
+
+#ifndef SMFTEMPOREADER_H
+#define SMFTEMPOREADER_H
+
+#include <QVector>
+#include "smfreader.h"
+
+class SongTimeline;
+
+/**
+ * Reads the tempo map of a Standard MIDI File into a SongTimeline.
+ *
+ * Only the set tempo (FF 51) and time signature (FF 58) meta events are
+ * kept; every other event is skipped as the file is streamed.
+ */
+class SmfTempoReader : public SmfReader
+{
+public:
+    explicit SmfTempoReader(QIODevice* device);
+
+    bool read(SongTimeline& timeline);
+
+protected:
+    bool metaEvent(qint64 tick, int type, quint32 length) override;
+
+private:
+    struct MetaEvent {
+        qint64 tick;
+        int type;
+        quint32 value;   /* microseconds per quarter, or numerator and denominator */
+    };
+
+    void buildTimeline(SongTimeline& timeline) const;
+
+    QVector<MetaEvent> m_events;
+};
+
+#endif // SMFTEMPOREADER_H
@@ -0,0 +1,301 @@
+/***************************************************************************
+ *   KMetronome - ALSA Sequencer based MIDI metronome                      *
+ *   Copyright (C) 2005-2021 Pedro Lopez-Cabanillas <plcl@users.sf.net>    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
+ ***************************************************************************/
+
+
+#include <algorithm>
+#include <QFile>
+#include <QStringList>
+#include "defs.h"
+#include "smftemporeader.h"
+#include "songtimeline.h"
+
+static bool validDenominator(int denominator)
+{
+    return denominator >= 1 && denominator <= 64 && (denominator & (denominator - 1)) == 0;
+}
+
+SongTimeline::SongTimeline() :
+    m_resolution(METRONOME_RESOLUTION),
+    m_end(0)
+{
+    update();
+}
+
+void SongTimeline::clear()
+{
+    m_meters.clear();
+    m_tempos.clear();
+    m_end = 0;
+    update();
+}
+
+/**
+ * Replaces all the changes. Only the bars and beats of the change points
+ * are used; their ticks and times are computed here. The song stops at
+ * the start of the end bar, or never if it is zero.
+ */
+void SongTimeline::setChanges(const QVector<Meter>& meters, const QVector<Tempo>& tempos, int end)
+{
+    m_meters = meters;
+    m_tempos = tempos;
+    m_end = end;
+    update();
+}
+
+void SongTimeline::setResolution(int ppq)
+{
+    m_resolution = ppq;
+    update();
+}
+
+qint64 SongTimeline::barTicks(const Meter& meter) const
+{
+    return qint64(m_resolution) * 4 / meter.denominator * meter.numerator;
+}
+
+/**
+ * Sorts the change points by bar, keeping the last one given for each
+ * bar, and computes their cumulative tick and time offsets.
+ */
+void SongTimeline::update()
+{
+    std::stable_sort(m_meters.begin(), m_meters.end(),
+                     [](const Meter& a, const Meter& b) { return a.bar < b.bar; });
+    QVector<Meter> meters;
+    foreach(const Meter& m, m_meters) {
+        if (!meters.isEmpty() && meters.last().bar == m.bar)
+            meters.last() = m;
+        else
+            meters.append(m);
+    }
+    if (meters.isEmpty() || meters.first().bar > 1) {
+        Meter first;
+        first.bar = 1;
+        first.numerator = RHYTHM_TS_NUM;
+        first.denominator = RHYTHM_TS_DEN;
+        meters.prepend(first);
+    }
+    meters[0].tick = 0;
+    for (int i = 1; i < meters.count(); ++i) {
+        const Meter& prev = meters.at(i - 1);
+        meters[i].tick = prev.tick + (meters.at(i).bar - prev.bar) * barTicks(prev);
+    }
+    m_meters = meters;
+
+    std::stable_sort(m_tempos.begin(), m_tempos.end(), [](const Tempo& a, const Tempo& b) {
+        return a.bar < b.bar || (a.bar == b.bar && a.beat < b.beat);
+    });
+    QVector<Tempo> tempos;
+    foreach(const Tempo& t, m_tempos) {
+        if (!tempos.isEmpty() && tempos.last().bar == t.bar && tempos.last().beat == t.beat)
+            tempos.last() = t;
+        else
+            tempos.append(t);
+    }
+    if (tempos.isEmpty() || tempos.first().bar > 1 || tempos.first().beat > 1) {
+        Tempo first;
+        first.bar = 1;
+        first.beat = 1;
+        first.bpm = TEMPO_DEFAULT;
+        tempos.prepend(first);
+    }
+    for (int i = 0; i < tempos.count(); ++i) {
+        const Tempo& t = tempos.at(i);
+        qint64 beatTicks = qint64(m_resolution) * 4 / meterAt(t.bar).denominator;
+        tempos[i].tick = barTick(t.bar) + qRound64((t.beat - 1) * beatTicks);
+        tempos[i].usecs = 0;
+        if (i > 0) {
+            const Tempo& prev = tempos.at(i - 1);
+            tempos[i].usecs = prev.usecs +
+                qRound64((tempos.at(i).tick - prev.tick) * 60000000.0 / (prev.bpm * m_resolution));
+        }
+    }
+    m_tempos = tempos;
+}
+
+/**
+ * Reads the timeline from a text file, or the tempo map of a Standard
+ * MIDI File.
+ */
+bool SongTimeline::load(const QString& fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        m_error = file.errorString();
+        return false;
+    }
+    if (SmfTempoReader::isSmf(&file)) {
+        SmfTempoReader reader(&file);
+        if (!reader.read(*this)) {
+            m_error = reader.errorString();
+            return false;
+        }
+        return true;
+    }
+    return parse(QString::fromUtf8(file.readAll()));
+}
+
+/**
+ * Replaces the timeline with the changes of a text. Returns false, and
+ * leaves the timeline untouched, if a line is not valid.
+ */
+bool SongTimeline::parse(const QString& text)
+{
+    SongTimeline timeline;
+    timeline.m_resolution = m_resolution;
+    QVector<int> tempoLines;
+    const QStringList lines = text.split('\n');
+    for (int n = 0; n < lines.count(); ++n) {
+        const QString line = lines.at(n).trimmed();
+        if (line.isEmpty() || line.startsWith('#'))
+            continue;
+        const QStringList words = line.simplified().split(' ');
+        const QString keyword = words.first().toLower();
+        if (keyword != "tempo" && keyword != "meter" && keyword != "end") {
+            m_error = tr("Unknown change at line %1").arg(n + 1);
+            return false;
+        }
+        bool ok = false;
+        qreal beat = 1;
+        QStringList position = words.value(1).split(':');
+        if (keyword == "tempo" && position.count() == 2) {
+            beat = position.at(1).toDouble(&ok);
+            if (!ok || beat < 1) {
+                m_error = tr("Invalid beat at line %1").arg(n + 1);
+                return false;
+            }
+            position.removeLast();
+        }
+        int bar = position.first().toInt(&ok);
+        if (!ok || bar < 1 || position.count() != 1) {
+            m_error = tr("Invalid bar number at line %1").arg(n + 1);
+            return false;
+        }
+        if (keyword == "tempo" && words.count() == 3) {
+            qreal bpm = words.at(2).toDouble(&ok);
+            if (!ok || bpm < TEMPO_MIN || bpm > TEMPO_MAX) {
+                m_error = tr("Invalid tempo at line %1").arg(n + 1);
+                return false;
+            }
+            Tempo t;
+            t.bar = bar;
+            t.beat = beat;
+            t.bpm = bpm;
+            timeline.m_tempos.append(t);
+            tempoLines.append(n);
+        } else if (keyword == "meter" && words.count() == 3) {
+            const QStringList ts = words.at(2).split('/');
+            bool numOk = false, denOk = false;
+            Meter m;
+            m.bar = bar;
+            m.numerator = ts.value(0).toInt(&numOk);
+            m.denominator = ts.value(1).toInt(&denOk);
+            if (ts.count() != 2 || !numOk || !denOk || m.numerator < 1 ||
+                m.numerator > 32 || !validDenominator(m.denominator)) {
+                m_error = tr("Invalid time signature at line %1").arg(n + 1);
+                return false;
+            }
+            timeline.m_meters.append(m);
+        } else if (keyword == "end" && words.count() == 2) {
+            if (bar < 2) {
+                m_error = tr("The song must have one bar at least, at line %1").arg(n + 1);
+                return false;
+            }
+            timeline.m_end = bar;
+        } else {
+            m_error = tr("Wrong number of values at line %1").arg(n + 1);
+            return false;
+        }
+    }
+    // the meters may come later in the text, so the beats are checked last
+    const QVector<Tempo> tempos = timeline.m_tempos;
+    timeline.update();
+    for (int i = 0; i < tempos.count(); ++i) {
+        const Tempo& t = tempos.at(i);
+        if (t.beat >= timeline.meterAt(t.bar).numerator + 1) {
+            m_error = tr("The beat is beyond the end of the bar at line %1").arg(tempoLines.at(i) + 1);
+            return false;
+        }
+    }
+    m_meters = timeline.m_meters;
+    m_tempos = timeline.m_tempos;
+    m_end = timeline.m_end;
+    m_error.clear();
+    return true;
+}
+
+QString SongTimeline::toText() const
+{
+    QString text;
+    foreach(const Meter& m, m_meters)
+        text += QString("meter %1 %2/%3\n").arg(m.bar).arg(m.numerator).arg(m.denominator);
+    foreach(const Tempo& t, m_tempos) {
+        if (t.beat > 1)
+            text += QString("tempo %1:%2 %3\n").arg(t.bar).arg(t.beat).arg(t.bpm);
+        else
+            text += QString("tempo %1 %2\n").arg(t.bar).arg(t.bpm);
+    }
+    if (m_end > 0)
+        text += QString("end %1\n").arg(m_end);
+    return text;
+}
+
+/* The first tempo change at or after the given tick */
+int SongTimeline::tempoIndex(qint64 tick) const
+{
+    QVector<Tempo>::ConstIterator it = std::lower_bound(m_tempos.constBegin(), m_tempos.constEnd(), tick,
+        [](const Tempo& t, qint64 value) { return t.tick < value; });
+    return int(it - m_tempos.constBegin());
+}
+
+qreal SongTimeline::tempoAt(qint64 tick) const
+{
+    QVector<Tempo>::ConstIterator it = std::upper_bound(m_tempos.constBegin(), m_tempos.constEnd(), tick,
+        [](qint64 value, const Tempo& t) { return value < t.tick; });
+    return (it == m_tempos.constBegin()) ? m_tempos.first().bpm : (it - 1)->bpm;
+}
+
+const SongTimeline::Meter& SongTimeline::meterAt(int bar) const
+{
+    QVector<Meter>::ConstIterator it = std::upper_bound(m_meters.constBegin(), m_meters.constEnd(), bar,
+        [](int value, const Meter& m) { return value < m.bar; });
+    return (it == m_meters.constBegin()) ? m_meters.first() : *(it - 1);
+}
+
+qint64 SongTimeline::barTick(int bar) const
+{
+    const Meter& m = meterAt(bar);
+    return m.tick + (bar - m.bar) * barTicks(m);
+}
+
+int SongTimeline::barAt(qint64 tick) const
+{
+    QVector<Meter>::ConstIterator it = std::upper_bound(m_meters.constBegin(), m_meters.constEnd(), tick,
+        [](qint64 value, const Meter& m) { return value < m.tick; });
+    const Meter& m = (it == m_meters.constBegin()) ? m_meters.first() : *(it - 1);
+    return m.bar + int((tick - m.tick) / barTicks(m));
+}
+
+/* Microseconds from the start of the song until the given tick */
+qint64 SongTimeline::timeAt(qint64 tick) const
+{
+    QVector<Tempo>::ConstIterator it = std::upper_bound(m_tempos.constBegin(), m_tempos.constEnd(), tick,
+        [](qint64 value, const Tempo& t) { return value < t.tick; });
+    const Tempo& t = (it == m_tempos.constBegin()) ? m_tempos.first() : *(it - 1);
+    return t.usecs + qRound64((tick - t.tick) * 60000000.0 / (t.bpm * m_resolution));
+}
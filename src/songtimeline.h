@@ -0,0 +1,97 @@
+/***************************************************************************
+ *   KMetronome - ALSA Sequencer based MIDI metronome                      *
+ *   Copyright (C) 2005-2021 Pedro Lopez-Cabanillas <plcl@users.sf.net>    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
+ ***************************************************************************/
+
+
+#ifndef SONGTIMELINE_H
+#define SONGTIMELINE_H
+
+#include <QCoreApplication>
+#include <QString>
+#include <QVector>
+
+/**
+ * The tempo and meter map of a song, for click tracks with sections at
+ * different tempos and time signatures.
+ *
+ * Meter changes happen at the start of a bar, and tempo changes at any
+ * beat of a bar; bars and beats are numbered from one, and beats may be
+ * fractional. Each meter change knows the tick where its first bar
+ * starts, and each tempo change its tick and the time elapsed until it,
+ * so converting between bars, ticks and time is a binary search over the
+ * change points. Bar 1 always has a tempo and a meter; when missing, the
+ * defaults are used.
+ *
+ * The text format has one change per line, "tempo BAR[:BEAT] BPM", "meter
+ * BAR NUMERATOR/DENOMINATOR" or "end BAR" for the bar where the song
+ * stops; a BEAT past the last beat of its bar is refused. Empty lines and
+ * lines starting with '#' are ignored.
+ */
+class SongTimeline
+{
+    Q_DECLARE_TR_FUNCTIONS(SongTimeline)
+
+public:
+    struct Meter {
+        int bar;
+        int numerator;
+        int denominator;
+        qint64 tick;
+    };
+
+    struct Tempo {
+        int bar;
+        qreal beat;
+        qreal bpm;
+        qint64 tick;
+        qint64 usecs;
+    };
+
+    SongTimeline();
+
+    void clear();
+    void setChanges(const QVector<Meter>& meters, const QVector<Tempo>& tempos, int end);
+    void setResolution(int ppq);
+    int resolution() const { return m_resolution; }
+
+    bool load(const QString& fileName);
+    bool parse(const QString& text);
+    QString toText() const;
+    QString errorString() const { return m_error; }
+
+    int endBar() const { return m_end; }
+    int tempoCount() const { return m_tempos.count(); }
+    const Tempo& tempo(int index) const { return m_tempos.at(index); }
+    int tempoIndex(qint64 tick) const;
+    qreal tempoAt(qint64 tick) const;
+    const Meter& meterAt(int bar) const;
+    qint64 barTick(int bar) const;
+    int barAt(qint64 tick) const;
+    qint64 timeAt(qint64 tick) const;
+
+private:
+    void update();
+    qint64 barTicks(const Meter& meter) const;
+
+    QVector<Meter> m_meters;
+    QVector<Tempo> m_tempos;
+    int m_resolution;
+    int m_end;
+    QString m_error;
+};
+
+#endif // SONGTIMELINE_H
@@ -0,0 +1,125 @@
+/***************************************************************************
+ *   KMetronome - ALSA Sequencer based MIDI metronome                      *
+ *   Copyright (C) 2005-2021 Pedro Lopez-Cabanillas <plcl@users.sf.net>    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
+ ***************************************************************************/
+
+#include <cstdio>
+#include <QElapsedTimer>
+#include <QEvent>
+#include <QPair>
+#include <QVector>
+#include <QWidget>
+#include <QWindow>
+#include "startuptrace.h"
+
+namespace StartupTrace
+{
+
+static QElapsedTimer s_timer;
+static qint64 s_last = 0;
+static bool s_enabled = false;
+static bool s_decided = false;
+static bool s_clicked = false;
+static QVector<QPair<const char*, qint64> > s_pending;
+
+/**
+ * Catches the first expose event of the main window (time to window).
+ */
+class StartupWatcher : public QObject
+{
+public:
+    StartupWatcher(QWindow* window) : QObject(window),
+        m_window(window)
+    {
+        m_window->installEventFilter(this);
+    }
+
+protected:
+    bool eventFilter(QObject *watched, QEvent *event) override
+    {
+        if (watched == m_window && event->type() == QEvent::Expose && m_window->isExposed()) {
+            m_window->removeEventFilter(this);
+            mark("time to window");
+            deleteLater();
+        }
+        return QObject::eventFilter(watched, event);
+    }
+
+private:
+    QWindow* m_window;
+};
+
+void start()
+{
+    s_timer.start();
+    s_last = 0;
+}
+
+static void print(const char* phase, qint64 now)
+{
+    fprintf(stderr, "startup: %9.3f ms (+%8.3f ms) %s\n",
+            now / 1e6, (now - s_last) / 1e6, phase);
+    s_last = now;
+}
+
+/**
+ * Marks recorded before the command line is parsed are kept pending
+ * and printed once tracing is known to be enabled.
+ */
+void setEnabled(bool enabled)
+{
+    s_enabled = enabled;
+    s_decided = true;
+    if (s_enabled) {
+        for (const auto& p : qAsConst(s_pending))
+            print(p.first, p.second);
+    }
+    s_pending.clear();
+}
+
+bool isEnabled()
+{
+    return s_enabled;
+}
+
+void mark(const char* phase)
+{
+    if (!s_decided)
+        s_pending.append(qMakePair(phase, s_timer.nsecsElapsed()));
+    else if (s_enabled)
+        print(phase, s_timer.nsecsElapsed());
+}
+
+void watchWindow(QWidget* window)
+{
+    if (!s_enabled || window == nullptr || window->windowHandle() == nullptr)
+        return;
+    new StartupWatcher(window->windowHandle());
+}
+
+/**
+ * Called when the sequencer has scheduled the first bar, so its first
+ * click is on the queue. Only the first call is marked.
+ */
+void firstClick()
+{
+    if (s_clicked)
+        return;
+    s_clicked = true;
+    mark("time to first click");
+}
+
+}
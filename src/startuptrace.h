@@ -0,0 +1,40 @@
+/***************************************************************************
+ *   KMetronome - ALSA Sequencer based MIDI metronome                      *
+ *   Copyright (C) 2005-2021 Pedro Lopez-Cabanillas <plcl@users.sf.net>    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
+ ***************************************************************************/
+
+#ifndef STARTUPTRACE_H
+#define STARTUPTRACE_H
+
+class QWidget;
+
+/**
+ * Startup phase tracing, enabled with the --trace-startup option.
+ * Each mark prints the time elapsed since the process started and since
+ * the previous mark. The trace ends when the first metronome click is
+ * scheduled, at the first playback.
+ */
+namespace StartupTrace
+{
+    void start();
+    void setEnabled(bool enabled);
+    bool isEnabled();
+    void mark(const char* phase);
+    void watchWindow(QWidget* window);
+    void firstClick();
+}
+
+#endif // STARTUPTRACE_H
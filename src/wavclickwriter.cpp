@@ -0,0 +1,161 @@
+/***************************************************************************
+ *   KMetronome - ALSA Sequencer based MIDI metronome                      *
+ *   Copyright (C) 2005-2021 Pedro Lopez-Cabanillas <plcl@users.sf.net>    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
+ ***************************************************************************/
+
+
+#include <QIODevice>
+#include <QtEndian>
+#include "wavclickwriter.h"
+
+/* Frames rendered and written at once */
+const int WAV_WRITE_FRAMES(8192);
+const int WAV_CHANNELS(2);
+const int WAV_FRAME_BYTES(WAV_CHANNELS * 2);
+const int WAV_HEADER_BYTES(44);
+/* The sizes of a RIFF file are 32 bit numbers */
+const qint64 WAV_DATA_MAX(Q_INT64_C(0xffffffff) - WAV_HEADER_BYTES);
+
+static void appendNumber(QByteArray& data, quint32 value, int size)
+{
+    for (int i = 0; i < size; ++i)
+        data.append(char((value >> (i * 8)) & 0xff));
+}
+
+WavClickWriter::WavClickWriter(QIODevice* device, int sampleRate) :
+    m_device(device),
+    m_synth(sampleRate),
+    m_headerPos(0),
+    m_frame(0),
+    m_resolution(METRONOME_RESOLUTION)
+{
+    m_samples.resize(WAV_WRITE_FRAMES * WAV_CHANNELS);
+}
+
+/**
+ * Writes the header, with the sizes of an empty file until finish()
+ * patches them, and starts at tick zero with the default tempo.
+ */
+bool WavClickWriter::begin()
+{
+    m_error.clear();
+    m_headerPos = m_device->pos();
+    m_frame = 0;
+    m_synth.reset();
+    m_tempos.clear();
+    clickTempo(0, TEMPO_DEFAULT);
+    return writeHeader();
+}
+
+bool WavClickWriter::writeHeader()
+{
+    quint32 dataSize = quint32(m_frame * WAV_FRAME_BYTES);
+    QByteArray header("RIFF");
+    appendNumber(header, dataSize + WAV_HEADER_BYTES - 8, 4);
+    header.append("WAVEfmt ");
+    appendNumber(header, 16, 4);
+    appendNumber(header, 1, 2); /* PCM */
+    appendNumber(header, WAV_CHANNELS, 2);
+    appendNumber(header, quint32(m_synth.sampleRate()), 4);
+    appendNumber(header, quint32(m_synth.sampleRate() * WAV_FRAME_BYTES), 4);
+    appendNumber(header, WAV_FRAME_BYTES, 2);
+    appendNumber(header, 16, 2);
+    header.append("data");
+    appendNumber(header, dataSize, 4);
+    if (m_device->write(header) != header.size()) {
+        m_error = tr("The audio file can't be written");
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Renders up to the end of the last bar, and patches the sizes of the
+ * header.
+ */
+bool WavClickWriter::finish(int tick)
+{
+    if (!renderTo(qint64(frameOf(tick))))
+        return false;
+    qint64 end = m_device->pos();
+    if (!m_device->seek(m_headerPos) ||
+        !writeHeader() || !m_device->seek(end)) {
+        m_error = tr("The audio file can't be written");
+        return false;
+    }
+    return true;
+}
+
+/* The frame of a tick, after the last tempo change not later than it */
+double WavClickWriter::frameOf(int tick) const
+{
+    int i = m_tempos.count() - 1;
+    while (i > 0 && m_tempos.at(i).tick > tick)
+        --i;
+    const Tempo& tempo = m_tempos.at(i);
+    return tempo.frame + (tick - tempo.tick) * tempo.framesPerTick;
+}
+
+bool WavClickWriter::renderTo(qint64 frame)
+{
+    if (!m_error.isEmpty())
+        return false;
+    if (frame * WAV_FRAME_BYTES > WAV_DATA_MAX) {
+        m_error = tr("The audio is too long for a WAV file");
+        return false;
+    }
+    while (m_frame < frame) {
+        int n = int(qMin(frame - m_frame, qint64(WAV_WRITE_FRAMES)));
+        m_synth.render(m_samples.data(), n);
+#if Q_BYTE_ORDER == Q_BIG_ENDIAN
+        for (int i = 0; i < n * WAV_CHANNELS; ++i)
+            m_samples[i] = qToLittleEndian(m_samples.at(i));
+#endif
+        qint64 bytes = qint64(n) * WAV_FRAME_BYTES;
+        if (m_device->write(reinterpret_cast<const char*>(m_samples.constData()), bytes) != bytes) {
+            m_error = tr("The audio file can't be written");
+            return false;
+        }
+        m_frame += n;
+    }
+    return true;
+}
+
+/**
+ * Renders the audio until the note, which starts then. A note earlier
+ * than the audio already written starts right away.
+ */
+void WavClickWriter::clickNote(int key, int velocity, int tick, int)
+{
+    if (renderTo(qint64(frameOf(tick))))
+        m_synth.noteOn(key, velocity);
+}
+
+/**
+ * Tempo changes come in time order, before the notes they apply to. One
+ * at the same tick as the previous change replaces it.
+ */
+void WavClickWriter::clickTempo(int tick, qreal bpm)
+{
+    Tempo tempo;
+    tempo.tick = tick;
+    tempo.frame = m_tempos.isEmpty() ? 0.0 : frameOf(tick);
+    tempo.framesPerTick = 60.0 * m_synth.sampleRate() / (bpm * m_resolution);
+    if (!m_tempos.isEmpty() && m_tempos.last().tick == tick)
+        m_tempos.last() = tempo;
+    else
+        m_tempos.append(tempo);
+}
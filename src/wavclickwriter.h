@@ -0,0 +1,81 @@
+/***************************************************************************
+ *   KMetronome - ALSA Sequencer based MIDI metronome                      *
+ *   Copyright (C) 2005-2021 Pedro Lopez-Cabanillas <plcl@users.sf.net>    *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program. If not, see <http://www.gnu.org/licenses/>.*
+ ***************************************************************************/
+
+
+#ifndef WAVCLICKWRITER_H
+#define WAVCLICKWRITER_H
+
+#include <QCoreApplication>
+#include <QString>
+#include <QVector>
+#include "clickgenerator.h"
+#include "clicksynth.h"
+
+class QIODevice;
+
+/**
+ * Renders the bars of a ClickGenerator with the ClickSynth, and writes
+ * them as a 16 bit stereo WAV file to a seekable device.
+ *
+ * The audio is streamed: the synthesizer renders up to the frame of each
+ * note as it comes, through a buffer of a few thousand frames, so the
+ * memory used doesn't depend on the length of the file. Ticks become
+ * frames along the tempo changes received. The sizes in the header are
+ * patched when the file is finished.
+ */
+class WavClickWriter : public ClickSink
+{
+    Q_DECLARE_TR_FUNCTIONS(WavClickWriter)
+
+public:
+    explicit WavClickWriter(QIODevice* device, int sampleRate = AUDIO_SAMPLE_RATE);
+
+    void setResolution(int ppq) { m_resolution = ppq; }
+    void setVolume(int volume) { m_synth.setVolume(volume); }
+    void setBalance(int balance) { m_synth.setBalance(balance); }
+    bool begin();
+    bool finish(int tick);
+    qint64 frames() const { return m_frame; }
+    int sampleRate() const { return m_synth.sampleRate(); }
+    QString errorString() const { return m_error; }
+
+    void clickNote(int key, int velocity, int tick, int tag) override;
+    void clickTempo(int tick, qreal bpm) override;
+
+private:
+    struct Tempo {
+        int tick;
+        double frame;
+        double framesPerTick;
+    };
+
+    double frameOf(int tick) const;
+    bool renderTo(qint64 frame);
+    bool writeHeader();
+
+    QIODevice* m_device;
+    ClickSynth m_synth;
+    QVector<qint16> m_samples;
+    QVector<Tempo> m_tempos;
+    qint64 m_headerPos;
+    qint64 m_frame;
+    int m_resolution;
+    QString m_error;
+};
+
+#endif // WAVCLICKWRITER_H